@@ -8,201 +8,2470 @@
 #include <linux/wait.h>
 #include <linux/sched.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <linux/time.h>
 #include <linux/hrtimer.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/rculist.h>
+#include <linux/log2.h>
+#include <linux/capability.h>
+#include <linux/int_sqrt.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/idr.h>
+
+#include "logitech_mouse.h"
 
-#define BUFFER_SIZE 256
 #define DEVICE_NAME "logitech_mouse"
-#define REPORT_INTERVAL_MS 8 // 8ms = 125Hz
-#define REPORT_INTERVAL_NS (REPORT_INTERVAL_MS * 1000000L)
+#define MOUSE_MAX_DEVICES 16 // Minor 0..15: luồng sự kiện, 16..31: metrics của từng chuột
+#define DEFAULT_RING_SIZE 256
+#define MIN_RING_SIZE 16
+#define MAX_RING_SIZE 65536
+#define DEFAULT_REPORT_INTERVAL_US 8000 // 8ms = 125Hz
+#define MAX_REPORT_INTERVAL_US 1000000
+#define DEFAULT_IDLE_TIMEOUT_US 100000 // Dừng timer sau 100ms không có chuyển động
+#define MAX_IDLE_TIMEOUT_US 10000000
+#define DEFAULT_FLUSH_THRESHOLD 64
+#define DEFAULT_AGGREGATE_REPORTS 8 // 8 kHz -> 1 kHz MOVE
+#define MAX_AGGREGATE_REPORTS 1024
+#define DEFAULT_WAKE_BATCH 32
+#define HIGH_RATE_RING_SIZE 4096 // Số slot tối thiểu ở passthrough/aggregate: ~0.5 s ở 8 kHz
+#define MAX_WAKEUP_TIMEOUT_US 10000000
+#define RING_DATA_OFFSET PAGE_SIZE
+#define STASH_SIZE 32 // Số sự kiện producer giữ lại khi overflow_policy = block
+#define METRICS_NAME DEVICE_NAME "_metrics"
+#define METRICS_RING_SIZE 64 // Số bản ghi quỹ đạo gần nhất được giữ lại
+#define TRAJECTORY_MIN_NS (1ULL * NSEC_PER_SEC)
+#define TRAJECTORY_MAX_NS (10ULL * NSEC_PER_SEC)
+#define COSINE_TOLERANCE_PCT 98 // cos(11.5 độ) ~ 0.98, giống pub.c
+#define RESIDENCY_BUCKETS 32 // Bucket k: thời gian nằm trong ring từ 2^k tới 2^(k+1) ns
+#define RAW_REPORT_MAX 64 // Report lớn hơn thì không dùng đường raw_event
+
+#define USB_VENDOR_ID_LOGITECH 0x046d
+#define USB_DEVICE_ID_LOGITECH_C077 0xc077
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Hoai Son & Trong Nhan");
+MODULE_DESCRIPTION("Driver Logitech 046d:c077 with 125Hz move reporting");
+
+// Giá trị ban đầu cho mỗi chuột mới; đổi lúc chạy qua sysfs hoặc MOUSE_IOC_SET_CONFIG
+static unsigned int ring_size = DEFAULT_RING_SIZE;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Number of event slots in the ring (rounded up to a power of 2)");
+
+static unsigned int report_interval_us = DEFAULT_REPORT_INTERVAL_US;
+module_param(report_interval_us, uint, 0444);
+MODULE_PARM_DESC(report_interval_us, "MOVE coalescing interval in microseconds");
+
+static unsigned int overflow_policy = MOUSE_OVERFLOW_DROP_OLDEST;
+module_param(overflow_policy, uint, 0444);
+MODULE_PARM_DESC(overflow_policy, "Ring overflow policy: 0 = drop-oldest, 1 = drop-newest, 2 = block");
+
+static bool tickless = true;
+module_param(tickless, bool, 0444);
+MODULE_PARM_DESC(tickless, "Run the MOVE timer only while the mouse is moving (0 = fixed periodic timer)");
+
+static unsigned int idle_timeout_us = DEFAULT_IDLE_TIMEOUT_US;
+module_param(idle_timeout_us, uint, 0444);
+MODULE_PARM_DESC(idle_timeout_us, "Quiet period in microseconds before the MOVE timer stops in tickless mode");
+
+static bool adaptive_flush;
+module_param(adaptive_flush, bool, 0444);
+MODULE_PARM_DESC(adaptive_flush, "Send MOVE immediately on direction change or large delta");
+
+static unsigned int flush_threshold = DEFAULT_FLUSH_THRESHOLD;
+module_param(flush_threshold, uint, 0444);
+MODULE_PARM_DESC(flush_threshold, "Delta (counts) that triggers an immediate MOVE in adaptive mode");
+
+static unsigned int move_mode = MOUSE_MOVE_COALESCE;
+module_param(move_mode, uint, 0444);
+MODULE_PARM_DESC(move_mode, "MOVE generation: 0 = coalesce every report_interval_us, 1 = passthrough, 2 = aggregate");
+
+static unsigned int aggregate_reports = DEFAULT_AGGREGATE_REPORTS;
+module_param(aggregate_reports, uint, 0444);
+MODULE_PARM_DESC(aggregate_reports, "Motion reports per MOVE in aggregate mode");
+
+static unsigned int wake_batch = DEFAULT_WAKE_BATCH;
+module_param(wake_batch, uint, 0444);
+MODULE_PARM_DESC(wake_batch, "MOVE events queued before readers are woken in passthrough/aggregate mode");
+
+static bool raw_fast_path = true;
+module_param(raw_fast_path, bool, 0444);
+MODULE_PARM_DESC(raw_fast_path, "Parse whole input reports in .raw_event when the descriptor layout is known");
+
+static bool metrics = true;
+module_param(metrics, bool, 0444);
+MODULE_PARM_DESC(metrics, "Create /dev/" METRICS_NAME "N with per-trajectory speed and accuracy");
+
+static const char * const overflow_policy_names[] = {
+    [MOUSE_OVERFLOW_DROP_OLDEST] = "drop-oldest",
+    [MOUSE_OVERFLOW_DROP_NEWEST] = "drop-newest",
+    [MOUSE_OVERFLOW_BLOCK] = "block",
+};
+
+static const char * const move_mode_names[] = {
+    [MOUSE_MOVE_COALESCE] = "coalesce",
+    [MOUSE_MOVE_PASSTHROUGH] = "passthrough",
+    [MOUSE_MOVE_AGGREGATE] = "aggregate",
+};
+
+static dev_t dev_base;
+static struct class *mouse_class;
+static struct dentry *debug_root;
+static DEFINE_IDA(mouse_ida); // Cấp số N cho /dev/logitech_mouseN
+
+// Ring cùng vùng nhớ map được sang user space; được thay thế nguyên khối khi đổi kích thước
+struct event_ring {
+    void *mem;                       // vmalloc_user(): header + các slot
+    size_t mem_size;
+    struct mouse_ring_header *hdr;   // Trang đầu của mem
+    struct mouse_event_v2 *slots;    // Các slot sự kiện sau header
+    u32 mask;                        // capacity - 1
+};
+
+/*
+ * Bộ đếm thống kê, mỗi CPU một bản: đường nóng chỉ làm this_cpu_inc() không
+ * lock, không atomic; sysfs/debugfs cộng dồn các CPU khi đọc.
+ */
+struct mouse_stats {
+    u64 enqueued[4];        // Sự kiện đã ghi vào ring, theo MOUSE_EVENT_*
+    u64 dropped;            // Sự kiện producer tự bỏ (drop-newest/block)
+    u64 reader_lost;        // Sự kiện bị ghi đè trước khi reader read() kịp đọc
+    u64 filtered;           // Sự kiện read() bỏ theo bộ lọc của reader
+    u64 high_water;         // Số sự kiện chờ lớn nhất mà một reader từng thấy (lấy max)
+    u64 motion_reports;     // Report HID có chuyển động (so với enqueued[MOVE] để biết mức gộp)
+    u64 timer_fires;        // Số lần move_timer chạy
+    u64 timer_empty;        // ... trong đó không có MOVE nào để gửi
+    u64 wakeups;            // Số lần đánh thức reader đang chờ
+    u64 residency[RESIDENCY_BUCKETS]; // Thời gian từ lúc tạo sự kiện tới lúc read() lấy ra
+};
+
+/*
+ * Phân đoạn quỹ đạo ngay trong driver, cùng quy tắc với pub.c nhưng không cần
+ * giữ lại các sự kiện: mỗi sự kiện chỉ cập nhật vài tổng tích lũy (số nguyên).
+ */
+struct trajectory_state {
+    u64 start_ns;
+    u32 points;
+    u32 move_run;       // Số MOVE liên tiếp tính tới sự kiện cuối (tối đa 3)
+    s32 prev_dx, prev_dy;
+    u64 path_q8;        // Tổng độ dài, Q.8
+    u32 eqdir, segments;
+};
+
+// Vị trí một usage trong report đầu vào, tính bằng bit; size = 0 khi report không có usage này
+struct report_item {
+    u16 offset;
+    u8 size;
+    bool is_signed;
+};
+
+/*
+ * Bố cục report chuột lấy từ descriptor một lần lúc probe, để raw_event đọc
+ * X/Y/wheel/nút trực tiếp từ report thay vì chờ HID core gọi .event cho từng usage.
+ */
+struct report_layout {
+    bool valid;             // false: descriptor lạ, dùng đường .event chung
+    u8 report_id;
+    bool numbered;          // Byte đầu của report là report ID
+    u32 size;               // Kích thước report (byte, không tính ID)
+    struct report_item x, y, wheel;
+    struct report_item button[3]; // Theo MOUSE_BUTTON_*
+};
+
+/*
+ * Toàn bộ trạng thái của một con chuột, cấp phát trong mouse_probe(). Mỗi chuột
+ * có ring, timer, lock và /dev/logitech_mouseN riêng nên nhiều chuột trên cùng
+ * một máy không tranh chấp nhau. Vòng đời theo dev: file đang mở giữ tham chiếu
+ * qua cdev, struct chỉ được giải phóng trong mouse_dev_release().
+ */
+struct mouse_dev {
+    struct hid_device *hdev;
+    struct device dev;              // /dev/logitech_mouseN và các file sysfs
+    struct cdev cdev;
+    struct cdev metrics_cdev;
+    struct device *metrics_device;  // /dev/logitech_mouse_metricsN
+    struct dentry *debug_dir;
+    int minor;
+    bool disconnected;              // Chuột đã bị rút, reader nhận -ENODEV
+    struct report_layout layout;    // Chỉ đọc sau probe
+
+    // Cấu hình riêng của chuột này, khởi tạo từ module param
+    unsigned int ring_size;
+    unsigned int report_interval_us;
+    unsigned int overflow_policy;
+    bool tickless;
+    unsigned int idle_timeout_us;
+    bool adaptive_flush;
+    unsigned int flush_threshold;
+    unsigned int move_mode;         // MOUSE_MOVE_*, đổi dưới event_lock
+    unsigned int aggregate_reports;
+    unsigned int wake_batch;
+
+    /*
+     * Producer dùng ring dưới event_lock, reader dùng dưới rcu_read_lock().
+     * Đổi kích thước thay con trỏ trong event_lock rồi chờ RCU trước khi giải phóng ring cũ.
+     */
+    struct event_ring __rcu *ring;
+    atomic_t ring_mmap_count;       // Số vma đang map ring
+    struct mutex config_mutex;      // Tuần tự hóa đổi cấu hình với mmap ring
+
+    struct list_head reader_list;
+    spinlock_t reader_list_lock;
+
+    /*
+     * event_lock bảo vệ trạng thái tích lũy (pending_dx/dy, has_x/has_y, last_value)
+     * vốn được cả hrtimer lẫn HID .event sửa, cả hai đều chạy trong ngữ cảnh ngắt.
+     * Mọi lần ghi vào ring đều nằm trong lock này nên ring chỉ có đúng một producer
+     * tại một thời điểm; reader không bao giờ lấy lock này.
+     */
+    spinlock_t event_lock;
+    struct hrtimer move_timer;
+    bool timer_armed;               // move_timer đang chạy hoặc đã hẹn giờ
+    u64 last_motion_ns;             // Thời điểm nhận delta gần nhất
+    u64 move_arrival_ns;            // Thời điểm nhận delta đầu tiên của MOVE đang gộp
+    s32 pending_dx, pending_dy;     // Delta MOVE đang gộp, luôn vừa trong s16
+    int has_x, has_y;
+    u32 pending_reports;            // Số report có chuyển động trong MOVE đang gộp
+    bool report_motion;             // Đường .event: report đang xử lý có chuyển động
+    u32 wake_pending;               // MOVE đã vào ring nhưng chưa đánh thức reader mặc định
+    int last_value[3];              // Trạng thái nút trước đó
+
+    // Sự kiện chưa ghi được vào ring (drop-newest/block); phần tử cuối có thể là GAP
+    struct mouse_event_v2 stash[STASH_SIZE];
+    u32 stash_count;
+
+    // Quỹ đạo đang thu thập và các bản ghi đã xong, cũng dưới event_lock
+    struct trajectory_state traj;
+    struct mouse_metrics metrics_ring[METRICS_RING_SIZE];
+    u32 metrics_head;
+    wait_queue_head_t metrics_queue;
+
+    struct mouse_stats __percpu *stats;
+};
+
+#define to_mouse_dev(d) container_of(d, struct mouse_dev, dev)
+
+// Trạng thái riêng của mỗi lần open(): con trỏ đọc và số sự kiện bị mất
+struct mouse_reader {
+    struct mouse_dev *mdev;
+    struct list_head node;          // Trong reader_list, producer duyệt bằng RCU
+    struct mouse_ring_reader *ctl;  // Trang điều khiển, map được sang user space
+    struct mouse_event_v2 *bounce;  // Bản sao tạm các slot, bounce[0] dành cho GAP
+    u32 bounce_size;
+    u32 abi;                        // MOUSE_ABI_* trả về qua read()
+    struct mutex lock;              // Tuần tự hóa read() trên cùng một file
+
+    /*
+     * Mỗi reader một wait queue để producer chỉ đánh thức đúng reader đã tới ngưỡng.
+     * Không có ngưỡng và bộ lọc: theo driver (mọi sự kiện, hoặc wake_batch ở
+     * passthrough/aggregate). Ngược lại read()/poll() chỉ báo có dữ liệu khi ready
+     * được bật, bộ lọc mà không có ngưỡng thì mỗi sự kiện khớp là đủ.
+     */
+    wait_queue_head_t wait;
+    struct mouse_wakeup wakeup;     // Đổi dưới lock, producer đọc bằng READ_ONCE
+    struct mouse_filter filter;     // Như wakeup
+    bool filtering;                 // filter đang bật, ghi sau cùng
+    bool ready;                     // Đã tới ngưỡng, hạ khi reader đọc hết
+    atomic_t wake_count;            // Sự kiện khớp bộ lọc kể từ lần đọc hết trước
+    struct hrtimer wake_timer;      // Hạn timeout_us tính từ sự kiện chưa đọc đầu tiên
+    atomic_t wake_timer_armed;
+};
+
+#define stats_inc(mdev, field) this_cpu_inc((mdev)->stats->field)
+
+static u64 stats_sum(struct mouse_dev *mdev, size_t offset) {
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        sum += *(u64 *)((char *)per_cpu_ptr(mdev->stats, cpu) + offset);
+    }
+    return sum;
+}
+
+#define STATS_SUM(mdev, field) stats_sum(mdev, offsetof(struct mouse_stats, field))
+
+static void stats_update_high_water(struct mouse_dev *mdev, u32 depth) {
+    struct mouse_stats *stats = get_cpu_ptr(mdev->stats);
+
+    if (depth > stats->high_water) {
+        stats->high_water = depth;
+    }
+    put_cpu_ptr(mdev->stats);
+}
+
+static struct event_ring *alloc_ring(u32 capacity) {
+    struct event_ring *r;
+
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r) {
+        return NULL;
+    }
+
+    r->mem_size = RING_DATA_OFFSET + PAGE_ALIGN(capacity * sizeof(struct mouse_event_v2));
+    // vmalloc_user() trả về vùng nhớ đã xóa về 0 và cho phép remap sang user space
+    r->mem = vmalloc_user(r->mem_size);
+    if (!r->mem) {
+        kfree(r);
+        return NULL;
+    }
+
+    r->hdr = r->mem;
+    r->hdr->magic = MOUSE_RING_MAGIC;
+    r->hdr->version = MOUSE_RING_VERSION;
+    r->hdr->capacity = capacity;
+    r->hdr->event_size = sizeof(struct mouse_event_v2);
+    r->hdr->data_offset = RING_DATA_OFFSET;
+    r->slots = r->mem + RING_DATA_OFFSET;
+    r->mask = capacity - 1;
+    return r;
+}
+
+static void free_ring(struct event_ring *r) {
+    if (r) {
+        vfree(r->mem);
+        kfree(r);
+    }
+}
+
+static inline u32 ring_head(struct mouse_dev *mdev) {
+    u32 head;
+
+    rcu_read_lock();
+    head = smp_load_acquire(&rcu_dereference(mdev->ring)->hdr->head);
+    rcu_read_unlock();
+    return head;
+}
+
+static inline bool reader_has_data(struct mouse_reader *reader) {
+    return ring_head(reader->mdev) != READ_ONCE(reader->ctl->tail);
+}
+
+static inline struct event_ring *producer_ring(struct mouse_dev *mdev) {
+    return rcu_dereference_protected(mdev->ring, lockdep_is_held(&mdev->event_lock));
+}
+
+static void ring_write(struct mouse_dev *mdev, struct event_ring *r, const struct mouse_event_v2 *event) {
+    u32 head = r->hdr->head;
+
+    r->slots[head & r->mask] = *event;
+    // Slot phải được ghi xong trước khi reader nhìn thấy head mới
+    smp_store_release(&r->hdr->head, head + 1);
+    stats_inc(mdev, enqueued[MOUSE_EVENT_TYPE(event->info)]);
+}
+
+/*
+ * Số sự kiện reader chưa đọc. tail nằm trong vùng nhớ user space map được nên có
+ * thể là giá trị bất kỳ: tail vượt head tính là 0, tụt quá một vòng ring tính là
+ * capacity (reader đó đã bị ghi đè, read() sẽ báo GAP).
+ */
+static inline u32 reader_depth(struct mouse_reader *reader, u32 head, u32 capacity) {
+    s32 depth = (s32)(head - READ_ONCE(reader->ctl->tail));
+
+    return depth <= 0 ? 0 : min_t(u32, depth, capacity);
+}
+
+// Số slot còn trống tính theo reader chậm nhất (chỉ dùng cho drop-newest/block)
+static u32 ring_room(struct mouse_dev *mdev, struct event_ring *r) {
+    struct mouse_reader *reader;
+    u32 capacity = r->mask + 1;
+    u32 head = r->hdr->head;
+    u32 used = 0;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        used = max(used, reader_depth(reader, head, capacity));
+    }
+    rcu_read_unlock();
+    stats_update_high_water(mdev, used);
+
+    return used >= capacity ? 0 : capacity - used;
+}
+
+/*
+ * Giữ sự kiện lại; khi hết chỗ thì gộp vào một sự kiện GAP ở slot cuối để giữ thứ tự.
+ * Trả về false nếu sự kiện bị bỏ.
+ */
+static bool stash_event(struct mouse_dev *mdev, const struct mouse_event_v2 *event, u32 limit) {
+    struct mouse_event_v2 *last = mdev->stash_count ? &mdev->stash[mdev->stash_count - 1] : NULL;
+
+    if (mdev->stash_count + 1 < limit) {
+        mdev->stash[mdev->stash_count++] = *event;
+        return true;
+    }
+
+    stats_inc(mdev, dropped);
+    dev_warn_ratelimited(&mdev->dev, "ring full, event dropped\n");
+    // Quỹ đạo đang tính đã có sự kiện bị mất: bỏ, giống reader khi gặp GAP
+    memset(&mdev->traj, 0, sizeof(mdev->traj));
+    if (last && MOUSE_EVENT_TYPE(last->info) == MOUSE_EVENT_GAP) {
+        mouse_event_set_gap_count(last, mouse_event_gap_count(last) + 1);
+        return false;
+    }
+
+    last = &mdev->stash[mdev->stash_count++];
+    memset(last, 0, sizeof(*last));
+    last->timestamp_ns = event->timestamp_ns;
+    last->info = MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0);
+    mouse_event_set_gap_count(last, 1);
+    return false;
+}
+
+static void reader_wake(struct mouse_reader *reader) {
+    // wq_has_sleeper() có sẵn memory barrier, tránh lấy lock của wait queue khi không ai chờ
+    if (wq_has_sleeper(&reader->wait)) {
+        wake_up_interruptible(&reader->wait);
+        stats_inc(reader->mdev, wakeups);
+    }
+}
+
+// Reader dùng cờ ready thay vì báo có dữ liệu ngay khi ring có sự kiện mới
+static inline bool reader_selective(struct mouse_reader *reader) {
+    return READ_ONCE(reader->wakeup.events) || READ_ONCE(reader->filtering);
+}
+
+static void reader_get_filter(struct mouse_reader *reader, struct mouse_filter *filter) {
+    filter->types = READ_ONCE(reader->filter.types);
+    filter->buttons = READ_ONCE(reader->filter.buttons);
+    filter->min_motion = READ_ONCE(reader->filter.min_motion);
+    filter->reserved = 0;
+}
+
+static bool reader_wants(struct mouse_reader *reader, const struct mouse_event_v2 *event) {
+    struct mouse_filter filter;
+
+    if (!READ_ONCE(reader->filtering)) {
+        return true;
+    }
+    reader_get_filter(reader, &filter);
+    return mouse_filter_match(&filter, event);
+}
+
+/*
+ * Đếm (tối đa limit) sự kiện khớp bộ lọc trong phần reader chưa đọc. Không lấy
+ * lock: slot bị producer ghi đè giữa chừng chỉ làm sai số đếm, read() vẫn báo GAP.
+ */
+static u32 reader_count_matching(struct mouse_reader *reader, u32 limit) {
+    struct mouse_filter filter;
+    struct mouse_event_v2 event;
+    struct event_ring *r;
+    u32 head, seq, n = 0;
+
+    reader_get_filter(reader, &filter);
+    rcu_read_lock();
+    r = rcu_dereference(reader->mdev->ring);
+    head = smp_load_acquire(&r->hdr->head);
+    for (seq = head - reader_depth(reader, head, r->mask + 1); seq != head && n < limit; seq++) {
+        event = r->slots[seq & r->mask];
+        n += mouse_filter_match(&filter, &event);
+    }
+    rcu_read_unlock();
+    return n;
+}
+
+/*
+ * Xét ngưỡng đánh thức của reader_selective(); type_mask là BIT(type) của sự kiện
+ * (khớp bộ lọc) vừa vào ring, 0 nếu không có sự kiện mới. Gọi từ producer
+ * (event_lock) và từ reader vừa đọc hết, nên chỉ dùng thao tác nguyên tử.
+ * Ngưỡng số sự kiện tối đa bằng nửa ring để reader không bị ghi đè khi đang ngủ.
+ */
+static void reader_check_wakeup(struct mouse_reader *reader, u32 type_mask) {
+    struct event_ring *r;
+    u32 pending, threshold, timeout_us;
+
+    if (READ_ONCE(reader->ready)) {
+        return;
+    }
+    rcu_read_lock();
+    r = rcu_dereference(reader->mdev->ring);
+    pending = reader_depth(reader, smp_load_acquire(&r->hdr->head), r->mask + 1);
+    threshold = clamp_t(u32, READ_ONCE(reader->wakeup.events), 1, (r->mask + 1) / 2);
+    rcu_read_unlock();
+    if (pending == 0) {
+        return;
+    }
+    /*
+     * Có bộ lọc thì chỉ đếm sự kiện khớp. Khi xét lại mà không có sự kiện mới,
+     * sự kiện khớp tới đúng lúc wake_count bị xóa có thể chưa được đếm: đếm lại
+     * trong ring. Không có sự kiện khớp nào thì không đánh thức, cũng không hẹn giờ.
+     */
+    if (READ_ONCE(reader->filtering)) {
+        pending = atomic_read(&reader->wake_count);
+        if (!type_mask) {
+            u32 matching = reader_count_matching(reader, threshold);
+
+            // Producer vừa tăng wake_count thì giữ giá trị của nó
+            if (matching > pending && atomic_cmpxchg(&reader->wake_count, pending, matching) == pending) {
+                pending = matching;
+            }
+        }
+        if (pending == 0) {
+            return;
+        }
+    }
+
+    // GAP luôn đánh thức ngay: reader đang bị mất sự kiện
+    if (pending >= threshold || (type_mask & (READ_ONCE(reader->wakeup.flags) | BIT(MOUSE_EVENT_GAP)))) {
+        WRITE_ONCE(reader->ready, true);
+        reader_wake(reader);
+        return;
+    }
+    timeout_us = READ_ONCE(reader->wakeup.timeout_us);
+    if (timeout_us && !atomic_xchg(&reader->wake_timer_armed, 1)) {
+        hrtimer_start(&reader->wake_timer, ns_to_ktime((u64)timeout_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+    }
+}
+
+static enum hrtimer_restart reader_timer_callback(struct hrtimer *timer) {
+    struct mouse_reader *reader = container_of(timer, struct mouse_reader, wake_timer);
+
+    atomic_set(&reader->wake_timer_armed, 0);
+    // Reader có bộ lọc chỉ được đánh thức khi phần chưa đọc có sự kiện khớp
+    if (reader_has_data(reader) && (!READ_ONCE(reader->filtering) || reader_count_matching(reader, 1))) {
+        WRITE_ONCE(reader->ready, true);
+        reader_wake(reader);
+    }
+    return HRTIMER_NORESTART;
+}
+
+/*
+ * read()/poll() có trả dữ liệu không. Reader có ngưỡng đã đọc hết thì hạ ready để
+ * lần chờ sau lại theo ngưỡng; sự kiện tới đúng lúc đó được xét lại như producer làm.
+ */
+static bool reader_ready(struct mouse_reader *reader) {
+    if (!reader_selective(reader)) {
+        return reader_has_data(reader);
+    }
+    if (READ_ONCE(reader->ready)) {
+        if (reader_has_data(reader)) {
+            return true;
+        }
+        atomic_set(&reader->wake_count, 0);
+        WRITE_ONCE(reader->ready, false);
+        // Cặp với smp_mb() trong notify_readers(): hoặc producer thấy ready = false,
+        // hoặc ở đây thấy head mới của nó
+        smp_mb();
+        reader_check_wakeup(reader, 0);
+    }
+    return READ_ONCE(reader->ready);
+}
+
+// Đánh thức các reader theo ngưỡng mặc định của driver
+static void wake_readers(struct mouse_dev *mdev) {
+    struct mouse_reader *reader;
+
+    mdev->wake_pending = 0;
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        if (!reader_selective(reader)) {
+            reader_wake(reader);
+        }
+    }
+    rcu_read_unlock();
+}
+
+static inline ktime_t report_interval(struct mouse_dev *mdev) {
+    return ns_to_ktime((u64)READ_ONCE(mdev->report_interval_us) * NSEC_PER_USEC);
+}
+
+// Hẹn giờ cho move_timer nếu nó đang dừng; gọi trong event_lock
+static void arm_move_timer(struct mouse_dev *mdev) {
+    lockdep_assert_held(&mdev->event_lock);
+
+    // Sau khi chuột bị rút, mouse_remove() đã hủy timer và không được bật lại
+    if (!mdev->timer_armed && !mdev->disconnected) {
+        mdev->timer_armed = true;
+        hrtimer_start(&mdev->move_timer, report_interval(mdev), HRTIMER_MODE_REL);
+    }
+}
+
+/*
+ * Reader có ngưỡng riêng (MOUSE_IOC_SET_WAKEUP) được xét từng cái. Với reader mặc
+ * định: ở passthrough/aggregate, 8 kHz report sẽ thành 8000 lần đánh thức mỗi giây
+ * nếu mỗi MOVE đánh thức reader. MOVE chỉ được đếm lại, reader được đánh thức khi
+ * đủ wake_batch sự kiện hoặc ở nhịp move_timer kế tiếp (tối đa report_interval_us).
+ * Sự kiện khác đánh thức ngay, kéo theo cả các MOVE đang chờ.
+ */
+static void notify_readers(struct mouse_dev *mdev, const struct mouse_event_v2 *event) {
+    u32 type = MOUSE_EVENT_TYPE(event->info);
+    bool wake_default = mdev->move_mode == MOUSE_MOVE_COALESCE || type != MOUSE_EVENT_MOVE ||
+                        mdev->wake_pending + 1 >= READ_ONCE(mdev->wake_batch);
+    struct mouse_reader *reader;
+
+    mdev->wake_pending = wake_default ? 0 : mdev->wake_pending + 1;
+    // head mới phải thấy được trước khi đọc ready, xem reader_ready()
+    smp_mb();
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        // Sự kiện bị lọc không được đếm và không đánh thức reader này
+        if (!reader_wants(reader, event)) {
+            continue;
+        }
+        if (reader_selective(reader)) {
+            if (READ_ONCE(reader->filtering)) {
+                atomic_inc(&reader->wake_count);
+            }
+            reader_check_wakeup(reader, BIT(type));
+        } else if (wake_default) {
+            reader_wake(reader);
+        }
+    }
+    rcu_read_unlock();
+    if (!wake_default) {
+        arm_move_timer(mdev);
+    }
+}
+
+// Ghi các sự kiện đang giữ lại theo đúng thứ tự, trong giới hạn room,
+// báo reader cho từng sự kiện như khi ghi trực tiếp (GAP đánh thức ngay)
+static void flush_stash(struct mouse_dev *mdev, struct event_ring *r, u32 *room) {
+    u32 n = min(mdev->stash_count, *room);
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        ring_write(mdev, r, &mdev->stash[i]);
+        notify_readers(mdev, &mdev->stash[i]);
+    }
+    memmove(mdev->stash, mdev->stash + n, (mdev->stash_count - n) * sizeof(mdev->stash[0]));
+    mdev->stash_count -= n;
+    *room -= n;
+}
+
+/*
+ * Ghi một sự kiện theo overflow_policy:
+ *   drop-oldest: không bao giờ chờ reader, slot cũ nhất bị ghi đè khi ring đầy
+ *   drop-newest: bỏ sự kiện mới khi reader chậm nhất chưa đọc hết ring
+ *   block:       giữ tối đa STASH_SIZE sự kiện ở producer tới khi ring có chỗ
+ * Sự kiện bị bỏ ở producer được báo cho reader bằng một sự kiện GAP. Trả về false
+ * nếu sự kiện bị bỏ; sự kiện đang giữ sẽ vào ring theo đúng thứ tự.
+ */
+static bool enqueue_event(struct mouse_dev *mdev, const struct mouse_event_v2 *event) {
+    struct event_ring *r = producer_ring(mdev);
+    bool kept = true;
+    u32 room;
+
+    lockdep_assert_held(&mdev->event_lock);
+
+    if (mdev->overflow_policy == MOUSE_OVERFLOW_DROP_OLDEST) {
+        room = U32_MAX;
+        flush_stash(mdev, r, &room);
+        ring_write(mdev, r, event);
+        notify_readers(mdev, event);
+    } else {
+        room = ring_room(mdev, r);
+        flush_stash(mdev, r, &room);
+        if (mdev->stash_count == 0 && room > 0) {
+            ring_write(mdev, r, event);
+            notify_readers(mdev, event);
+        } else {
+            // Reader được báo khi flush_stash() thực sự ghi sự kiện vào ring
+            kept = stash_event(mdev, event, mdev->overflow_policy == MOUSE_OVERFLOW_BLOCK ? STASH_SIZE : 1);
+            // Timer đẩy phần đang giữ khi reader đọc bớt
+            arm_move_timer(mdev);
+        }
+    }
+    return kept;
+}
+
+/*
+ * Gọi mỗi nhịp timer: đẩy các sự kiện đang giữ nếu reader đã đọc bớt, và cho
+ * biết có được gửi MOVE không. Với policy block, khi ring đầy MOVE không bị bỏ
+ * mà tiếp tục tích lũy delta tới nhịp sau.
+ */
+static bool can_flush_move(struct mouse_dev *mdev) {
+    struct event_ring *r = producer_ring(mdev);
+    u32 room;
+
+    if (mdev->overflow_policy == MOUSE_OVERFLOW_DROP_OLDEST) {
+        return true;
+    }
+    room = ring_room(mdev, r);
+    if (mdev->stash_count) {
+        flush_stash(mdev, r, &room);
+    }
+    return mdev->overflow_policy != MOUSE_OVERFLOW_BLOCK || (mdev->stash_count == 0 && room > 0);
+}
+
+static int resize_ring(struct mouse_dev *mdev, u32 capacity) {
+    struct event_ring *old, *new;
+    struct mouse_reader *reader;
+    unsigned long flags;
+    u32 head, n, seq;
+
+    lockdep_assert_held(&mdev->config_mutex);
+
+    old = rcu_dereference_protected(mdev->ring, lockdep_is_held(&mdev->config_mutex));
+    if (capacity == old->mask + 1) {
+        return 0;
+    }
+    // Không thể thay vùng nhớ đang được map sang user space
+    if (atomic_read(&mdev->ring_mmap_count)) {
+        return -EBUSY;
+    }
+
+    new = alloc_ring(capacity);
+    if (!new) {
+        return -ENOMEM;
+    }
+
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    head = old->hdr->head;
+    // Số sự kiện reader chậm nhất chưa đọc; phần cũ hơn đã bị ghi đè trong ring cũ
+    n = 0;
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        n = max(n, reader_depth(reader, head, old->mask + 1));
+    }
+    rcu_read_unlock();
+    // Thu nhỏ ring sẽ làm mất sự kiện còn trong hàng đợi: thử lại sau khi reader đọc bớt
+    if (capacity < n) {
+        spin_unlock_irqrestore(&mdev->event_lock, flags);
+        free_ring(new);
+        return -EBUSY;
+    }
+    // Chỉ copy phần reader còn cần, giữ nguyên số thứ tự để tail vẫn trỏ đúng sự kiện
+    for (seq = head - n; seq != head; seq++) {
+        new->slots[seq & new->mask] = old->slots[seq & old->mask];
+    }
+    new->hdr->head = head;
+    rcu_assign_pointer(mdev->ring, new);
+    mdev->ring_size = capacity;
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+
+    // Chờ mọi reader đang copy từ ring cũ
+    synchronize_rcu();
+    free_ring(old);
+    return 0;
+}
+
+static int set_ring_size(struct mouse_dev *mdev, unsigned int size) {
+    if (size < MIN_RING_SIZE || size > MAX_RING_SIZE) {
+        return -EINVAL;
+    }
+    return resize_ring(mdev, roundup_pow_of_two(size));
+}
+
+static int set_report_interval(struct mouse_dev *mdev, unsigned int interval_us) {
+    if (interval_us == 0 || interval_us > MAX_REPORT_INTERVAL_US) {
+        return -EINVAL;
+    }
+    // Có hiệu lực từ lần timer chạy tiếp theo
+    WRITE_ONCE(mdev->report_interval_us, interval_us);
+    return 0;
+}
+
+static int set_overflow_policy(struct mouse_dev *mdev, unsigned int policy) {
+    unsigned long flags;
+
+    if (policy >= ARRAY_SIZE(overflow_policy_names)) {
+        return -EINVAL;
+    }
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    mdev->overflow_policy = policy;
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+    return 0;
+}
+
+/*
+ * Đổi cách tạo MOVE; gọi dưới config_mutex. Ở passthrough/aggregate ring được nới
+ * tới HIGH_RATE_RING_SIZE nếu đang nhỏ hơn; ring đang được map thì giữ nguyên kích
+ * thước (người dùng tự đổi ring_size sau khi reader mmap đóng).
+ */
+static int set_move_mode(struct mouse_dev *mdev, unsigned int mode) {
+    unsigned long flags;
+
+    lockdep_assert_held(&mdev->config_mutex);
+
+    if (mode >= ARRAY_SIZE(move_mode_names)) {
+        return -EINVAL;
+    }
+    if (mode != MOUSE_MOVE_COALESCE && mdev->ring_size < HIGH_RATE_RING_SIZE &&
+        resize_ring(mdev, HIGH_RATE_RING_SIZE) < 0) {
+        dev_warn(&mdev->dev, "ring is mapped, keeping %u slots for %s mode\n",
+                 mdev->ring_size, move_mode_names[mode]);
+    }
+
+    // MOVE đang gộp dở và reader chưa được đánh thức đều do timer (đang chạy) xử lý tiếp
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    mdev->move_mode = mode;
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+    return 0;
+}
+
+static int apply_config(struct mouse_dev *mdev, const struct mouse_config *config) {
+    int ret;
+
+    if (config->ring_size < MIN_RING_SIZE || config->ring_size > MAX_RING_SIZE ||
+        config->report_interval_us == 0 || config->report_interval_us > MAX_REPORT_INTERVAL_US ||
+        config->overflow_policy >= ARRAY_SIZE(overflow_policy_names)) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&mdev->config_mutex);
+    ret = set_ring_size(mdev, config->ring_size);
+    if (!ret) {
+        set_report_interval(mdev, config->report_interval_us);
+        set_overflow_policy(mdev, config->overflow_policy);
+    }
+    mutex_unlock(&mdev->config_mutex);
+    return ret;
+}
+
+static int mouse_open(struct inode *inode, struct file *file) {
+    // cdev là con của mdev->dev nên file đang mở giữ mdev sống tới khi release()
+    struct mouse_dev *mdev = container_of(inode->i_cdev, struct mouse_dev, cdev);
+    struct mouse_reader *reader;
+
+    if (READ_ONCE(mdev->disconnected)) {
+        return -ENODEV;
+    }
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader) {
+        return -ENOMEM;
+    }
+
+    reader->ctl = (struct mouse_ring_reader *)get_zeroed_page(GFP_KERNEL);
+    if (!reader->ctl) {
+        kfree(reader);
+        return -ENOMEM;
+    }
+    reader->mdev = mdev;
+    reader->abi = MOUSE_ABI_V1;
+
+    mutex_init(&reader->lock);
+    init_waitqueue_head(&reader->wait);
+    hrtimer_init(&reader->wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    reader->wake_timer.function = reader_timer_callback;
+    // Giống evdev: reader mới chỉ nhận các sự kiện xảy ra sau khi open()
+    reader->ctl->tail = ring_head(mdev);
+
+    spin_lock(&mdev->reader_list_lock);
+    list_add_tail_rcu(&reader->node, &mdev->reader_list);
+    spin_unlock(&mdev->reader_list_lock);
+
+    file->private_data = reader;
+    return 0;
+}
+
+// Histogram log2 của thời gian từ lúc sự kiện vào ring tới lúc được read() lấy ra
+static void record_residency(struct mouse_dev *mdev, const struct mouse_event_v2 *events, u32 count) {
+    u64 now = ktime_get_ns();
+    u32 i, bucket;
+
+    for (i = 0; i < count; i++) {
+        bucket = ilog2(max_t(u64, now - mouse_event_flush_ns(&events[i]), 1));
+        stats_inc(mdev, residency[min_t(u32, bucket, RESIDENCY_BUCKETS - 1)]);
+    }
+}
+
+// Dồn các sự kiện khớp bộ lọc của reader lên đầu mảng, trả về số sự kiện còn lại
+static u32 reader_filter(struct mouse_reader *reader, struct mouse_event_v2 *events, u32 count) {
+    struct mouse_filter filter;
+    u32 i, n = 0;
+
+    if (!READ_ONCE(reader->filtering)) {
+        return count;
+    }
+    reader_get_filter(reader, &filter);
+    for (i = 0; i < count; i++) {
+        if (mouse_filter_match(&filter, &events[i])) {
+            events[n++] = events[i];
+        }
+    }
+    this_cpu_add(reader->mdev->stats->filtered, count - n);
+    return n;
+}
+
+/*
+ * Copy tối đa max_events sự kiện của reader vào bounce mà không lấy lock.
+ * Phần bị producer ghi đè (trước hoặc trong lúc copy) được thay bằng một sự
+ * kiện GAP. Trả về số sự kiện bắt đầu từ bounce[*start], hoặc mã lỗi âm.
+ */
+static int reader_fetch(struct mouse_reader *reader, u32 max_events, u32 *start) {
+    struct mouse_dev *mdev = reader->mdev;
+    struct event_ring *r;
+    struct mouse_event_v2 *gap;
+    u32 capacity, head, tail, lost, count, idx, chunk, skip;
+
+    for (;;) {
+        rcu_read_lock();
+        r = rcu_dereference(mdev->ring);
+        capacity = r->mask + 1;
+        if (reader->bounce_size > capacity) {
+            break;
+        }
+        rcu_read_unlock();
+
+        // Ring vừa được mở rộng: cấp lại bounce ngoài vùng RCU
+        kvfree(reader->bounce);
+        reader->bounce = kvmalloc_array(capacity + 1, sizeof(struct mouse_event_v2), GFP_KERNEL);
+        reader->bounce_size = reader->bounce ? capacity + 1 : 0;
+        if (!reader->bounce) {
+            return -ENOMEM;
+        }
+    }
+
+    head = smp_load_acquire(&r->hdr->head);
+    tail = READ_ONCE(reader->ctl->tail);
+    stats_update_high_water(mdev, min(head - tail, capacity));
+    lost = 0;
+    if (head - tail > capacity) {
+        // Reader bị producer vượt quá một vòng ring
+        lost = head - tail - capacity;
+        tail = head - capacity;
+    }
+
+    // Chừa một chỗ cho GAP nếu đã biết có sự kiện bị mất
+    count = min_t(u32, head - tail, max_events - (lost ? 1 : 0));
+    idx = tail & r->mask;
+    chunk = min_t(u32, count, capacity - idx);
+    memcpy(reader->bounce + 1, &r->slots[idx], chunk * sizeof(struct mouse_event_v2));
+    memcpy(reader->bounce + 1 + chunk, &r->slots[0], (count - chunk) * sizeof(struct mouse_event_v2));
+
+    // Producer đang ghi (hoặc đã ghi) sự kiện head, tức là đè lên sự kiện head - capacity
+    smp_rmb();
+    head = READ_ONCE(r->hdr->head);
+    rcu_read_unlock();
+
+    skip = head - capacity - tail + 1;
+    if ((s32)skip <= 0) {
+        skip = 0;
+    } else if (skip > count) {
+        skip = count;
+    }
+    lost += skip;
+    WRITE_ONCE(reader->ctl->tail, tail + count);
+    record_residency(mdev, reader->bounce + 1 + skip, count - skip);
+    count = skip + reader_filter(reader, reader->bounce + 1 + skip, count - skip);
+
+    if (!lost) {
+        *start = 1;
+        return count;
+    }
+
+    // GAP nằm ngay trước các sự kiện còn hợp lệ (đè lên slot hỏng cuối cùng nếu có)
+    reader->ctl->lost += lost;
+    this_cpu_add(mdev->stats->reader_lost, lost);
+    gap = &reader->bounce[skip];
+    memset(gap, 0, sizeof(*gap));
+    gap->timestamp_ns = ktime_get_ns();
+    gap->info = MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0);
+    mouse_event_set_gap_count(gap, min_t(u32, lost, INT_MAX));
+    *start = skip;
+    return count - skip + 1;
+}
+
+// Đổi bản ghi v2 sang v1: thời gian monotonic được quy đổi về thời gian thực
+static void event_to_v1(const struct mouse_event_v2 *in, struct mouse_event *out) {
+    struct timespec64 ts = ktime_to_timespec64(ktime_mono_to_real(ns_to_ktime(in->timestamp_ns)));
+
+    memset(out, 0, sizeof(*out));
+    out->timestamp_sec = ts.tv_sec;
+    out->timestamp_nsec = ts.tv_nsec;
+    out->type = MOUSE_EVENT_TYPE(in->info);
+    switch (out->type) {
+    case MOUSE_EVENT_MOVE:
+        out->x = in->dx;
+        out->y = in->dy;
+        break;
+    case MOUSE_EVENT_CLICK:
+        out->button = MOUSE_EVENT_BUTTON(in->info);
+        out->action = MOUSE_EVENT_ACTION(in->info);
+        break;
+    case MOUSE_EVENT_WHEEL:
+        out->wheel_value = in->dx;
+        break;
+    case MOUSE_EVENT_GAP:
+        out->x = min_t(u32, mouse_event_gap_count(in), INT_MAX);
+        break;
+    }
+}
+
+static int copy_events_v1(char __user *user_buffer, const struct mouse_event_v2 *events, u32 count) {
+    struct mouse_event chunk[8];
+    u32 i, n;
+
+    // Đổi theo từng nhóm nhỏ để không cần thêm bộ đệm v1 cỡ cả ring
+    while (count) {
+        n = min_t(u32, count, ARRAY_SIZE(chunk));
+        for (i = 0; i < n; i++) {
+            event_to_v1(&events[i], &chunk[i]);
+        }
+        if (copy_to_user(user_buffer, chunk, n * sizeof(chunk[0]))) {
+            return -EFAULT;
+        }
+        user_buffer += n * sizeof(chunk[0]);
+        events += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static ssize_t mouse_read(struct file *file, char __user *user_buffer, size_t size, loff_t *offset) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    size_t record_size, max_events;
+    u32 start = 0;
+    ssize_t ret = 0;
+
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mutex_trylock(&reader->lock)) {
+            return -EAGAIN;
+        }
+    } else if (mutex_lock_interruptible(&reader->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    record_size = reader->abi == MOUSE_ABI_V2 ? sizeof(struct mouse_event_v2) : sizeof(struct mouse_event);
+    max_events = min_t(size_t, size / record_size, MAX_RING_SIZE);
+    if (max_events == 0) {
+        ret = -EINVAL;
+        goto out_unlock;
+    }
+
+    do {
+        if (!reader_ready(reader)) {
+            // Phần còn lại trong ring vẫn đọc được sau khi chuột bị rút
+            if (READ_ONCE(mdev->disconnected)) {
+                ret = -ENODEV;
+                goto out_unlock;
+            }
+            if (file->f_flags & O_NONBLOCK) {
+                ret = -EAGAIN;
+                goto out_unlock;
+            }
+            if (wait_event_interruptible(reader->wait,
+                                         reader_ready(reader) || READ_ONCE(mdev->disconnected))) {
+                ret = -ERESTARTSYS;
+                goto out_unlock;
+            }
+            continue;
+        }
+        // Có thể không lấy được gì nếu tail vừa bị đổi qua mmap, khi đó chờ tiếp
+        ret = reader_fetch(reader, max_events, &start);
+    } while (ret == 0);
+
+    if (ret < 0) {
+        goto out_unlock;
+    }
+
+    if (reader->abi == MOUSE_ABI_V2) {
+        if (copy_to_user(user_buffer, reader->bounce + start, ret * record_size)) {
+            ret = -EFAULT;
+            goto out_unlock;
+        }
+    } else if (copy_events_v1(user_buffer, reader->bounce + start, ret)) {
+        ret = -EFAULT;
+        goto out_unlock;
+    }
+
+    ret *= record_size;
+
+out_unlock:
+    mutex_unlock(&reader->lock);
+    return ret;
+}
+
+static __poll_t mouse_poll(struct file *file, poll_table *wait) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    __poll_t mask;
+
+    poll_wait(file, &reader->wait, wait);
+    mask = reader_ready(reader) ? EPOLLIN | EPOLLRDNORM : 0;
+    if (READ_ONCE(mdev->disconnected)) {
+        mask |= EPOLLHUP | EPOLLERR;
+    }
+    return mask;
+}
+
+// Đếm số mapping của ring để không thay ring khi user space còn đang map
+static void ring_vma_open(struct vm_area_struct *vma) {
+    struct mouse_dev *mdev = vma->vm_private_data;
+
+    atomic_inc(&mdev->ring_mmap_count);
+}
+
+static void ring_vma_close(struct vm_area_struct *vma) {
+    struct mouse_dev *mdev = vma->vm_private_data;
+
+    atomic_dec(&mdev->ring_mmap_count);
+}
+
+static const struct vm_operations_struct ring_vm_ops = {
+    .open = ring_vma_open,
+    .close = ring_vma_close,
+};
+
+/*
+ * Trang điều khiển riêng của file được map đọc/ghi để reader tự cập nhật tail,
+ * còn header và các slot dùng chung chỉ được map chỉ đọc.
+ */
+static int mouse_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    struct event_ring *r;
+    int ret;
+
+    if (vma->vm_pgoff == MOUSE_MMAP_READER_PGOFF) {
+        if (size != PAGE_SIZE) {
+            return -EINVAL;
+        }
+        return vm_insert_page(vma, vma->vm_start, virt_to_page(reader->ctl));
+    }
+
+    if (vma->vm_pgoff != MOUSE_MMAP_RING_PGOFF) {
+        return -EINVAL;
+    }
+    if (vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+    vm_flags_clear(vma, VM_MAYWRITE);
+
+    mutex_lock(&mdev->config_mutex);
+    r = rcu_dereference_protected(mdev->ring, lockdep_is_held(&mdev->config_mutex));
+    if (size > r->mem_size) {
+        ret = -EINVAL;
+    } else {
+        ret = remap_vmalloc_range(vma, r->mem, 0);
+    }
+    if (!ret) {
+        vma->vm_ops = &ring_vm_ops;
+        vma->vm_private_data = mdev;
+        ring_vma_open(vma);
+    }
+    mutex_unlock(&mdev->config_mutex);
+    return ret;
+}
+
+// Ngưỡng hoặc bộ lọc vừa đổi: xét lại ngay với những gì đang chờ trong ring
+static void reader_recheck(struct mouse_reader *reader) {
+    atomic_set(&reader->wake_count, 0);
+    WRITE_ONCE(reader->ready, false);
+    smp_mb();
+    if (reader_selective(reader)) {
+        reader_check_wakeup(reader, 0);
+    } else {
+        reader_wake(reader);
+    }
+}
+
+static long mouse_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    struct mouse_config config;
+    struct mouse_wakeup wakeup;
+    struct mouse_filter filter;
+    u64 lost;
+    u32 abi;
+
+    switch (cmd) {
+    case MOUSE_IOC_GET_LOST:
+        lost = READ_ONCE(reader->ctl->lost);
+        if (copy_to_user((void __user *)arg, &lost, sizeof(lost))) {
+            return -EFAULT;
+        }
+        return 0;
+    case MOUSE_IOC_GET_CONFIG:
+        memset(&config, 0, sizeof(config));
+        config.ring_size = READ_ONCE(mdev->ring_size);
+        config.report_interval_us = READ_ONCE(mdev->report_interval_us);
+        config.overflow_policy = READ_ONCE(mdev->overflow_policy);
+        if (copy_to_user((void __user *)arg, &config, sizeof(config))) {
+            return -EFAULT;
+        }
+        return 0;
+    case MOUSE_IOC_SET_CONFIG:
+        // Cấu hình dùng chung cho mọi reader nên cần quyền quản trị
+        if (!capable(CAP_SYS_ADMIN)) {
+            return -EPERM;
+        }
+        if (copy_from_user(&config, (void __user *)arg, sizeof(config))) {
+            return -EFAULT;
+        }
+        return apply_config(mdev, &config);
+    case MOUSE_IOC_SET_ABI:
+        if (get_user(abi, (u32 __user *)arg)) {
+            return -EFAULT;
+        }
+        if (abi != MOUSE_ABI_V1 && abi != MOUSE_ABI_V2) {
+            return -EINVAL;
+        }
+        // Không đổi định dạng giữa chừng một read() đang chạy
+        if (mutex_lock_interruptible(&reader->lock)) {
+            return -ERESTARTSYS;
+        }
+        reader->abi = abi;
+        mutex_unlock(&reader->lock);
+        return 0;
+    case MOUSE_IOC_GET_WAKEUP:
+        memset(&wakeup, 0, sizeof(wakeup));
+        wakeup.events = READ_ONCE(reader->wakeup.events);
+        wakeup.timeout_us = READ_ONCE(reader->wakeup.timeout_us);
+        wakeup.flags = READ_ONCE(reader->wakeup.flags);
+        if (copy_to_user((void __user *)arg, &wakeup, sizeof(wakeup))) {
+            return -EFAULT;
+        }
+        return 0;
+    case MOUSE_IOC_SET_WAKEUP:
+        if (copy_from_user(&wakeup, (void __user *)arg, sizeof(wakeup))) {
+            return -EFAULT;
+        }
+        if (wakeup.events > MAX_RING_SIZE || wakeup.timeout_us > MAX_WAKEUP_TIMEOUT_US ||
+            (wakeup.flags & ~MOUSE_WAKEUP_MASK) || wakeup.reserved) {
+            return -EINVAL;
+        }
+        // timeout_us/flags chỉ có nghĩa khi có ngưỡng: không nhận rồi lặng lẽ bỏ qua
+        if (wakeup.events == 0 && (wakeup.timeout_us || wakeup.flags)) {
+            return -EINVAL;
+        }
+        if (mutex_lock_interruptible(&reader->lock)) {
+            return -ERESTARTSYS;
+        }
+        WRITE_ONCE(reader->wakeup.timeout_us, wakeup.timeout_us);
+        WRITE_ONCE(reader->wakeup.flags, wakeup.flags);
+        WRITE_ONCE(reader->wakeup.events, wakeup.events);
+        reader_recheck(reader);
+        mutex_unlock(&reader->lock);
+        return 0;
+    case MOUSE_IOC_GET_FILTER:
+        memset(&filter, 0, sizeof(filter));
+        reader_get_filter(reader, &filter);
+        if (copy_to_user((void __user *)arg, &filter, sizeof(filter))) {
+            return -EFAULT;
+        }
+        return 0;
+    case MOUSE_IOC_SET_FILTER:
+        if (copy_from_user(&filter, (void __user *)arg, sizeof(filter))) {
+            return -EFAULT;
+        }
+        if ((filter.types & ~GENMASK(MOUSE_EVENT_GAP, 0)) ||
+            (filter.buttons & ~GENMASK(MOUSE_BUTTON_MIDDLE, 0)) ||
+            filter.min_motion > MOUSE_FILTER_MAX_MOTION || filter.reserved) {
+            return -EINVAL;
+        }
+        // Cùng lock với read() để một lần đọc không dùng lẫn bộ lọc cũ và mới
+        if (mutex_lock_interruptible(&reader->lock)) {
+            return -ERESTARTSYS;
+        }
+        WRITE_ONCE(reader->filtering, false);
+        WRITE_ONCE(reader->filter.types, filter.types);
+        WRITE_ONCE(reader->filter.buttons, filter.buttons);
+        WRITE_ONCE(reader->filter.min_motion, filter.min_motion);
+        WRITE_ONCE(reader->filtering, mouse_filter_active(&filter));
+        reader_recheck(reader);
+        mutex_unlock(&reader->lock);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int mouse_release(struct inode *inode, struct file *file) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+
+    spin_lock(&mdev->reader_list_lock);
+    list_del_rcu(&reader->node);
+    spin_unlock(&mdev->reader_list_lock);
+    // Producer có thể vẫn đang đọc tail của reader này trong ring_room()/notify_readers()
+    synchronize_rcu();
+    hrtimer_cancel(&reader->wake_timer);
+
+    // Mapping giữ tham chiếu tới file nên release() chỉ chạy sau khi đã munmap
+    free_page((unsigned long)reader->ctl);
+    kvfree(reader->bounce);
+    kfree(reader);
+    return 0;
+}
+
+static const struct file_operations mouse_fops = {
+    .owner = THIS_MODULE,
+    .open = mouse_open,
+    .read = mouse_read,
+    .poll = mouse_poll,
+    .mmap = mouse_mmap,
+    .unlocked_ioctl = mouse_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .release = mouse_release,
+};
+
+// Con trỏ đọc riêng của mỗi lần open() /dev/logitech_mouse_metricsN
+struct metrics_reader {
+    struct mouse_dev *mdev;
+    u32 tail;
+    u64 lost;
+    struct mutex lock;
+};
+
+static inline bool metrics_has_data(struct metrics_reader *reader) {
+    return smp_load_acquire(&reader->mdev->metrics_head) != READ_ONCE(reader->tail);
+}
+
+static int metrics_open(struct inode *inode, struct file *file) {
+    struct mouse_dev *mdev = container_of(inode->i_cdev, struct mouse_dev, metrics_cdev);
+    struct metrics_reader *reader;
+
+    if (READ_ONCE(mdev->disconnected)) {
+        return -ENODEV;
+    }
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader) {
+        return -ENOMEM;
+    }
+    mutex_init(&reader->lock);
+    reader->mdev = mdev;
+    reader->tail = smp_load_acquire(&mdev->metrics_head);
+    file->private_data = reader;
+    return 0;
+}
+
+static ssize_t metrics_read(struct file *file, char __user *user_buffer, size_t size, loff_t *offset) {
+    struct metrics_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    struct mouse_metrics chunk[8];
+    size_t max_records = size / sizeof(struct mouse_metrics);
+    size_t done = 0;
+    unsigned long flags;
+    u32 head, n, i;
+    ssize_t ret = 0;
+
+    if (max_records == 0) {
+        return -EINVAL;
+    }
+
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mutex_trylock(&reader->lock)) {
+            return -EAGAIN;
+        }
+    } else if (mutex_lock_interruptible(&reader->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    if (!metrics_has_data(reader)) {
+        if (READ_ONCE(mdev->disconnected)) {
+            ret = -ENODEV;
+            goto out_unlock;
+        }
+        if (file->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            goto out_unlock;
+        }
+        if (wait_event_interruptible(mdev->metrics_queue,
+                                     metrics_has_data(reader) || READ_ONCE(mdev->disconnected))) {
+            ret = -ERESTARTSYS;
+            goto out_unlock;
+        }
+    }
+
+    // Mỗi quỹ đạo chỉ có một bản ghi nên copy dưới event_lock là đủ rẻ
+    while (done < max_records) {
+        spin_lock_irqsave(&mdev->event_lock, flags);
+        head = mdev->metrics_head;
+        if (head - reader->tail > METRICS_RING_SIZE) {
+            reader->lost += head - reader->tail - METRICS_RING_SIZE;
+            reader->tail = head - METRICS_RING_SIZE;
+        }
+        n = min_t(u32, head - reader->tail, min_t(size_t, max_records - done, ARRAY_SIZE(chunk)));
+        for (i = 0; i < n; i++) {
+            chunk[i] = mdev->metrics_ring[(reader->tail + i) % METRICS_RING_SIZE];
+        }
+        reader->tail += n;
+        spin_unlock_irqrestore(&mdev->event_lock, flags);
+
+        if (n == 0) {
+            break;
+        }
+        if (copy_to_user(user_buffer + done * sizeof(chunk[0]), chunk, n * sizeof(chunk[0]))) {
+            ret = -EFAULT;
+            goto out_unlock;
+        }
+        done += n;
+    }
+    // Bị đánh thức vì chuột bị rút mà không có bản ghi nào
+    ret = done ? done * sizeof(struct mouse_metrics) : -ENODEV;
+
+out_unlock:
+    mutex_unlock(&reader->lock);
+    return ret;
+}
+
+static __poll_t metrics_poll(struct file *file, poll_table *wait) {
+    struct metrics_reader *reader = file->private_data;
+    struct mouse_dev *mdev = reader->mdev;
+    __poll_t mask;
+
+    poll_wait(file, &mdev->metrics_queue, wait);
+    mask = metrics_has_data(reader) ? EPOLLIN | EPOLLRDNORM : 0;
+    if (READ_ONCE(mdev->disconnected)) {
+        mask |= EPOLLHUP | EPOLLERR;
+    }
+    return mask;
+}
+
+static long metrics_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct metrics_reader *reader = file->private_data;
+    u64 lost;
+
+    if (cmd != MOUSE_IOC_GET_LOST) {
+        return -ENOTTY;
+    }
+    mutex_lock(&reader->lock);
+    lost = reader->lost;
+    mutex_unlock(&reader->lock);
+    return copy_to_user((void __user *)arg, &lost, sizeof(lost)) ? -EFAULT : 0;
+}
+
+static int metrics_release(struct inode *inode, struct file *file) {
+    kfree(file->private_data);
+    return 0;
+}
+
+static const struct file_operations metrics_fops = {
+    .owner = THIS_MODULE,
+    .open = metrics_open,
+    .read = metrics_read,
+    .poll = metrics_poll,
+    .unlocked_ioctl = metrics_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .release = metrics_release,
+};
+
+static ssize_t ring_size_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->ring_size));
+}
+
+static ssize_t ring_size_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+    unsigned int size;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &size);
+    if (ret) {
+        return ret;
+    }
+    mutex_lock(&mdev->config_mutex);
+    ret = set_ring_size(mdev, size);
+    mutex_unlock(&mdev->config_mutex);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(ring_size);
+
+static ssize_t report_interval_us_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->report_interval_us));
+}
+
+static ssize_t report_interval_us_store(struct device *dev, struct device_attribute *attr,
+                                        const char *buf, size_t count) {
+    unsigned int interval_us;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &interval_us);
+    if (ret) {
+        return ret;
+    }
+    ret = set_report_interval(to_mouse_dev(dev), interval_us);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(report_interval_us);
+
+static ssize_t overflow_policy_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    unsigned int policy = READ_ONCE(to_mouse_dev(dev)->overflow_policy);
+    int len = 0;
+    unsigned int i;
+
+    // Giống các file sysfs dạng lựa chọn khác: giá trị hiện tại nằm trong []
+    for (i = 0; i < ARRAY_SIZE(overflow_policy_names); i++) {
+        len += sysfs_emit_at(buf, len, i == policy ? "[%s] " : "%s ", overflow_policy_names[i]);
+    }
+    buf[len - 1] = '\n';
+    return len;
+}
+
+static ssize_t overflow_policy_store(struct device *dev, struct device_attribute *attr,
+                                     const char *buf, size_t count) {
+    int policy = sysfs_match_string(overflow_policy_names, buf);
+
+    if (policy < 0) {
+        return policy;
+    }
+    set_overflow_policy(to_mouse_dev(dev), policy);
+    return count;
+}
+static DEVICE_ATTR_RW(overflow_policy);
 
-MODULE_LICENSE("GPL");
-MODULE_AUTHOR("Hoai Son & Trong Nhan");
-MODULE_DESCRIPTION("Driver Logitech 046d:c077 with 125Hz move reporting");
+static ssize_t tickless_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%d\n", READ_ONCE(to_mouse_dev(dev)->tickless));
+}
 
-struct mouse_event {
-    long long timestamp_sec;
-    long timestamp_nsec;
-    int type;           // 0: MOVE, 1: CLICK, 2: WHEEL
-    int x;              // Tọa độ x tương đối
-    int y;              // Tọa độ y tương đối
-    int button;         // 0: LEFT, 1: RIGHT, 2: MIDDLE
-    int action;         // 0: RELEASE, 1: PRESS
-    int wheel_value;    // Giá trị cuộn
-};
+static ssize_t tickless_store(struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+    unsigned long flags;
+    bool value;
+    int ret;
 
-static dev_t dev_num;
-static struct cdev cdev;
-static struct class *mouse_class;
-static struct device *mouse_device;
-static char *buffer;
-static int buffer_head = 0;
-static int buffer_tail = 0;
-static spinlock_t buffer_lock;
-static wait_queue_head_t read_queue;
-
-static struct hrtimer move_timer;
-static struct mouse_event pending_move = {0};
-static int has_x = 0, has_y = 0;
-static int last_value[3] = {0}; // Trạng thái nút trước đó
-
-static void enqueue_event(struct mouse_event *event) {
-    spin_lock(&buffer_lock);
-    if ((buffer_head + 1) % BUFFER_SIZE == buffer_tail) {
-        pr_warn("Buffer full, event dropped\n");
-        spin_unlock(&buffer_lock);
-        return;
+    ret = kstrtobool(buf, &value);
+    if (ret) {
+        return ret;
+    }
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    mdev->tickless = value;
+    // Về chế độ cũ: timer chạy liên tục; sang tickless thì timer tự dừng khi rảnh
+    if (!mdev->tickless) {
+        arm_move_timer(mdev);
     }
-    memcpy(&buffer[buffer_head * sizeof(struct mouse_event)], event, sizeof(struct mouse_event));
-    buffer_head = (buffer_head + 1) % BUFFER_SIZE;
-    spin_unlock(&buffer_lock);
-    wake_up_interruptible(&read_queue);
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+    return count;
 }
+static DEVICE_ATTR_RW(tickless);
 
-static int mouse_open(struct inode *inode, struct file *file) {
-    return 0;
+static ssize_t idle_timeout_us_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->idle_timeout_us));
 }
 
-static ssize_t mouse_read(struct file *file, char __user *user_buffer, size_t size, loff_t *offset) {
-    struct mouse_event event;
+static ssize_t idle_timeout_us_store(struct device *dev, struct device_attribute *attr,
+                                     const char *buf, size_t count) {
+    unsigned int value;
     int ret;
 
-    if (wait_event_interruptible(read_queue, buffer_head != buffer_tail)) {
-        return -ERESTARTSYS;
+    ret = kstrtouint(buf, 0, &value);
+    if (ret) {
+        return ret;
+    }
+    if (value > MAX_IDLE_TIMEOUT_US) {
+        return -EINVAL;
+    }
+    WRITE_ONCE(to_mouse_dev(dev)->idle_timeout_us, value);
+    return count;
+}
+static DEVICE_ATTR_RW(idle_timeout_us);
+
+static ssize_t adaptive_flush_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%d\n", READ_ONCE(to_mouse_dev(dev)->adaptive_flush));
+}
+
+static ssize_t adaptive_flush_store(struct device *dev, struct device_attribute *attr,
+                                    const char *buf, size_t count) {
+    bool value;
+    int ret;
+
+    ret = kstrtobool(buf, &value);
+    if (ret) {
+        return ret;
     }
+    WRITE_ONCE(to_mouse_dev(dev)->adaptive_flush, value);
+    return count;
+}
+static DEVICE_ATTR_RW(adaptive_flush);
 
-    spin_lock(&buffer_lock);
-    memcpy(&event, &buffer[buffer_tail * sizeof(struct mouse_event)], sizeof(struct mouse_event));
-    spin_unlock(&buffer_lock);
+static ssize_t flush_threshold_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->flush_threshold));
+}
+
+static ssize_t flush_threshold_store(struct device *dev, struct device_attribute *attr,
+                                     const char *buf, size_t count) {
+    unsigned int value;
+    int ret;
 
-    if (size < sizeof(struct mouse_event)) {
+    ret = kstrtouint(buf, 0, &value);
+    if (ret) {
+        return ret;
+    }
+    if (value == 0 || value > S16_MAX) {
         return -EINVAL;
     }
+    WRITE_ONCE(to_mouse_dev(dev)->flush_threshold, value);
+    return count;
+}
+static DEVICE_ATTR_RW(flush_threshold);
+
+static ssize_t move_mode_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    unsigned int mode = READ_ONCE(to_mouse_dev(dev)->move_mode);
+    int len = 0;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(move_mode_names); i++) {
+        len += sysfs_emit_at(buf, len, i == mode ? "[%s] " : "%s ", move_mode_names[i]);
+    }
+    buf[len - 1] = '\n';
+    return len;
+}
+
+static ssize_t move_mode_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+    int mode = sysfs_match_string(move_mode_names, buf);
+    int ret;
+
+    if (mode < 0) {
+        return mode;
+    }
+    mutex_lock(&mdev->config_mutex);
+    ret = set_move_mode(mdev, mode);
+    mutex_unlock(&mdev->config_mutex);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(move_mode);
+
+static ssize_t aggregate_reports_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->aggregate_reports));
+}
+
+static ssize_t aggregate_reports_store(struct device *dev, struct device_attribute *attr,
+                                       const char *buf, size_t count) {
+    unsigned int value;
+    int ret;
 
-    ret = copy_to_user(user_buffer, &event, sizeof(struct mouse_event));
+    ret = kstrtouint(buf, 0, &value);
     if (ret) {
-        return -EFAULT;
+        return ret;
+    }
+    if (value == 0 || value > MAX_AGGREGATE_REPORTS) {
+        return -EINVAL;
     }
+    WRITE_ONCE(to_mouse_dev(dev)->aggregate_reports, value);
+    return count;
+}
+static DEVICE_ATTR_RW(aggregate_reports);
+
+static ssize_t wake_batch_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", READ_ONCE(to_mouse_dev(dev)->wake_batch));
+}
 
-    spin_lock(&buffer_lock);
-    buffer_tail = (buffer_tail + 1) % BUFFER_SIZE;
-    spin_unlock(&buffer_lock);
+static ssize_t wake_batch_store(struct device *dev, struct device_attribute *attr,
+                                const char *buf, size_t count) {
+    unsigned int value;
+    int ret;
 
-    return sizeof(struct mouse_event);
+    ret = kstrtouint(buf, 0, &value);
+    if (ret) {
+        return ret;
+    }
+    if (value == 0 || value > MAX_RING_SIZE) {
+        return -EINVAL;
+    }
+    WRITE_ONCE(to_mouse_dev(dev)->wake_batch, value);
+    return count;
 }
+static DEVICE_ATTR_RW(wake_batch);
 
-static int mouse_release(struct inode *inode, struct file *file) {
-    return 0;
+/*
+ * Thư mục stats/: mỗi file một bộ đếm, cộng dồn từ các CPU lúc đọc.
+ * Đọc trước và sau một khoảng thời gian để ra tốc độ (vd. timer_fires khi
+ * bật/tắt tickless). Histogram thời gian nằm trong ring ở debugfs.
+ */
+#define STATS_ATTR(name, field)                                                      \
+static ssize_t name##_show(struct device *dev, struct device_attribute *attr, char *buf) { \
+    return sysfs_emit(buf, "%llu\n", STATS_SUM(to_mouse_dev(dev), field));          \
+}                                                                                    \
+static DEVICE_ATTR_RO(name)
+
+STATS_ATTR(enqueued_move, enqueued[MOUSE_EVENT_MOVE]);
+STATS_ATTR(enqueued_click, enqueued[MOUSE_EVENT_CLICK]);
+STATS_ATTR(enqueued_wheel, enqueued[MOUSE_EVENT_WHEEL]);
+STATS_ATTR(enqueued_gap, enqueued[MOUSE_EVENT_GAP]);
+STATS_ATTR(dropped, dropped);
+STATS_ATTR(reader_lost, reader_lost);
+STATS_ATTR(reader_filtered, filtered);
+STATS_ATTR(motion_reports, motion_reports);
+STATS_ATTR(timer_fires, timer_fires);
+STATS_ATTR(timer_empty_fires, timer_empty);
+STATS_ATTR(reader_wakeups, wakeups);
+
+static ssize_t ring_high_water_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+    u64 high_water = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        high_water = max(high_water, per_cpu_ptr(mdev->stats, cpu)->high_water);
+    }
+    return sysfs_emit(buf, "%llu\n", high_water);
 }
+static DEVICE_ATTR_RO(ring_high_water);
 
-static const struct file_operations mouse_fops = {
-    .owner = THIS_MODULE,
-    .open = mouse_open,
-    .read = mouse_read,
-    .release = mouse_release,
+// Số sự kiện reader chậm nhất (kể cả reader mmap) còn chưa đọc
+static ssize_t ring_depth_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+    struct mouse_reader *reader;
+    struct event_ring *r;
+    u32 head, depth = 0;
+
+    rcu_read_lock();
+    r = rcu_dereference(mdev->ring);
+    head = smp_load_acquire(&r->hdr->head);
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        depth = max(depth, reader_depth(reader, head, r->mask + 1));
+    }
+    rcu_read_unlock();
+    return sysfs_emit(buf, "%u\n", depth);
+}
+static DEVICE_ATTR_RO(ring_depth);
+
+static struct attribute *mouse_stats_attrs[] = {
+    &dev_attr_enqueued_move.attr,
+    &dev_attr_enqueued_click.attr,
+    &dev_attr_enqueued_wheel.attr,
+    &dev_attr_enqueued_gap.attr,
+    &dev_attr_dropped.attr,
+    &dev_attr_reader_lost.attr,
+    &dev_attr_reader_filtered.attr,
+    &dev_attr_ring_high_water.attr,
+    &dev_attr_ring_depth.attr,
+    &dev_attr_motion_reports.attr,
+    &dev_attr_timer_fires.attr,
+    &dev_attr_timer_empty_fires.attr,
+    &dev_attr_reader_wakeups.attr,
+    NULL,
+};
+
+static const struct attribute_group mouse_stats_group = {
+    .name = "stats",
+    .attrs = mouse_stats_attrs,
+};
+
+static struct attribute *mouse_attrs[] = {
+    &dev_attr_ring_size.attr,
+    &dev_attr_report_interval_us.attr,
+    &dev_attr_overflow_policy.attr,
+    &dev_attr_tickless.attr,
+    &dev_attr_idle_timeout_us.attr,
+    &dev_attr_adaptive_flush.attr,
+    &dev_attr_flush_threshold.attr,
+    &dev_attr_move_mode.attr,
+    &dev_attr_aggregate_reports.attr,
+    &dev_attr_wake_batch.attr,
+    NULL,
+};
+
+static const struct attribute_group mouse_group = {
+    .attrs = mouse_attrs,
+};
+
+static const struct attribute_group *mouse_groups[] = {
+    &mouse_group,
+    &mouse_stats_group,
+    NULL,
 };
 
-// Hàm callback của timer để gửi báo cáo MOVE
+// Thu nhỏ vector (giữ hướng) để các tích bên dưới không tràn u64
+static inline void shrink_vector(s32 *dx, s32 *dy) {
+    while (abs(*dx) > 2047 || abs(*dy) > 2047) {
+        *dx /= 2;
+        *dy /= 2;
+    }
+}
+
+// cos(góc giữa hai vector) >= 0.98, tính hoàn toàn bằng số nguyên
+static bool same_direction(s32 dx1, s32 dy1, s32 dx2, s32 dy2) {
+    s64 dot;
+    u64 len1, len2;
+
+    shrink_vector(&dx1, &dy1);
+    shrink_vector(&dx2, &dy2);
+    dot = (s64)dx1 * dx2 + (s64)dy1 * dy2;
+    if (dot <= 0) {
+        return false;
+    }
+    len1 = (u64)(dx1 * dx1 + dy1 * dy1);
+    len2 = (u64)(dx2 * dx2 + dy2 * dy2);
+    // dot / (|v1| * |v2|) >= 0.98  <=>  dot^2 * 100^2 >= 98^2 * |v1|^2 * |v2|^2
+    return (u64)dot * dot * (100 * 100) >= len1 * len2 * (COSINE_TOLERANCE_PCT * COSINE_TOLERANCE_PCT);
+}
+
+static void emit_metrics(struct mouse_dev *mdev, u64 end_ns, u16 end_type) {
+    struct trajectory_state *traj = &mdev->traj;
+    struct mouse_metrics *m = &mdev->metrics_ring[mdev->metrics_head % METRICS_RING_SIZE];
+    u64 duration_ns = end_ns - traj->start_ns;
+
+    m->start_ns = traj->start_ns;
+    m->duration_us = div_u64(duration_ns, NSEC_PER_USEC);
+    m->point_count = traj->points;
+    m->path_length = min_t(u64, traj->path_q8, U32_MAX);
+    m->speed = min_t(u64, mul_u64_u64_div_u64(traj->path_q8, NSEC_PER_SEC, duration_ns), U32_MAX);
+    m->accuracy = traj->segments ?
+                  div_u64((u64)traj->eqdir * MOUSE_METRICS_ACCURACY_SCALE, traj->segments) :
+                  MOUSE_METRICS_ACCURACY_SCALE;
+    m->end_type = end_type;
+    m->segments = traj->segments;
+    smp_store_release(&mdev->metrics_head, mdev->metrics_head + 1);
+
+    if (wq_has_sleeper(&mdev->metrics_queue)) {
+        wake_up_interruptible(&mdev->metrics_queue);
+    }
+}
+
+static void metrics_feed(struct mouse_dev *mdev, const struct mouse_event_v2 *event) {
+    struct trajectory_state *traj = &mdev->traj;
+    u32 type = MOUSE_EVENT_TYPE(event->info);
+    u64 elapsed;
+
+    lockdep_assert_held(&mdev->event_lock);
+
+    if (traj->points++ == 0) {
+        traj->start_ns = event->timestamp_ns;
+    }
+
+    if (type == MOUSE_EVENT_MOVE) {
+        traj->move_run = min(traj->move_run + 1, 3U);
+        // Giống pub.c: độ dài tính từ MOVE thứ hai trong chuỗi, hướng từ MOVE thứ ba
+        if (traj->move_run >= 2) {
+            traj->path_q8 += int_sqrt64((u64)((s64)event->dx * event->dx + (s64)event->dy * event->dy)
+                                        << (2 * MOUSE_METRICS_FRAC_BITS));
+        }
+        if (traj->move_run == 3 && (traj->prev_dx || traj->prev_dy) && (event->dx || event->dy)) {
+            traj->eqdir += same_direction(traj->prev_dx, traj->prev_dy, event->dx, event->dy);
+            traj->segments++;
+        }
+        traj->prev_dx = event->dx;
+        traj->prev_dy = event->dy;
+    } else {
+        traj->move_run = 0;
+    }
+
+    elapsed = event->timestamp_ns - traj->start_ns;
+    if (type == MOUSE_EVENT_CLICK || type == MOUSE_EVENT_WHEEL || elapsed > TRAJECTORY_MAX_NS) {
+        if (elapsed >= TRAJECTORY_MIN_NS && elapsed <= TRAJECTORY_MAX_NS && traj->points > 1) {
+            emit_metrics(mdev, event->timestamp_ns, type);
+        }
+        memset(traj, 0, sizeof(*traj));
+    }
+}
+
+/*
+ * Sự kiện thật từ chuột: ghi vào ring rồi mới cập nhật quỹ đạo, để sự kiện bị bỏ
+ * (kể cả CLICK/WHEEL kết thúc quỹ đạo) không tạo ra bản ghi mà reader không thấy
+ */
+static void report_event(struct mouse_dev *mdev, const struct mouse_event_v2 *event) {
+    if (enqueue_event(mdev, event) && metrics) {
+        metrics_feed(mdev, event);
+    }
+}
+
+// Gửi MOVE đang gộp (nếu có) trước sự kiện khác để giữ đúng thứ tự
+static void flush_move(struct mouse_dev *mdev, u64 now) {
+    struct mouse_event_v2 move = {0};
+
+    if (!mdev->has_x && !mdev->has_y) {
+        return;
+    }
+    // Thời điểm delta đầu tiên tới, để đo được độ trễ do gộp
+    move.timestamp_ns = mdev->move_arrival_ns;
+    move.flush_delay_us = min_t(u64, div_u64(now - mdev->move_arrival_ns, NSEC_PER_USEC), U16_MAX);
+    move.dx = mdev->pending_dx;
+    move.dy = mdev->pending_dy;
+    move.info = MOUSE_EVENT_INFO(MOUSE_EVENT_MOVE, 0, 0);
+    report_event(mdev, &move);
+    mdev->pending_dx = mdev->pending_dy = 0;
+    mdev->has_x = mdev->has_y = 0;
+    mdev->pending_reports = 0;
+}
+
+/*
+ * Cộng delta vào trục đang gộp; gửi MOVE sớm nếu tổng sắp vượt s16 của bản ghi v2.
+ * Ở chế độ adaptive_flush, MOVE cũng được gửi ngay khi đổi hướng trên trục này
+ * (phần đã gộp đi trước) hoặc khi delta lớn (gửi cả delta đó).
+ * Người gọi bật timer sau khi đã cộng xong các trục của report.
+ */
+static void accumulate(struct mouse_dev *mdev, s32 *pending, int *has, __s32 value, u64 now) {
+    bool adaptive = READ_ONCE(mdev->adaptive_flush);
+
+    if (abs(*pending + value) > S16_MAX || (adaptive && (*pending ^ value) < 0 && *pending)) {
+        flush_move(mdev, now);
+    }
+    if (!mdev->has_x && !mdev->has_y) {
+        mdev->move_arrival_ns = now;
+    }
+    *pending += clamp_t(__s32, value, -S16_MAX, S16_MAX);
+    *has = 1;
+    mdev->last_motion_ns = now;
+
+    if (adaptive && abs(value) >= READ_ONCE(mdev->flush_threshold)) {
+        flush_move(mdev, now);
+    }
+}
+
+/*
+ * Gọi một lần cho mỗi report có chuyển động, sau khi đã cộng delta của mọi trục.
+ * coalesce chỉ bật timer; passthrough gửi MOVE ngay; aggregate gửi khi đủ
+ * aggregate_reports report, phần lẻ do timer gửi. Với policy block, ring đầy thì
+ * delta tiếp tục được gộp như coalesce thay vì bị giữ từng report một.
+ */
+static void motion_report(struct mouse_dev *mdev, u64 now) {
+    stats_inc(mdev, motion_reports);
+    mdev->pending_reports++;
+    if ((mdev->move_mode == MOUSE_MOVE_PASSTHROUGH ||
+         (mdev->move_mode == MOUSE_MOVE_AGGREGATE &&
+          mdev->pending_reports >= READ_ONCE(mdev->aggregate_reports))) &&
+        can_flush_move(mdev)) {
+        flush_move(mdev, now);
+    }
+    // Delta đầu tiên sau khi chuột đứng yên mới bật lại timer
+    arm_move_timer(mdev);
+}
+
+/*
+ * Hàm callback của timer để gửi báo cáo MOVE. Ở chế độ tickless, timer tự
+ * dừng khi không có gì để gửi và chuột đã đứng yên quá idle_timeout_us.
+ */
 static enum hrtimer_restart move_timer_callback(struct hrtimer *timer) {
-    struct timespec64 ts;
-    ktime_get_real_ts64(&ts);
+    struct mouse_dev *mdev = container_of(timer, struct mouse_dev, move_timer);
+    enum hrtimer_restart ret = HRTIMER_RESTART;
+    u64 now = ktime_get_ns();
+    unsigned long flags;
+
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    stats_inc(mdev, timer_fires);
+    if (!mdev->has_x && !mdev->has_y) {
+        stats_inc(mdev, timer_empty);
+    }
+    if (can_flush_move(mdev)) {
+        flush_move(mdev, now);
+    }
+    // MOVE của passthrough/aggregate chưa đánh thức reader
+    if (mdev->wake_pending) {
+        wake_readers(mdev);
+    }
+    if (READ_ONCE(mdev->tickless) && !mdev->has_x && !mdev->has_y && mdev->stash_count == 0 &&
+        now - mdev->last_motion_ns >= (u64)READ_ONCE(mdev->idle_timeout_us) * NSEC_PER_USEC) {
+        mdev->timer_armed = false;
+        ret = HRTIMER_NORESTART;
+    }
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+
+    if (ret == HRTIMER_RESTART) {
+        hrtimer_forward_now(timer, report_interval(mdev));
+    }
+    return ret;
+}
+
+static void stop_move_timer(struct mouse_dev *mdev) {
+    unsigned long flags;
+
+    hrtimer_cancel(&mdev->move_timer);
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    mdev->timer_armed = false;
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+}
+
+// Ghi CLICK khi trạng thái nút thay đổi, sau MOVE đang gộp để giữ đúng thứ tự
+static void report_button(struct mouse_dev *mdev, int button_idx, __s32 value, u64 now) {
+    struct mouse_event_v2 click_event = {0};
+
+    if (value == mdev->last_value[button_idx]) {
+        return;
+    }
+    flush_move(mdev, now);
+    click_event.timestamp_ns = now;
+    click_event.info = MOUSE_EVENT_INFO(MOUSE_EVENT_CLICK, button_idx,
+                                        value ? MOUSE_ACTION_PRESS : MOUSE_ACTION_RELEASE);
+    report_event(mdev, &click_event);
+    mdev->last_value[button_idx] = value;
+}
+
+static void report_wheel(struct mouse_dev *mdev, __s32 value, u64 now) {
+    struct mouse_event_v2 wheel_event = {0};
+
+    flush_move(mdev, now); // Gửi MOVE trước nếu có
+    wheel_event.timestamp_ns = now;
+    wheel_event.dx = clamp_t(__s32, value, S16_MIN, S16_MAX);
+    wheel_event.info = MOUSE_EVENT_INFO(MOUSE_EVENT_WHEEL, 0, 0);
+    report_event(mdev, &wheel_event);
+}
+
+static struct report_item *layout_item(struct report_layout *layout, unsigned int usage, bool *relative) {
+    switch (usage) {
+    case HID_GD_X:
+        *relative = true;
+        return &layout->x;
+    case HID_GD_Y:
+        *relative = true;
+        return &layout->y;
+    case HID_GD_WHEEL:
+        *relative = true;
+        return &layout->wheel;
+    case HID_UP_BUTTON | 1:
+        *relative = false;
+        return &layout->button[MOUSE_BUTTON_LEFT];
+    case HID_UP_BUTTON | 2:
+        *relative = false;
+        return &layout->button[MOUSE_BUTTON_RIGHT];
+    case HID_UP_BUTTON | 3:
+        *relative = false;
+        return &layout->button[MOUSE_BUTTON_MIDDLE];
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Tìm report đầu vào chứa X/Y tương đối (046d:c077 chỉ có một report như vậy) và
+ * ghi lại vị trí các usage cần dùng. Descriptor có X/Y tuyệt đối, nút dạng mảng
+ * hoặc report quá lớn thì để layout->valid = false và dùng đường .event.
+ */
+static void find_report_layout(struct hid_device *hdev, struct report_layout *layout) {
+    struct hid_report_enum *report_enum = &hdev->report_enum[HID_INPUT_REPORT];
+    struct hid_report *report;
+    struct hid_field *field;
+    struct report_item *item;
+    unsigned int i, j;
+    bool relative, usable;
+
+    memset(layout, 0, sizeof(*layout));
+    list_for_each_entry(report, &report_enum->report_list, list) {
+        struct report_layout l = {0};
+
+        usable = DIV_ROUND_UP(report->size, 8) <= RAW_REPORT_MAX;
+        for (i = 0; i < report->maxfield && usable; i++) {
+            field = report->field[i];
+            for (j = 0; j < field->maxusage && j < field->report_count; j++) {
+                item = layout_item(&l, field->usage[j].hid, &relative);
+                if (!item) {
+                    continue;
+                }
+                if (!(field->flags & HID_MAIN_ITEM_VARIABLE) || field->report_size > 32 ||
+                    relative != !!(field->flags & HID_MAIN_ITEM_RELATIVE)) {
+                    usable = false;
+                    break;
+                }
+                item->offset = field->report_offset + j * field->report_size;
+                item->size = field->report_size;
+                item->is_signed = field->logical_minimum < 0;
+            }
+        }
+
+        if (usable && l.x.size && l.y.size) {
+            l.valid = true;
+            l.report_id = report->id;
+            l.numbered = report_enum->numbered;
+            l.size = DIV_ROUND_UP(report->size, 8);
+            *layout = l;
+            return;
+        }
+    }
+}
+
+static inline __s32 read_item(struct hid_device *hdev, u8 *data, const struct report_item *item) {
+    u32 value = hid_field_extract(hdev, data, item->offset, item->size);
+
+    return item->is_signed ? sign_extend32(value, item->size - 1) : (__s32)value;
+}
+
+/*
+ * Đường nhanh: đọc cả report một lượt với một lần lấy thời gian và một lần lấy
+ * event_lock. Luôn trả về 0 để HID core vẫn chuyển report cho hid-input/hidraw.
+ */
+static int mouse_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+{
+    struct mouse_dev *mdev = hid_get_drvdata(hdev);
+    const struct report_layout *layout = &mdev->layout;
+    u8 padded[RAW_REPORT_MAX];
+    unsigned long flags;
+    __s32 dx, dy, wheel = 0;
+    u64 now;
+    int i;
+
+    if (!layout->valid || report->id != layout->report_id) {
+        return 0;
+    }
+    if (layout->numbered) {
+        data++;
+        size--;
+    }
+    // Giống HID core: report ngắn hơn descriptor được coi như có phần đuôi bằng 0
+    if (size < (int)layout->size) {
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, data, max(size, 0));
+        data = padded;
+    }
+
+    dx = read_item(hdev, data, &layout->x);
+    dy = read_item(hdev, data, &layout->y);
+    if (layout->wheel.size) {
+        wheel = read_item(hdev, data, &layout->wheel);
+    }
 
-    if (has_x || has_y) {
-        pending_move.timestamp_sec = ts.tv_sec;
-        pending_move.timestamp_nsec = ts.tv_nsec;
-        pending_move.type = 0; // MOVE
-        enqueue_event(&pending_move);
-        memset(&pending_move, 0, sizeof(struct mouse_event));
-        has_x = has_y = 0;
+    now = ktime_get_ns();
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    // Cùng thứ tự với descriptor của chuột: nút, X/Y rồi wheel
+    for (i = 0; i < ARRAY_SIZE(layout->button); i++) {
+        if (layout->button[i].size) {
+            report_button(mdev, i, read_item(hdev, data, &layout->button[i]), now);
+        }
     }
+    if (dx) {
+        accumulate(mdev, &mdev->pending_dx, &mdev->has_x, dx, now);
+    }
+    if (dy) {
+        accumulate(mdev, &mdev->pending_dy, &mdev->has_y, dy, now);
+    }
+    if (dx || dy) {
+        motion_report(mdev, now);
+    }
+    if (wheel) {
+        report_wheel(mdev, wheel, now);
+    }
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
 
-    hrtimer_forward_now(timer, ktime_set(0, REPORT_INTERVAL_NS));
-    return HRTIMER_RESTART;
+    return 0;
 }
 
+// Đường chung, gọi cho từng usage; chỉ dùng khi raw_event không hiểu được report
 static int mouse_event(struct hid_device *hdev, struct hid_field *field, struct hid_usage *usage, __s32 value)
 {
-    struct timespec64 ts;
-    ktime_get_real_ts64(&ts);
+    struct mouse_dev *mdev = hid_get_drvdata(hdev);
+    unsigned long flags;
+    u64 now;
+
+    // Report này đã được mouse_raw_event() xử lý nguyên khối
+    if (mdev->layout.valid && field->report->id == mdev->layout.report_id) {
+        return 0;
+    }
 
+    now = ktime_get_ns();
+    spin_lock_irqsave(&mdev->event_lock, flags);
     if (usage->type == EV_REL) {
         if (usage->code == REL_X && value != 0) {
-            pending_move.x += value; // Tích lũy delta_x
-            has_x = 1;
+            accumulate(mdev, &mdev->pending_dx, &mdev->has_x, value, now); // Tích lũy delta_x
+            mdev->report_motion = true;
         } else if (usage->code == REL_Y && value != 0) {
-            pending_move.y += value; // Tích lũy delta_y
-            has_y = 1;
+            accumulate(mdev, &mdev->pending_dy, &mdev->has_y, value, now); // Tích lũy delta_y
+            mdev->report_motion = true;
         } else if ((usage->code == REL_WHEEL || usage->code == REL_WHEEL_HI_RES) && value != 0) {
-            if (has_x || has_y) { // Gửi MOVE trước nếu có
-                pending_move.timestamp_sec = ts.tv_sec;
-                pending_move.timestamp_nsec = ts.tv_nsec;
-                pending_move.type = 0;
-                enqueue_event(&pending_move);
-                memset(&pending_move, 0, sizeof(struct mouse_event));
-                has_x = has_y = 0;
-            }
-            struct mouse_event wheel_event = {0};
-            wheel_event.timestamp_sec = ts.tv_sec;
-            wheel_event.timestamp_nsec = ts.tv_nsec;
-            wheel_event.type = 2; // WHEEL
-            wheel_event.wheel_value = value;
-            enqueue_event(&wheel_event);
+            report_wheel(mdev, value, now);
         }
     } else if (usage->type == EV_KEY) {
         if (usage->code == BTN_LEFT || usage->code == BTN_RIGHT || usage->code == BTN_MIDDLE) {
-            int button_idx = (usage->code == BTN_LEFT) ? 0 : (usage->code == BTN_RIGHT) ? 1 : 2;
-            if (value != last_value[button_idx]) { // Chỉ ghi khi trạng thái thay đổi
-                if (has_x || has_y) { // Gửi MOVE trước nếu có
-                    pending_move.timestamp_sec = ts.tv_sec;
-                    pending_move.timestamp_nsec = ts.tv_nsec;
-                    pending_move.type = 0;
-                    enqueue_event(&pending_move);
-                    memset(&pending_move, 0, sizeof(struct mouse_event));
-                    has_x = has_y = 0;
-                }
-                struct mouse_event click_event = {0};
-                click_event.timestamp_sec = ts.tv_sec;
-                click_event.timestamp_nsec = ts.tv_nsec;
-                click_event.type = 1; // CLICK
-                click_event.button = button_idx;
-                click_event.action = value;
-                enqueue_event(&click_event);
-                last_value[button_idx] = value;
-            }
+            int button_idx = (usage->code == BTN_LEFT) ? MOUSE_BUTTON_LEFT :
+                             (usage->code == BTN_RIGHT) ? MOUSE_BUTTON_RIGHT : MOUSE_BUTTON_MIDDLE;
+            report_button(mdev, button_idx, value, now); // Chỉ ghi khi trạng thái thay đổi
+        }
+    }
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+
+    return 0;
+}
+
+// Đường chung: HID core gọi sau khi mọi usage của report đã qua mouse_event()
+static int mouse_report(struct hid_device *hdev, struct hid_report *report)
+{
+    struct mouse_dev *mdev = hid_get_drvdata(hdev);
+    unsigned long flags;
+
+    if (mdev->layout.valid && report->id == mdev->layout.report_id) {
+        return 0;
+    }
+
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    if (mdev->report_motion) {
+        mdev->report_motion = false;
+        motion_report(mdev, ktime_get_ns());
+    }
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+
+    return 0;
+}
+
+/*
+ * debugfs: ghi N vào logitech_mouse/logitech_mouseX/stress để đẩy N sự kiện
+ * MOVE giả (timestamp_ns = số thứ tự, dx = 16 bit thấp của số thứ tự, dy = ~dx)
+ * qua đúng đường producer của chuột đó với tốc độ tối đa.
+ * Dùng cùng test/ring_stress.c để kiểm tra ring khi nhiều reader cùng đọc.
+ */
+static ssize_t stress_write(struct file *file, const char __user *user_buffer, size_t size, loff_t *offset) {
+    struct mouse_dev *mdev = file->private_data;
+    struct mouse_event_v2 event = {0};
+    unsigned long flags;
+    unsigned int count, i;
+    int ret;
+
+    ret = kstrtouint_from_user(user_buffer, size, 0, &count);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        // Thời điểm thật để histogram residency đúng; tăng ngặt để ring_stress kiểm tra thứ tự.
+        // Số thứ tự (16 bit thấp) nằm ở dx, ring_stress dựng lại phần còn lại nhờ các GAP
+        event.timestamp_ns = max_t(u64, ktime_get_ns(), event.timestamp_ns + 1);
+        event.dx = (s16)i;
+        event.dy = ~event.dx;
+        event.info = MOUSE_EVENT_INFO(MOUSE_EVENT_MOVE, 0, 0);
+        // Giống ngữ cảnh ngắt thật: tắt ngắt và lấy event_lock quanh mỗi lần ghi
+        spin_lock_irqsave(&mdev->event_lock, flags);
+        enqueue_event(mdev, &event);
+        spin_unlock_irqrestore(&mdev->event_lock, flags);
+        if ((i & 1023) == 0) {
+            cond_resched();
         }
     }
 
+    return size;
+}
+
+/*
+ * debugfs: logitech_mouse/logitech_mouseX/stats in toàn bộ bộ đếm kèm histogram
+ * thời gian nằm trong ring; ghi bất kỳ giá trị nào vào file để xóa bộ đếm
+ * (vd. sau khi chạy stress).
+ */
+static int stats_show(struct seq_file *m, void *v) {
+    struct mouse_dev *mdev = m->private;
+    u64 count;
+    int i;
+
+    seq_printf(m, "enqueued_move %llu\n", STATS_SUM(mdev, enqueued[MOUSE_EVENT_MOVE]));
+    seq_printf(m, "enqueued_click %llu\n", STATS_SUM(mdev, enqueued[MOUSE_EVENT_CLICK]));
+    seq_printf(m, "enqueued_wheel %llu\n", STATS_SUM(mdev, enqueued[MOUSE_EVENT_WHEEL]));
+    seq_printf(m, "enqueued_gap %llu\n", STATS_SUM(mdev, enqueued[MOUSE_EVENT_GAP]));
+    seq_printf(m, "dropped %llu\n", STATS_SUM(mdev, dropped));
+    seq_printf(m, "reader_lost %llu\n", STATS_SUM(mdev, reader_lost));
+    seq_printf(m, "reader_filtered %llu\n", STATS_SUM(mdev, filtered));
+    seq_printf(m, "motion_reports %llu\n", STATS_SUM(mdev, motion_reports));
+    seq_printf(m, "timer_fires %llu\n", STATS_SUM(mdev, timer_fires));
+    seq_printf(m, "timer_empty_fires %llu\n", STATS_SUM(mdev, timer_empty));
+    seq_printf(m, "reader_wakeups %llu\n", STATS_SUM(mdev, wakeups));
+    seq_puts(m, "residency_ns count\n");
+    for (i = 0; i < RESIDENCY_BUCKETS; i++) {
+        count = STATS_SUM(mdev, residency[i]);
+        if (count) {
+            seq_printf(m, "%llu %llu\n", 1ULL << i, count);
+        }
+    }
     return 0;
 }
 
+static int stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, stats_show, inode->i_private);
+}
+
+static ssize_t stats_write(struct file *file, const char __user *user_buffer, size_t size, loff_t *offset) {
+    struct mouse_dev *mdev = ((struct seq_file *)file->private_data)->private;
+    int cpu;
+
+    // Không đồng bộ với đường nóng: một vài lần đếm đang chạy có thể còn sót lại
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(mdev->stats, cpu), 0, sizeof(struct mouse_stats));
+    }
+    return size;
+}
+
+static const struct file_operations stats_fops = {
+    .owner = THIS_MODULE,
+    .open = stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .write = stats_write,
+    .release = single_release,
+};
+
+static const struct file_operations stress_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = stress_write,
+};
+
+/*
+ * Các chuột được hỗ trợ. Driver chỉ dùng usage chuẩn (REL_X/Y, WHEEL,
+ * BTN_LEFT/RIGHT/MIDDLE) nên thêm model khác chỉ cần thêm một dòng ở đây,
+ * hoặc thêm lúc chạy mà không build lại:
+ *   echo "0003 046d c05a" > /sys/bus/hid/drivers/logitech_mouse/new_id
+ */
 static const struct hid_device_id mouse_id_table[] = {
-    { HID_USB_DEVICE(0x046d, 0xc077) },
+    { HID_USB_DEVICE(USB_VENDOR_ID_LOGITECH, USB_DEVICE_ID_LOGITECH_C077) },
     { }
 };
 MODULE_DEVICE_TABLE(hid, mouse_id_table);
 
+// Gọi khi tham chiếu cuối cùng tới mdev->dev mất đi (sau remove và khi mọi file đã đóng)
+static void mouse_dev_release(struct device *dev) {
+    struct mouse_dev *mdev = to_mouse_dev(dev);
+
+    free_ring(rcu_dereference_protected(mdev->ring, 1));
+    free_percpu(mdev->stats);
+    ida_free(&mouse_ida, mdev->minor);
+    kfree(mdev);
+}
+
 static int mouse_probe(struct hid_device *hdev, const struct hid_device_id *id)
 {
-    int ret;
-    hid_info(hdev, "Connected to Logitech 046d:c077\n");
+    struct mouse_dev *mdev;
+    struct event_ring *r;
+    unsigned long flags;
+    int minor, ret;
+
+    minor = ida_alloc_max(&mouse_ida, MOUSE_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0) {
+        hid_err(hdev, "too many mice (max %d)\n", MOUSE_MAX_DEVICES);
+        return minor;
+    }
+
+    mdev = kzalloc(sizeof(*mdev), GFP_KERNEL);
+    if (!mdev) {
+        ret = -ENOMEM;
+        goto err_free_minor;
+    }
+    mdev->hdev = hdev;
+    mdev->minor = minor;
+    mdev->ring_size = ring_size;
+    mdev->report_interval_us = report_interval_us;
+    mdev->overflow_policy = overflow_policy;
+    mdev->tickless = tickless;
+    mdev->idle_timeout_us = idle_timeout_us;
+    mdev->adaptive_flush = adaptive_flush;
+    mdev->flush_threshold = flush_threshold;
+    mdev->move_mode = move_mode;
+    mdev->aggregate_reports = aggregate_reports;
+    mdev->wake_batch = wake_batch;
+    if (mdev->move_mode != MOUSE_MOVE_COALESCE) {
+        mdev->ring_size = max_t(unsigned int, mdev->ring_size, HIGH_RATE_RING_SIZE);
+    }
+
+    mdev->stats = alloc_percpu(struct mouse_stats);
+    if (!mdev->stats) {
+        ret = -ENOMEM;
+        goto err_free_mdev;
+    }
+    r = alloc_ring(mdev->ring_size);
+    if (!r) {
+        ret = -ENOMEM;
+        goto err_free_stats;
+    }
+    RCU_INIT_POINTER(mdev->ring, r);
+
+    atomic_set(&mdev->ring_mmap_count, 0);
+    mutex_init(&mdev->config_mutex);
+    INIT_LIST_HEAD(&mdev->reader_list);
+    spin_lock_init(&mdev->reader_list_lock);
+    spin_lock_init(&mdev->event_lock);
+    hrtimer_init(&mdev->move_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    mdev->move_timer.function = move_timer_callback;
+    init_waitqueue_head(&mdev->metrics_queue);
+
+    // Từ đây mdev được giải phóng qua put_device() -> mouse_dev_release()
+    device_initialize(&mdev->dev);
+    mdev->dev.class = mouse_class;
+    mdev->dev.parent = &hdev->dev;
+    mdev->dev.devt = MKDEV(MAJOR(dev_base), minor);
+    mdev->dev.groups = mouse_groups;
+    mdev->dev.release = mouse_dev_release;
+    ret = dev_set_name(&mdev->dev, DEVICE_NAME "%d", minor);
+    if (ret) goto err_put_device;
+
+    // drvdata phải có trước hid_hw_start() vì .event có thể chạy ngay sau đó
+    hid_set_drvdata(hdev, mdev);
     ret = hid_parse(hdev);
-    if (ret) return ret;
+    if (ret) goto err_put_device;
+    if (raw_fast_path) {
+        find_report_layout(hdev, &mdev->layout);
+        if (!mdev->layout.valid) {
+            hid_info(hdev, "unknown report layout, using per-usage event path\n");
+        }
+    }
     ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
-    if (ret) return ret;
+    if (ret) goto err_put_device;
 
-    // Khởi tạo timer cho báo cáo 125Hz
-    hrtimer_init(&move_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-    move_timer.function = move_timer_callback;
-    hrtimer_start(&move_timer, ktime_set(0, REPORT_INTERVAL_NS), HRTIMER_MODE_REL);
+    cdev_init(&mdev->cdev, &mouse_fops);
+    mdev->cdev.owner = THIS_MODULE;
+    ret = cdev_device_add(&mdev->cdev, &mdev->dev);
+    if (ret) goto err_hw_stop;
 
+    if (metrics) {
+        cdev_init(&mdev->metrics_cdev, &metrics_fops);
+        mdev->metrics_cdev.owner = THIS_MODULE;
+        cdev_set_parent(&mdev->metrics_cdev, &mdev->dev.kobj);
+        ret = cdev_add(&mdev->metrics_cdev, MKDEV(MAJOR(dev_base), MOUSE_MAX_DEVICES + minor), 1);
+        if (ret) goto err_del_cdev;
+
+        mdev->metrics_device = device_create(mouse_class, &mdev->dev, mdev->metrics_cdev.dev, mdev,
+                                             METRICS_NAME "%d", minor);
+        if (IS_ERR(mdev->metrics_device)) {
+            ret = PTR_ERR(mdev->metrics_device);
+            goto err_del_metrics_cdev;
+        }
+    }
+
+    // Lỗi debugfs không ảnh hưởng tới hoạt động chính của driver
+    mdev->debug_dir = debugfs_create_dir(dev_name(&mdev->dev), debug_root);
+    debugfs_create_file("stress", 0200, mdev->debug_dir, mdev, &stress_fops);
+    debugfs_create_file("stats", 0600, mdev->debug_dir, mdev, &stats_fops);
+
+    // Chế độ tickless: timer chỉ được bật khi có delta đầu tiên
+    if (!READ_ONCE(mdev->tickless)) {
+        spin_lock_irqsave(&mdev->event_lock, flags);
+        arm_move_timer(mdev);
+        spin_unlock_irqrestore(&mdev->event_lock, flags);
+    }
+
+    hid_info(hdev, "Connected %04x:%04x as /dev/%s\n", hdev->vendor, hdev->product, dev_name(&mdev->dev));
     return 0;
+
+err_del_metrics_cdev:
+    cdev_del(&mdev->metrics_cdev);
+err_del_cdev:
+    cdev_device_del(&mdev->cdev, &mdev->dev);
+err_hw_stop:
+    hid_hw_stop(hdev);
+    // Delta đầu tiên sau hid_hw_start() có thể đã bật move_timer: hủy như mouse_remove()
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    WRITE_ONCE(mdev->disconnected, true);
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+    stop_move_timer(mdev);
+err_put_device:
+    put_device(&mdev->dev);
+    return ret;
+
+err_free_stats:
+    free_percpu(mdev->stats);
+err_free_mdev:
+    kfree(mdev);
+err_free_minor:
+    ida_free(&mouse_ida, minor);
+    return ret;
 }
 
+/*
+ * Chỉ dừng chuột này: gỡ các node để không ai mở thêm, dừng HID và timer rồi
+ * đánh thức reader (read() trả -ENODEV, poll() báo EPOLLHUP). mdev còn sống tới
+ * khi file cuối cùng được đóng.
+ */
 static void mouse_remove(struct hid_device *hdev)
 {
-    hid_info(hdev, "Disconnected from Logitech 046d:c077\n");
-    hrtimer_cancel(&move_timer);
+    struct mouse_dev *mdev = hid_get_drvdata(hdev);
+    struct mouse_reader *reader;
+    unsigned long flags;
+
+    hid_info(hdev, "Disconnected /dev/%s\n", dev_name(&mdev->dev));
+    debugfs_remove_recursive(mdev->debug_dir);
+    if (metrics) {
+        device_destroy(mouse_class, mdev->metrics_cdev.dev);
+        cdev_del(&mdev->metrics_cdev);
+    }
+    cdev_device_del(&mdev->cdev, &mdev->dev);
     hid_hw_stop(hdev);
+
+    // Đặt cờ trong event_lock để arm_move_timer() không bật lại timer sau khi hủy
+    spin_lock_irqsave(&mdev->event_lock, flags);
+    WRITE_ONCE(mdev->disconnected, true);
+    spin_unlock_irqrestore(&mdev->event_lock, flags);
+    stop_move_timer(mdev);
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &mdev->reader_list, node) {
+        wake_up_interruptible(&reader->wait);
+    }
+    rcu_read_unlock();
+    wake_up_interruptible(&mdev->metrics_queue);
+    put_device(&mdev->dev);
 }
 
 static struct hid_driver mouse_driver = {
@@ -210,19 +2479,27 @@ static struct hid_driver mouse_driver = {
     .id_table = mouse_id_table,
     .probe = mouse_probe,
     .remove = mouse_remove,
+    .raw_event = mouse_raw_event,
     .event = mouse_event,
+    .report = mouse_report,
 };
 
 static int __init mouse_init(void) {
     int ret;
 
-    buffer = kmalloc(BUFFER_SIZE * sizeof(struct mouse_event), GFP_KERNEL);
-    if (!buffer) {
-        return -ENOMEM;
+    if (ring_size < MIN_RING_SIZE || ring_size > MAX_RING_SIZE ||
+        report_interval_us == 0 || report_interval_us > MAX_REPORT_INTERVAL_US ||
+        overflow_policy >= ARRAY_SIZE(overflow_policy_names) ||
+        idle_timeout_us > MAX_IDLE_TIMEOUT_US || flush_threshold == 0 || flush_threshold > S16_MAX ||
+        move_mode >= ARRAY_SIZE(move_mode_names) || aggregate_reports == 0 ||
+        aggregate_reports > MAX_AGGREGATE_REPORTS || wake_batch == 0 || wake_batch > MAX_RING_SIZE) {
+        return -EINVAL;
     }
+    ring_size = roundup_pow_of_two(ring_size);
 
-    ret = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
-    if (ret < 0) goto err_free_buffer;
+    // Mỗi chuột một minor cho luồng sự kiện và một minor cho metrics
+    ret = alloc_chrdev_region(&dev_base, 0, 2 * MOUSE_MAX_DEVICES, DEVICE_NAME);
+    if (ret < 0) return ret;
 
     mouse_class = class_create(DEVICE_NAME);
     if (IS_ERR(mouse_class)) {
@@ -230,45 +2507,30 @@ static int __init mouse_init(void) {
         goto err_free_region;
     }
 
-    cdev_init(&cdev, &mouse_fops);
-    ret = cdev_add(&cdev, dev_num, 1);
-    if (ret < 0) goto err_destroy_class;
-
-    mouse_device = device_create(mouse_class, NULL, dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(mouse_device)) {
-        ret = PTR_ERR(mouse_device);
-        goto err_del_cdev;
-    }
-
-    spin_lock_init(&buffer_lock);
-    init_waitqueue_head(&read_queue);
+    // Lỗi debugfs không ảnh hưởng tới hoạt động chính của driver
+    debug_root = debugfs_create_dir(DEVICE_NAME, NULL);
 
     ret = hid_register_driver(&mouse_driver);
-    if (ret) goto err_destroy_device;
+    if (ret) goto err_remove_debugfs;
 
     return 0;
 
-err_destroy_device:
-    device_destroy(mouse_class, dev_num);
-err_del_cdev:
-    cdev_del(&cdev);
-err_destroy_class:
+err_remove_debugfs:
+    debugfs_remove_recursive(debug_root);
     class_destroy(mouse_class);
 err_free_region:
-    unregister_chrdev_region(dev_num, 1);
-err_free_buffer:
-    kfree(buffer);
+    unregister_chrdev_region(dev_base, 2 * MOUSE_MAX_DEVICES);
     return ret;
 }
 
 static void __exit mouse_exit(void) {
+    // Gọi mouse_remove() cho từng chuột còn cắm
     hid_unregister_driver(&mouse_driver);
-    device_destroy(mouse_class, dev_num);
-    cdev_del(&cdev);
+    debugfs_remove_recursive(debug_root);
     class_destroy(mouse_class);
-    unregister_chrdev_region(dev_num, 1);
-    kfree(buffer);
+    unregister_chrdev_region(dev_base, 2 * MOUSE_MAX_DEVICES);
+    ida_destroy(&mouse_ida);
 }
 
 module_init(mouse_init);
-module_exit(mouse_exit);
\ No newline at end of file
+module_exit(mouse_exit);
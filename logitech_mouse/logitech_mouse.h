@@ -0,0 +1,250 @@
+#ifndef _LOGITECH_MOUSE_H
+#define _LOGITECH_MOUSE_H
+
+/*
+ * ABI chung giữa driver logitech_mouse và các chương trình user space.
+ * Dùng được cả trong kernel lẫn user space (chỉ phụ thuộc <linux/types.h> và <linux/ioctl.h>).
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Hai định dạng bản ghi sự kiện, chọn riêng cho mỗi file bằng MOUSE_IOC_SET_ABI:
+ *   MOUSE_ABI_V1  struct mouse_event (40 byte), mặc định của read() để tương thích
+ *   MOUSE_ABI_V2  struct mouse_event_v2 (16 byte), cũng là định dạng của ring mmap
+ */
+#define MOUSE_ABI_V1 1
+#define MOUSE_ABI_V2 2
+
+#define MOUSE_EVENT_MOVE  0
+#define MOUSE_EVENT_CLICK 1
+#define MOUSE_EVENT_WHEEL 2
+#define MOUSE_EVENT_GAP   3 // Đánh dấu chỗ bị mất sự kiện
+
+#define MOUSE_BUTTON_LEFT   0
+#define MOUSE_BUTTON_RIGHT  1
+#define MOUSE_BUTTON_MIDDLE 2
+
+#define MOUSE_ACTION_RELEASE 0
+#define MOUSE_ACTION_PRESS   1
+
+// v1: thời gian thực (CLOCK_REALTIME)
+struct mouse_event {
+    long long timestamp_sec;
+    long timestamp_nsec;
+    int type;           // MOUSE_EVENT_*
+    int x;              // Tọa độ x tương đối (GAP: số sự kiện bị mất)
+    int y;              // Tọa độ y tương đối
+    int button;         // MOUSE_BUTTON_*
+    int action;         // MOUSE_ACTION_*
+    int wheel_value;    // Giá trị cuộn
+};
+
+/*
+ * v2: thời gian CLOCK_MONOTONIC tính bằng ns, không bị ảnh hưởng khi đổi giờ hệ thống.
+ * timestamp_ns là lúc report HID đầu tiên của sự kiện tới driver (với MOVE là
+ * delta đầu tiên được gộp); flush_delay_us là khoảng từ đó tới lúc sự kiện rời
+ * bộ gộp để vào ring, bão hòa ở 65535.
+ *   MOVE   dx, dy là delta đã gộp
+ *   CLICK  button và action nằm trong info
+ *   WHEEL  dx là giá trị cuộn
+ *   GAP    số sự kiện bị mất = mouse_event_gap_count()
+ */
+struct mouse_event_v2 {
+    __u64 timestamp_ns;
+    __s16 dx;
+    __s16 dy;
+    __u16 info;         // bit 0-1: type, bit 2-3: button, bit 4: action
+    __u16 flush_delay_us;
+};
+
+#define MOUSE_EVENT_INFO(type, button, action) \
+    ((__u16)(((type) & 0x3) | (((button) & 0x3) << 2) | (((action) & 0x1) << 4)))
+#define MOUSE_EVENT_TYPE(info)   ((info) & 0x3)
+#define MOUSE_EVENT_BUTTON(info) (((info) >> 2) & 0x3)
+#define MOUSE_EVENT_ACTION(info) (((info) >> 4) & 0x1)
+
+// Thời điểm (CLOCK_MONOTONIC, ns) sự kiện được đưa vào ring
+static inline __u64 mouse_event_flush_ns(const struct mouse_event_v2 *event) {
+    return event->timestamp_ns + (__u64)event->flush_delay_us * 1000;
+}
+
+// Số sự kiện bị mất của GAP được chia vào dx (16 bit thấp) và dy (16 bit cao)
+static inline __u32 mouse_event_gap_count(const struct mouse_event_v2 *event) {
+    return (__u32)(__u16)event->dx | (__u32)(__u16)event->dy << 16;
+}
+
+static inline void mouse_event_set_gap_count(struct mouse_event_v2 *event, __u32 count) {
+    event->dx = (__s16)(count & 0xffff);
+    event->dy = (__s16)(count >> 16);
+}
+
+/*
+ * Ring chia sẻ qua mmap(). Mỗi lần open() có một con trỏ đọc riêng nên
+ * nhiều chương trình có thể cùng đọc một ring mà không lấy mất sự kiện của nhau.
+ *
+ * Offset mmap (tính theo trang):
+ *   MOUSE_MMAP_READER_PGOFF  struct mouse_ring_reader, 1 trang, đọc/ghi, riêng cho file
+ *   MOUSE_MMAP_RING_PGOFF    struct mouse_ring_header + các slot, chỉ đọc, dùng chung
+ *
+ * Trong vùng ring:
+ *   [0, data_offset)                        struct mouse_ring_header
+ *   [data_offset, + capacity * event_size)  mảng struct mouse_event_v2
+ *
+ * head và tail là số thứ tự tăng liên tục (không quấn vòng theo capacity),
+ * sự kiện số n nằm ở slot n & (capacity - 1). Driver ghi slot rồi mới tăng
+ * head (release) và không bao giờ chờ reader: khi một reader chậm hơn
+ * capacity sự kiện, các sự kiện cũ nhất của reader đó bị ghi đè. Reader
+ * nhận ra điều này khi head - tail > capacity, cộng phần bị mất vào lost
+ * và nhảy tail lên head - capacity. Với overflow_policy drop-newest/block,
+ * driver tự bỏ sự kiện khi ring đầy và ghi một sự kiện MOUSE_EVENT_GAP vào
+ * đúng chỗ bị mất.
+ *
+ * capacity có thể đổi lúc chạy (sysfs hoặc MOUSE_IOC_SET_CONFIG) nhưng chỉ
+ * khi không có ai đang map ring; reader đọc qua read() không bị ảnh hưởng.
+ */
+#define MOUSE_RING_MAGIC   0x4c4d5247 // "LMRG"
+#define MOUSE_RING_VERSION 3 // 3: slot dạng struct mouse_event_v2
+
+#define MOUSE_MMAP_READER_PGOFF 0
+#define MOUSE_MMAP_RING_PGOFF   1
+
+struct mouse_ring_header {
+    __u32 magic;
+    __u32 version;
+    __u32 capacity;     // Số slot trong ring (lũy thừa của 2)
+    __u32 event_size;   // sizeof(struct mouse_event_v2)
+    __u32 data_offset;  // Offset (byte) của slot đầu tiên, căn theo trang
+    __u32 reserved[11];
+    __u32 head;         // Chỉ driver ghi
+    __u32 pad_head[15];
+};
+
+struct mouse_ring_reader {
+    __u32 tail;         // Số thứ tự sự kiện tiếp theo sẽ đọc
+    __u32 reserved;
+    __u64 lost;         // Tổng số sự kiện bị ghi đè trước khi kịp đọc
+};
+
+#define MOUSE_OVERFLOW_DROP_OLDEST 0 // Ghi đè sự kiện cũ nhất, không bao giờ chờ reader
+#define MOUSE_OVERFLOW_DROP_NEWEST 1 // Bỏ sự kiện mới khi reader chậm nhất chưa đọc hết ring
+#define MOUSE_OVERFLOW_BLOCK       2 // Giữ sự kiện mới ở driver (có giới hạn) tới khi ring có chỗ
+
+/*
+ * Cách driver tạo MOVE từ các report HID (move_mode trong sysfs, riêng từng chuột):
+ *   coalesce     gộp delta, gửi một MOVE mỗi report_interval_us (mặc định, 125 Hz)
+ *   passthrough  mỗi report có chuyển động là một MOVE, không gộp (flush_delay_us = 0),
+ *                để có quỹ đạo đủ độ phân giải của chuột 1-8 kHz
+ *   aggregate    một MOVE cho mỗi aggregate_reports report, phần lẻ được gửi sau
+ *                tối đa report_interval_us
+ * Ở passthrough/aggregate, MOVE không đánh thức reader ngay mà đợi đủ wake_batch sự
+ * kiện hoặc tối đa report_interval_us; CLICK/WHEEL/GAP vẫn đánh thức ngay.
+ */
+#define MOUSE_MOVE_COALESCE    0
+#define MOUSE_MOVE_PASSTHROUGH 1
+#define MOUSE_MOVE_AGGREGATE   2
+
+/*
+ * Ngưỡng đánh thức riêng của mỗi file (MOUSE_IOC_SET_WAKEUP), cho reader không cần
+ * độ trễ thấp: read()/poll() chỉ báo có dữ liệu khi có ít nhất events sự kiện chưa
+ * đọc (tối đa nửa ring), khi sự kiện chưa đọc đầu tiên đã chờ timeout_us, hoặc ngay
+ * khi có sự kiện thuộc loại trong flags. GAP và rút chuột luôn đánh thức ngay.
+ * events = 0 là mặc định của driver: báo ngay khi có sự kiện (passthrough/aggregate
+ * thì theo wake_batch), khi đó timeout_us và flags phải bằng 0 (nếu không: EINVAL).
+ * timeout_us = 0 là không giới hạn thời gian chờ.
+ * Với ring mmap, ngưỡng áp dụng cho poll() (mouse_ring_wait()).
+ */
+#define MOUSE_WAKEUP_CLICK (1 << MOUSE_EVENT_CLICK)
+#define MOUSE_WAKEUP_WHEEL (1 << MOUSE_EVENT_WHEEL)
+#define MOUSE_WAKEUP_MASK  (MOUSE_WAKEUP_CLICK | MOUSE_WAKEUP_WHEEL)
+
+struct mouse_wakeup {
+    __u32 events;
+    __u32 timeout_us;
+    __u32 flags;        // MOUSE_WAKEUP_*
+    __u32 reserved;     // Phải bằng 0
+};
+
+/*
+ * Bộ lọc riêng của mỗi file (MOUSE_IOC_SET_FILTER): sự kiện không khớp không được
+ * read() trả về, không được tính vào ngưỡng đánh thức và không đánh thức file đó.
+ * Trường bằng 0 là không lọc theo trường đó; GAP luôn được giữ.
+ *   types       bit (1 << MOUSE_EVENT_*) của các loại sự kiện muốn nhận
+ *   buttons     bit (1 << MOUSE_BUTTON_*) của các nút muốn nhận CLICK
+ *   min_motion  MOVE có độ dài sqrt(dx^2 + dy^2) nhỏ hơn bị bỏ, tối đa 32767
+ * Ring mmap là dùng chung nên vẫn chứa mọi sự kiện: bộ lọc quyết định poll(), còn
+ * mouse_ring_read() tự áp bộ lọc đã đặt qua mouse_ring_set_filter().
+ */
+struct mouse_filter {
+    __u32 types;
+    __u32 buttons;
+    __u32 min_motion;
+    __u32 reserved;     // Phải bằng 0
+};
+
+#define MOUSE_FILTER_MAX_MOTION 32767
+
+static inline int mouse_filter_active(const struct mouse_filter *filter) {
+    return filter->types || filter->buttons || filter->min_motion;
+}
+
+static inline int mouse_filter_match(const struct mouse_filter *filter, const struct mouse_event_v2 *event) {
+    unsigned int type = MOUSE_EVENT_TYPE(event->info);
+
+    if (type == MOUSE_EVENT_GAP) {
+        return 1;
+    }
+    if (filter->types && !(filter->types & (1U << type))) {
+        return 0;
+    }
+    if (type == MOUSE_EVENT_CLICK && filter->buttons &&
+        !(filter->buttons & (1U << MOUSE_EVENT_BUTTON(event->info)))) {
+        return 0;
+    }
+    // dx^2 + dy^2 tối đa 2^31 nên vừa trong __u32
+    if (type == MOUSE_EVENT_MOVE && filter->min_motion) {
+        return (__u32)(event->dx * event->dx) + (__u32)(event->dy * event->dy) >=
+               filter->min_motion * filter->min_motion;
+    }
+    return 1;
+}
+
+// Cấu hình dùng chung của driver, giống các file trong /sys/class/logitech_mouse/logitech_mouse/
+struct mouse_config {
+    __u32 ring_size;            // Số slot, được làm tròn lên lũy thừa của 2
+    __u32 report_interval_us;   // Chu kỳ gộp sự kiện MOVE
+    __u32 overflow_policy;      // MOUSE_OVERFLOW_*
+    __u32 reserved;
+};
+
+/*
+ * /dev/logitech_mouse_metrics: mỗi quỹ đạo hoàn chỉnh cho ra một bản ghi.
+ * Quỹ đạo kết thúc ở CLICK/WHEEL và chỉ được tính khi kéo dài từ 1 đến 10 giây
+ * (giống pub.c); quỹ đạo có sự kiện bị driver bỏ (ring đầy, báo bằng GAP) bị bỏ.
+ */
+#define MOUSE_METRICS_FRAC_BITS      8     // path_length, speed: số thực dấu phẩy tĩnh Q24.8
+#define MOUSE_METRICS_ACCURACY_SCALE 10000 // accuracy tính theo phần vạn
+
+struct mouse_metrics {
+    __u64 start_ns;     // Sự kiện đầu tiên của quỹ đạo (CLOCK_MONOTONIC)
+    __u32 duration_us;
+    __u32 point_count;  // Số sự kiện trong quỹ đạo, gồm cả CLICK/WHEEL cuối
+    __u32 path_length;  // Tổng độ dài các đoạn MOVE, Q24.8
+    __u32 speed;        // path_length / thời gian (đơn vị/giây), Q24.8
+    __u16 accuracy;     // Tỉ lệ cặp đoạn MOVE liên tiếp cùng hướng (cos >= 0.98)
+    __u16 end_type;     // MOUSE_EVENT_CLICK hoặc MOUSE_EVENT_WHEEL
+    __u32 segments;     // Số cặp đoạn MOVE dùng để tính accuracy
+};
+
+#define MOUSE_IOC_MAGIC      'L'
+#define MOUSE_IOC_GET_LOST   _IOR(MOUSE_IOC_MAGIC, 1, __u64) // Đọc lost của file này
+#define MOUSE_IOC_GET_CONFIG _IOR(MOUSE_IOC_MAGIC, 2, struct mouse_config)
+#define MOUSE_IOC_SET_CONFIG _IOW(MOUSE_IOC_MAGIC, 3, struct mouse_config) // Cần CAP_SYS_ADMIN
+#define MOUSE_IOC_SET_ABI    _IOW(MOUSE_IOC_MAGIC, 4, __u32) // MOUSE_ABI_* cho read() của file này
+#define MOUSE_IOC_GET_WAKEUP _IOR(MOUSE_IOC_MAGIC, 5, struct mouse_wakeup)
+#define MOUSE_IOC_SET_WAKEUP _IOW(MOUSE_IOC_MAGIC, 6, struct mouse_wakeup) // Chỉ cho file này
+#define MOUSE_IOC_GET_FILTER _IOR(MOUSE_IOC_MAGIC, 7, struct mouse_filter)
+#define MOUSE_IOC_SET_FILTER _IOW(MOUSE_IOC_MAGIC, 8, struct mouse_filter) // Chỉ cho file này
+
+#endif
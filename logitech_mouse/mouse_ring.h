@@ -0,0 +1,262 @@
+#ifndef _MOUSE_RING_H
+#define _MOUSE_RING_H
+
+/*
+ * Thư viện nhỏ (chỉ gồm header) để đọc ring sự kiện của driver qua mmap(),
+ * không cần read()/copy_to_user cho từng sự kiện. Sự kiện trong ring luôn ở
+ * định dạng struct mouse_event_v2.
+ *
+ *   struct mouse_ring ring;
+ *   struct mouse_event_v2 batch[64];
+ *   mouse_ring_open(&ring, "/dev/logitech_mouse0");
+ *   for (;;) {
+ *       unsigned int n = mouse_ring_read(&ring, batch, 64);
+ *       if (n == 0) { mouse_ring_wait(&ring, -1); continue; }
+ *       ... xử lý batch[0..n-1] ...
+ *   }
+ *
+ * mouse_ring_peek()/mouse_ring_release() cho phép xử lý ngay trên ring
+ * (zero-copy), nhưng vì driver ghi đè sự kiện cũ khi reader quá chậm, người
+ * gọi phải kiểm tra giá trị trả về của mouse_ring_release(). Cách này không
+ * sinh sự kiện GAP cho phần bị mất và không áp bộ lọc của mouse_ring_set_filter().
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "logitech_mouse.h"
+
+struct mouse_ring {
+    int fd;
+    long page_size;
+    void *map;                          // Header + các slot (chỉ đọc)
+    size_t map_size;
+    struct mouse_ring_reader *reader;   // Trang điều khiển riêng (đọc/ghi)
+    const struct mouse_ring_header *hdr;
+    const struct mouse_event_v2 *events;
+    __u32 mask;
+    struct mouse_filter filter;         // mouse_ring_read() bỏ sự kiện không khớp
+};
+
+static inline void mouse_ring_close(struct mouse_ring *ring) {
+    if (ring->map && ring->map != MAP_FAILED) {
+        munmap(ring->map, ring->map_size);
+    }
+    if (ring->reader && (void *)ring->reader != MAP_FAILED) {
+        munmap(ring->reader, ring->page_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    ring->map = NULL;
+    ring->reader = NULL;
+    ring->fd = -1;
+}
+
+// Trả về 0 nếu thành công, -1 nếu lỗi (errno được giữ nguyên)
+static inline int mouse_ring_open(struct mouse_ring *ring, const char *path) {
+    const struct mouse_ring_header *hdr;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->page_size = sysconf(_SC_PAGESIZE);
+    ring->fd = open(path, O_RDWR);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->reader = mmap(NULL, ring->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                        MOUSE_MMAP_READER_PGOFF * ring->page_size);
+    if ((void *)ring->reader == MAP_FAILED) {
+        mouse_ring_close(ring);
+        return -1;
+    }
+
+    // Đọc header trước để biết kích thước thật của ring
+    hdr = mmap(NULL, ring->page_size, PROT_READ, MAP_SHARED, ring->fd,
+               MOUSE_MMAP_RING_PGOFF * ring->page_size);
+    if (hdr == MAP_FAILED) {
+        mouse_ring_close(ring);
+        return -1;
+    }
+    if (hdr->magic != MOUSE_RING_MAGIC || hdr->version != MOUSE_RING_VERSION ||
+        hdr->event_size != sizeof(struct mouse_event_v2)) {
+        munmap((void *)hdr, ring->page_size);
+        mouse_ring_close(ring);
+        return -1;
+    }
+    ring->map_size = hdr->data_offset + (size_t)hdr->capacity * hdr->event_size;
+    munmap((void *)hdr, ring->page_size);
+
+    ring->map = mmap(NULL, ring->map_size, PROT_READ, MAP_SHARED, ring->fd,
+                     MOUSE_MMAP_RING_PGOFF * ring->page_size);
+    if (ring->map == MAP_FAILED) {
+        mouse_ring_close(ring);
+        return -1;
+    }
+    ring->hdr = ring->map;
+    ring->events = (const struct mouse_event_v2 *)((const char *)ring->map + ring->hdr->data_offset);
+    ring->mask = ring->hdr->capacity - 1;
+    return 0;
+}
+
+/*
+ * Trả về số sự kiện liên tiếp sẵn sàng và con trỏ tới sự kiện đầu tiên.
+ * Khi ring bị quấn vòng, phần còn lại sẽ được trả về ở lần gọi tiếp theo.
+ * Nếu reader đã bị driver vượt quá một vòng, phần bị ghi đè được cộng vào lost.
+ */
+static inline unsigned int mouse_ring_peek(struct mouse_ring *ring, const struct mouse_event_v2 **first) {
+    __u32 head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+    __u32 tail = ring->reader->tail;
+    __u32 avail, contiguous;
+
+    if (head - tail > ring->hdr->capacity) {
+        ring->reader->lost += head - tail - ring->hdr->capacity;
+        tail = head - ring->hdr->capacity;
+        ring->reader->tail = tail;
+    }
+
+    avail = head - tail;
+    contiguous = ring->hdr->capacity - (tail & ring->mask);
+    *first = &ring->events[tail & ring->mask];
+    return avail < contiguous ? avail : contiguous;
+}
+
+/*
+ * Đánh dấu n sự kiện đã xử lý. Trả về số sự kiện đầu tiên trong n sự kiện đó
+ * có thể đã bị driver ghi đè trong lúc đang xử lý (0 nếu tất cả đều hợp lệ).
+ */
+static inline unsigned int mouse_ring_release(struct mouse_ring *ring, unsigned int n) {
+    __u32 tail = ring->reader->tail;
+    __u32 head, overwritten;
+
+    // Phải đọc xong dữ liệu slot trước khi đọc lại head
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ring->reader->tail, tail + n, __ATOMIC_RELEASE);
+
+    // Driver đang ghi (hoặc đã ghi) sự kiện head, tức là đè lên sự kiện head - capacity
+    overwritten = head - ring->hdr->capacity - tail + 1;
+    if ((int)overwritten <= 0) {
+        return 0;
+    }
+    return overwritten < n ? overwritten : n;
+}
+
+// Ghi một sự kiện GAP vào out[*count], gộp với GAP ngay trước nếu có
+static inline void mouse_ring_put_gap(struct mouse_event_v2 *out, unsigned int *count, __u64 lost) {
+    struct mouse_event_v2 *gap;
+    struct timespec ts;
+
+    if (*count > 0 && MOUSE_EVENT_TYPE(out[*count - 1].info) == MOUSE_EVENT_GAP) {
+        gap = &out[*count - 1];
+        mouse_event_set_gap_count(gap, mouse_event_gap_count(gap) + (__u32)lost);
+        return;
+    }
+    // Cùng đồng hồ với timestamp_ns của driver
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    gap = &out[(*count)++];
+    memset(gap, 0, sizeof(*gap));
+    gap->timestamp_ns = (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    gap->info = MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0);
+    mouse_event_set_gap_count(gap, (__u32)lost);
+}
+
+// Dồn các sự kiện khớp bộ lọc lên đầu mảng, trả về số sự kiện còn lại
+static inline unsigned int mouse_ring_filter(const struct mouse_filter *filter, struct mouse_event_v2 *events,
+                                             unsigned int n) {
+    unsigned int kept = 0;
+
+    if (!mouse_filter_active(filter)) {
+        return n;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        if (mouse_filter_match(filter, &events[i])) {
+            events[kept++] = events[i];
+        }
+    }
+    return kept;
+}
+
+/*
+ * Copy tối đa max sự kiện ra out và trả về số sự kiện đã ghi. Giống read(),
+ * chỗ bị mất sự kiện (reader chậm hoặc sự kiện bị ghi đè trong lúc copy)
+ * được đánh dấu bằng một sự kiện MOUSE_EVENT_GAP.
+ */
+static inline unsigned int mouse_ring_read(struct mouse_ring *ring, struct mouse_event_v2 *out, unsigned int max) {
+    unsigned int count = 0;
+
+    while (count < max) {
+        const struct mouse_event_v2 *first;
+        __u64 lost = ring->reader->lost;
+        unsigned int n = mouse_ring_peek(ring, &first);
+        unsigned int torn;
+
+        if (ring->reader->lost != lost) {
+            mouse_ring_put_gap(out, &count, ring->reader->lost - lost);
+        }
+        if (n == 0 || count == max) {
+            break;
+        }
+        if (n > max - count) {
+            n = max - count;
+        }
+        memcpy(&out[count], first, n * sizeof(struct mouse_event_v2));
+        torn = mouse_ring_release(ring, n);
+        if (torn) {
+            unsigned int start = count;
+
+            ring->reader->lost += torn;
+            // GAP thay vào các slot hỏng, ngay trước các sự kiện còn hợp lệ
+            mouse_ring_put_gap(out, &count, torn);
+            memmove(&out[count], &out[start + torn], (n - torn) * sizeof(struct mouse_event_v2));
+        }
+        count += mouse_ring_filter(&ring->filter, &out[count], n - torn);
+    }
+    return count;
+}
+
+// Tổng số sự kiện file này đã bỏ lỡ vì đọc chậm
+static inline unsigned long long mouse_ring_lost(const struct mouse_ring *ring) {
+    return ring->reader->lost;
+}
+
+// Chờ tới khi có sự kiện mới; trả về >0 khi có dữ liệu, 0 khi hết thời gian
+static inline int mouse_ring_wait(struct mouse_ring *ring, int timeout_ms) {
+    struct pollfd pfd = { .fd = ring->fd, .events = POLLIN };
+
+    return poll(&pfd, 1, timeout_ms);
+}
+
+/*
+ * Đặt ngưỡng đánh thức của file (xem struct mouse_wakeup): mouse_ring_wait() chỉ
+ * trả về khi có ít nhất events sự kiện, sau timeout_us, hoặc ngay khi có sự kiện
+ * thuộc loại trong flags. Trả về 0 nếu thành công, -1 nếu lỗi (driver cũ: ENOTTY;
+ * EINVAL khi events = 0 mà timeout_us hoặc flags khác 0).
+ */
+static inline int mouse_ring_set_wakeup(struct mouse_ring *ring, __u32 events, __u32 timeout_us, __u32 flags) {
+    struct mouse_wakeup wakeup = { .events = events, .timeout_us = timeout_us, .flags = flags };
+
+    return ioctl(ring->fd, MOUSE_IOC_SET_WAKEUP, &wakeup);
+}
+
+/*
+ * Chỉ nhận các sự kiện khớp bộ lọc (xem struct mouse_filter): driver không đánh
+ * thức mouse_ring_wait() vì sự kiện bị lọc, mouse_ring_read() bỏ chúng khi copy.
+ * Trả về 0 nếu thành công, -1 nếu lỗi (driver cũ: ENOTTY, bộ lọc không đổi).
+ */
+static inline int mouse_ring_set_filter(struct mouse_ring *ring, __u32 types, __u32 buttons, __u32 min_motion) {
+    struct mouse_filter filter = { .types = types, .buttons = buttons, .min_motion = min_motion };
+
+    if (ioctl(ring->fd, MOUSE_IOC_SET_FILTER, &filter) < 0) {
+        return -1;
+    }
+    ring->filter = filter;
+    return 0;
+}
+
+#endif
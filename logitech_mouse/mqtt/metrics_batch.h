@@ -0,0 +1,242 @@
+#ifndef METRICS_BATCH_H
+#define METRICS_BATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * Định dạng nhị phân của message kết quả giữa pub và sub (header-only, link -lz).
+ * Mỗi message là một batch gồm header cố định rồi tới phần thân có độ dài body_len:
+ *
+ *   off  size  trường
+ *     0     4  magic         METRICS_BATCH_MAGIC ("LMMB")
+ *     4     1  version       METRICS_BATCH_VERSION
+ *     5     1  flags         METRICS_BATCH_ZLIB: phần thân nén bằng zlib
+ *     6     2  header_size   Độ dài header, bên nhận bỏ qua phần thêm ở cuối
+ *     8     2  record_size   Độ dài mỗi bản ghi, bên nhận bỏ qua phần thêm ở cuối
+ *    10     2  record_count
+ *    12     4  body_len      Số byte phần thân trên đường truyền (sau khi nén)
+ *    16     8  host_id       Định danh máy chạy pub
+ *    24     4  device_id     Số N của /dev/logitech_mouseN
+ *    28     4  reserved      0
+ *    32     8  batch_seq     Tăng 1 mỗi batch của cùng (host_id, device_id)
+ *    40     8  sent_ns       CLOCK_REALTIME lúc đóng gói
+ *
+ * Bản ghi (record_count x record_size byte, chưa nén):
+ *
+ *     0     8  seq           Số thứ tự quỹ đạo của pub
+ *     8     8  trace_id      0 nếu pub không chạy với -t
+ *    16     8  end_ns        CLOCK_REALTIME của sự kiện kết thúc quỹ đạo
+ *    24     4  duration_us
+ *    28     4  point_count
+ *    32     4  speed         float IEEE 754
+ *    36     4  accuracy      float IEEE 754
+ *
+ * Mọi số đều little-endian. Thêm trường mới thì nối vào cuối header/bản ghi và
+ * tăng header_size/record_size; chỉ đổi version khi bố cục cũ không còn đúng.
+ */
+
+#define METRICS_BATCH_MAGIC 0x424d4d4cU  // "LMMB"
+#define METRICS_BATCH_VERSION 1
+#define METRICS_BATCH_ZLIB 0x01
+
+#define METRICS_BATCH_HEADER_SIZE 48
+#define METRICS_RECORD_SIZE 40
+#define METRICS_BATCH_MAX_RECORDS 64
+// Nén xong lớn hơn bản gốc thì gửi bản gốc, nên không cần chừa chỗ cho zlib
+#define METRICS_BATCH_MAX_BYTES (METRICS_BATCH_HEADER_SIZE + METRICS_BATCH_MAX_RECORDS * METRICS_RECORD_SIZE)
+
+struct metrics_batch_header {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t record_count;
+    uint64_t host_id;
+    uint32_t device_id;
+    uint64_t batch_seq;
+    uint64_t sent_ns;
+};
+
+struct metrics_record {
+    uint64_t seq;
+    uint64_t trace_id;
+    uint64_t end_ns;
+    uint32_t duration_us;
+    uint32_t point_count;
+    float speed;
+    float accuracy;
+};
+
+static inline void mb_put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void mb_put32(uint8_t *p, uint32_t v) {
+    mb_put16(p, v);
+    mb_put16(p + 2, v >> 16);
+}
+
+static inline void mb_put64(uint8_t *p, uint64_t v) {
+    mb_put32(p, v);
+    mb_put32(p + 4, v >> 32);
+}
+
+static inline uint16_t mb_get16(const uint8_t *p) {
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static inline uint32_t mb_get32(const uint8_t *p) {
+    return mb_get16(p) | (uint32_t)mb_get16(p + 2) << 16;
+}
+
+static inline uint64_t mb_get64(const uint8_t *p) {
+    return mb_get32(p) | (uint64_t)mb_get32(p + 4) << 32;
+}
+
+static inline void mb_put_float(uint8_t *p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    mb_put32(p, bits);
+}
+
+static inline float mb_get_float(const uint8_t *p) {
+    uint32_t bits = mb_get32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Payload bắt đầu bằng magic của batch (JSON luôn bắt đầu bằng '{')
+static inline int metrics_batch_is_binary(const void *payload, size_t len) {
+    return len >= 4 && mb_get32(payload) == METRICS_BATCH_MAGIC;
+}
+
+/*
+ * Đóng gói count bản ghi vào out (ít nhất METRICS_BATCH_MAX_BYTES byte).
+ * hdr->flags chỉ là yêu cầu: nén không lợi thì bỏ cờ METRICS_BATCH_ZLIB.
+ * Trả về số byte của message, -1 nếu count không hợp lệ.
+ */
+static inline int metrics_batch_encode(const struct metrics_batch_header *hdr, const struct metrics_record *records,
+                                       int count, uint8_t *out) {
+    uint8_t body[METRICS_BATCH_MAX_RECORDS * METRICS_RECORD_SIZE];
+    size_t raw_len = (size_t)count * METRICS_RECORD_SIZE;
+    uint8_t flags = hdr->flags & METRICS_BATCH_ZLIB;
+    uLongf body_len;
+
+    if (count < 0 || count > METRICS_BATCH_MAX_RECORDS) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        uint8_t *p = body + (size_t)i * METRICS_RECORD_SIZE;
+        mb_put64(p + 0, records[i].seq);
+        mb_put64(p + 8, records[i].trace_id);
+        mb_put64(p + 16, records[i].end_ns);
+        mb_put32(p + 24, records[i].duration_us);
+        mb_put32(p + 28, records[i].point_count);
+        mb_put_float(p + 32, records[i].speed);
+        mb_put_float(p + 36, records[i].accuracy);
+    }
+
+    body_len = raw_len;
+    if (flags & METRICS_BATCH_ZLIB) {
+        if (compress2(out + METRICS_BATCH_HEADER_SIZE, &body_len, body, raw_len, Z_BEST_SPEED) != Z_OK ||
+            body_len >= raw_len) {
+            flags &= ~METRICS_BATCH_ZLIB;
+            body_len = raw_len;
+        }
+    }
+    if (!(flags & METRICS_BATCH_ZLIB)) {
+        memcpy(out + METRICS_BATCH_HEADER_SIZE, body, raw_len);
+    }
+
+    memset(out, 0, METRICS_BATCH_HEADER_SIZE);
+    mb_put32(out + 0, METRICS_BATCH_MAGIC);
+    out[4] = METRICS_BATCH_VERSION;
+    out[5] = flags;
+    mb_put16(out + 6, METRICS_BATCH_HEADER_SIZE);
+    mb_put16(out + 8, METRICS_RECORD_SIZE);
+    mb_put16(out + 10, count);
+    mb_put32(out + 12, body_len);
+    mb_put64(out + 16, hdr->host_id);
+    mb_put32(out + 24, hdr->device_id);
+    mb_put64(out + 32, hdr->batch_seq);
+    mb_put64(out + 40, hdr->sent_ns);
+    return METRICS_BATCH_HEADER_SIZE + body_len;
+}
+
+/*
+ * Giải mã một batch vào hdr và records (tối đa max_records bản ghi).
+ * Trả về số bản ghi, -1 nếu payload hỏng hoặc khác version.
+ */
+static inline int metrics_batch_decode(const void *payload, size_t len, struct metrics_batch_header *hdr,
+                                       struct metrics_record *records, int max_records) {
+    const uint8_t *p = payload;
+    uint8_t body[METRICS_BATCH_MAX_RECORDS * 2 * METRICS_RECORD_SIZE];
+    const uint8_t *raw;
+    size_t header_size, record_size, raw_len;
+
+    if (len < METRICS_BATCH_HEADER_SIZE || !metrics_batch_is_binary(p, len) || p[4] != METRICS_BATCH_VERSION) {
+        return -1;
+    }
+    header_size = mb_get16(p + 6);
+    record_size = mb_get16(p + 8);
+    hdr->version = p[4];
+    hdr->flags = p[5];
+    hdr->record_count = mb_get16(p + 10);
+    hdr->host_id = mb_get64(p + 16);
+    hdr->device_id = mb_get32(p + 24);
+    hdr->batch_seq = mb_get64(p + 32);
+    hdr->sent_ns = mb_get64(p + 40);
+
+    if (header_size < METRICS_BATCH_HEADER_SIZE || record_size < METRICS_RECORD_SIZE ||
+        hdr->record_count > max_records || header_size + (size_t)mb_get32(p + 12) != len) {
+        return -1;
+    }
+    raw_len = (size_t)hdr->record_count * record_size;
+    raw = p + header_size;
+    if (hdr->flags & METRICS_BATCH_ZLIB) {
+        uLongf out_len = sizeof(body);
+        if (raw_len > sizeof(body) ||
+            uncompress(body, &out_len, raw, len - header_size) != Z_OK || out_len != raw_len) {
+            return -1;
+        }
+        raw = body;
+    } else if (len - header_size != raw_len) {
+        return -1;
+    }
+
+    for (int i = 0; i < hdr->record_count; i++) {
+        const uint8_t *r = raw + (size_t)i * record_size;
+        records[i].seq = mb_get64(r + 0);
+        records[i].trace_id = mb_get64(r + 8);
+        records[i].end_ns = mb_get64(r + 16);
+        records[i].duration_us = mb_get32(r + 24);
+        records[i].point_count = mb_get32(r + 28);
+        records[i].speed = mb_get_float(r + 32);
+        records[i].accuracy = mb_get_float(r + 36);
+    }
+    return hdr->record_count;
+}
+
+// Định danh máy: FNV-1a 64 bit của /etc/machine-id, không có thì của hostname
+static inline uint64_t metrics_host_id(void) {
+    char buf[256] = { 0 };
+    uint64_t hash = 1469598103934665603ULL;
+    FILE *f = fopen("/etc/machine-id", "r");
+
+    if (!f || !fgets(buf, sizeof(buf), f)) {
+        gethostname(buf, sizeof(buf) - 1);
+    }
+    if (f) {
+        fclose(f);
+    }
+    for (const char *c = buf; *c && *c != '\n'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif /* METRICS_BATCH_H */
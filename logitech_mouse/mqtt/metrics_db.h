@@ -0,0 +1,288 @@
+#ifndef METRICS_DB_H
+#define METRICS_DB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+
+/*
+ * Ghi kết quả quỹ đạo vào MySQL (header-only, dùng chung cho sub và test/db_bench).
+ *
+ * Giữ một kết nối suốt quá trình chạy. Các dòng được gom vào bộ đệm (write-behind)
+ * và ghi khi đủ flush_rows dòng hoặc dòng cũ nhất đã chờ flush_ms; mỗi lần ghi là
+ * một transaction gồm các INSERT nhiều dòng đã prepare sẵn. Mất kết nối thì thử
+ * kết nối lại ngay một lần, sau đó mỗi DB_RETRY_MS; trong lúc đó các dòng vẫn nằm
+ * trong bộ đệm, đầy thì bỏ dòng mới.
+ *
+ * Không tự khóa: người gọi phải tuần tự hóa mọi lời gọi trên cùng một metrics_db.
+ */
+
+#define DB_MAX_STMT_ROWS 64     // Số dòng tối đa của một câu INSERT đã prepare
+#define DB_FLUSH_ROWS 128       // Mặc định: ghi khi đủ số dòng này
+#define DB_FLUSH_MS 500         // hoặc khi dòng cũ nhất đã chờ lâu thế này
+#define DB_BUFFER_ROWS 8192     // Số dòng giữ lại tối đa khi MySQL không ghi được
+#define DB_RETRY_MS 1000        // Khoảng cách giữa các lần kết nối lại
+
+struct metrics_row {
+    double speed;
+    double accuracy;
+    // Mốc tracing, trace_id = 0 nếu message không mang trace
+    uint64_t trace_id, sent_ns, received_ns, received_mono;
+};
+
+struct metrics_db {
+    const char *host, *user, *password, *database, *table;
+    int flush_rows;
+    int flush_ms;
+    FILE *trace_file;           // Ghi dòng "sub,..." khi dòng đã commit
+
+    MYSQL *conn;
+    MYSQL_STMT *stmts[DB_MAX_STMT_ROWS + 1];   // stmts[n]: INSERT n dòng, prepare khi cần
+    struct metrics_row *rows;
+    int count;
+    uint64_t oldest_ns;         // CLOCK_MONOTONIC khi dòng đầu tiên vào bộ đệm
+    uint64_t next_connect_ns;   // Chưa tới thì không thử kết nối lại
+
+    unsigned long long stored, dropped, transactions, reconnects;
+};
+
+static inline uint64_t metrics_db_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void metrics_db_disconnect(struct metrics_db *db) {
+    for (int i = 0; i <= DB_MAX_STMT_ROWS; i++) {
+        if (db->stmts[i]) {
+            mysql_stmt_close(db->stmts[i]);
+            db->stmts[i] = NULL;
+        }
+    }
+    if (db->conn) {
+        mysql_close(db->conn);
+        db->conn = NULL;
+    }
+}
+
+static inline int metrics_db_connect(struct metrics_db *db) {
+    unsigned int timeout = 5;
+
+    db->conn = mysql_init(NULL);
+    if (!db->conn) {
+        return -1;
+    }
+    mysql_options(db->conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (mysql_real_connect(db->conn, db->host, db->user, db->password, db->database, 0, NULL, 0) == NULL) {
+        fprintf(stderr, "MySQL connect: %s\n", mysql_error(db->conn));
+        mysql_close(db->conn);
+        db->conn = NULL;
+        db->next_connect_ns = metrics_db_now() + DB_RETRY_MS * 1000000ULL;
+        return -1;
+    }
+    // Mỗi lần ghi bộ đệm là một transaction
+    mysql_autocommit(db->conn, 0);
+    return 0;
+}
+
+// Cấp bộ đệm và điền giá trị mặc định; kết nối bằng metrics_db_connect()
+static inline int metrics_db_init(struct metrics_db *db) {
+    if (db->flush_rows <= 0) {
+        db->flush_rows = DB_FLUSH_ROWS;
+    }
+    if (db->flush_ms <= 0) {
+        db->flush_ms = DB_FLUSH_MS;
+    }
+    if (!db->table) {
+        db->table = "mouse_metrics";
+    }
+    db->rows = calloc(DB_BUFFER_ROWS, sizeof(db->rows[0]));
+    return db->rows ? 0 : -1;
+}
+
+static inline int metrics_db_lost(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+// Câu INSERT n dòng, prepare lần đầu dùng tới; lỗi thì trả về NULL và mã lỗi trong *err
+static inline MYSQL_STMT *metrics_db_stmt(struct metrics_db *db, int n, unsigned int *err) {
+    char sql[128 + DB_MAX_STMT_ROWS * 8];
+    int len;
+
+    if (db->stmts[n]) {
+        return db->stmts[n];
+    }
+    len = snprintf(sql, sizeof(sql), "insert into %s(speed, accuracy) values (?, ?)", db->table);
+    for (int i = 1; i < n; i++) {
+        len += snprintf(sql + len, sizeof(sql) - len, ", (?, ?)");
+    }
+
+    MYSQL_STMT *stmt = mysql_stmt_init(db->conn);
+    if (!stmt) {
+        *err = CR_SERVER_LOST;
+        return NULL;
+    }
+    if (mysql_stmt_prepare(stmt, sql, len) != 0) {
+        *err = mysql_stmt_errno(stmt);
+        fprintf(stderr, "MySQL prepare: %s\n", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    db->stmts[n] = stmt;
+    return stmt;
+}
+
+// Ghi n dòng bằng một câu INSERT; trả về mã lỗi MySQL, 0 nếu thành công
+static inline unsigned int metrics_db_insert(struct metrics_db *db, const struct metrics_row *rows, int n) {
+    MYSQL_BIND bind[2 * DB_MAX_STMT_ROWS];
+    unsigned int err = 0;
+    MYSQL_STMT *stmt = metrics_db_stmt(db, n, &err);
+
+    if (!stmt) {
+        return err;
+    }
+    memset(bind, 0, 2 * n * sizeof(bind[0]));
+    for (int i = 0; i < n; i++) {
+        bind[2 * i].buffer_type = MYSQL_TYPE_DOUBLE;
+        bind[2 * i].buffer = (void *)&rows[i].speed;
+        bind[2 * i + 1].buffer_type = MYSQL_TYPE_DOUBLE;
+        bind[2 * i + 1].buffer = (void *)&rows[i].accuracy;
+    }
+    if (mysql_stmt_bind_param(stmt, bind) || mysql_stmt_execute(stmt)) {
+        err = mysql_stmt_errno(stmt);
+        fprintf(stderr, "MySQL insert: %s\n", mysql_stmt_error(stmt));
+        return err ? err : CR_SERVER_LOST;
+    }
+    return 0;
+}
+
+// Một transaction cho toàn bộ bộ đệm; trả về mã lỗi MySQL, 0 nếu thành công
+static inline unsigned int metrics_db_write(struct metrics_db *db) {
+    unsigned int err = 0;
+
+    for (int done = 0; done < db->count && !err; ) {
+        int n = db->count - done < DB_MAX_STMT_ROWS ? db->count - done : DB_MAX_STMT_ROWS;
+        err = metrics_db_insert(db, &db->rows[done], n);
+        done += n;
+    }
+    if (!err && mysql_commit(db->conn)) {
+        err = mysql_errno(db->conn);
+        fprintf(stderr, "MySQL commit: %s\n", mysql_error(db->conn));
+    }
+    if (err) {
+        mysql_rollback(db->conn);
+    }
+    return err;
+}
+
+/*
+ * Ghi toàn bộ bộ đệm. Trả về 0 nếu đã ghi (hoặc bộ đệm rỗng), -1 nếu chưa ghi
+ * được và các dòng vẫn còn trong bộ đệm.
+ */
+static inline int metrics_db_flush(struct metrics_db *db) {
+    unsigned int err;
+
+    if (db->count == 0) {
+        return 0;
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!db->conn) {
+            if (attempt == 0 && metrics_db_now() < db->next_connect_ns) {
+                return -1;
+            }
+            if (metrics_db_connect(db) < 0) {
+                return -1;
+            }
+            db->reconnects++;
+        }
+
+        err = metrics_db_write(db);
+        if (!err) {
+            break;
+        }
+        if (!metrics_db_lost(err)) {
+            // Lỗi dữ liệu/schema: ghi lại cũng lỗi, bỏ cả bộ đệm
+            fprintf(stderr, "Dropping %d rows\n", db->count);
+            db->dropped += db->count;
+            db->count = 0;
+            return -1;
+        }
+        // Mất kết nối: statement cũ không dùng được nữa, kết nối lại và thử một lần
+        metrics_db_disconnect(db);
+        db->next_connect_ns = metrics_db_now() + DB_RETRY_MS * 1000000ULL;
+    }
+    if (!db->conn) {
+        return -1;
+    }
+
+    if (db->trace_file) {
+        uint64_t stored_mono = metrics_db_now();
+        for (int i = 0; i < db->count; i++) {
+            const struct metrics_row *r = &db->rows[i];
+            if (r->trace_id) {
+                fprintf(db->trace_file, "sub,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)r->trace_id,
+                        (unsigned long long)r->sent_ns, (unsigned long long)r->received_ns,
+                        (unsigned long long)r->received_mono, (unsigned long long)stored_mono);
+            }
+        }
+    }
+    db->stored += db->count;
+    db->transactions++;
+    db->count = 0;
+    return 0;
+}
+
+/*
+ * Thêm một dòng vào bộ đệm, ghi ngay nếu đủ flush_rows dòng.
+ * Giá trị được làm tròn 2 chữ số như khi còn ghi bằng "%.2f".
+ */
+static inline void metrics_db_add(struct metrics_db *db, const struct metrics_row *row) {
+    if (db->count == DB_BUFFER_ROWS) {
+        db->dropped++;
+        return;
+    }
+    if (db->count == 0) {
+        db->oldest_ns = metrics_db_now();
+    }
+    struct metrics_row *r = &db->rows[db->count++];
+    *r = *row;
+    r->speed = round(row->speed * 100) / 100;
+    r->accuracy = round(row->accuracy * 100) / 100;
+    if (db->count >= db->flush_rows) {
+        metrics_db_flush(db);
+    }
+}
+
+// Mốc CLOCK_MONOTONIC cần gọi metrics_db_flush() tiếp theo, 0 nếu bộ đệm rỗng
+static inline uint64_t metrics_db_deadline(const struct metrics_db *db) {
+    uint64_t deadline;
+
+    if (db->count == 0) {
+        return 0;
+    }
+    deadline = db->oldest_ns + db->flush_ms * 1000000ULL;
+    if (!db->conn && db->next_connect_ns > deadline) {
+        deadline = db->next_connect_ns;
+    }
+    return deadline;
+}
+
+// Ghi nốt bộ đệm rồi đóng kết nối
+static inline void metrics_db_close(struct metrics_db *db) {
+    db->next_connect_ns = 0;
+    metrics_db_flush(db);
+    if (db->count) {
+        db->dropped += db->count;
+        db->count = 0;
+    }
+    metrics_db_disconnect(db);
+    free(db->rows);
+    db->rows = NULL;
+}
+
+#endif /* METRICS_DB_H */
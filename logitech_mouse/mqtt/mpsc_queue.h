@@ -0,0 +1,128 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hàng đợi vòng có giới hạn, không khóa, nhiều luồng ghi - một luồng đọc
+ * (header-only). Mỗi slot mang số thứ tự riêng như hàng đợi bounded của Vyukov:
+ * luồng ghi giành vị trí bằng CAS trên tail rồi ghi thẳng vào slot, luồng đọc
+ * chỉ cần load-acquire số thứ tự nên không có CAS ở phía đọc.
+ *
+ *   void *slot = mpsc_queue_reserve(&q, &ticket);  // NULL: hàng đợi đầy
+ *   ... ghi phần tử vào slot ...
+ *   mpsc_queue_commit(&q, ticket);
+ *
+ *   void *item = mpsc_queue_front(&q);             // NULL: rỗng (hoặc slot đầu chưa commit)
+ *   ... xử lý item ngay trên slot ...
+ *   mpsc_queue_pop(&q);
+ *
+ * Hàng đợi không tự đánh thức luồng đọc; người dùng tự ghép với eventfd/futex.
+ */
+
+#define MPSC_CACHE_LINE 64
+
+struct mpsc_queue {
+    unsigned char *slots;
+    size_t stride;              // Số thứ tự + phần tử, làm tròn lên cache line
+    size_t mask;                // Số slot - 1 (lũy thừa của 2)
+
+    size_t tail __attribute__((aligned(MPSC_CACHE_LINE)));  // Luồng ghi giành bằng CAS
+    size_t head __attribute__((aligned(MPSC_CACHE_LINE)));  // Chỉ luồng đọc ghi
+};
+
+static inline size_t *mpsc_queue_seq(const struct mpsc_queue *q, size_t pos) {
+    return (size_t *)(q->slots + (pos & q->mask) * q->stride);
+}
+
+static inline void *mpsc_queue_item(const struct mpsc_queue *q, size_t pos) {
+    return q->slots + (pos & q->mask) * q->stride + MPSC_CACHE_LINE;
+}
+
+// capacity được làm tròn lên lũy thừa của 2; trả về 0 nếu thành công, -1 nếu hết bộ nhớ
+static inline int mpsc_queue_init(struct mpsc_queue *q, size_t capacity, size_t item_size) {
+    size_t n = 2;
+
+    while (n < capacity) {
+        n <<= 1;
+    }
+    // Số thứ tự nằm riêng một cache line để phần tử luôn được căn lề
+    q->stride = MPSC_CACHE_LINE + (item_size + MPSC_CACHE_LINE - 1) / MPSC_CACHE_LINE * MPSC_CACHE_LINE;
+    q->mask = n - 1;
+    q->head = 0;
+    q->tail = 0;
+    q->slots = aligned_alloc(MPSC_CACHE_LINE, n * q->stride);
+    if (!q->slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        *mpsc_queue_seq(q, i) = i;
+    }
+    return 0;
+}
+
+static inline void mpsc_queue_free(struct mpsc_queue *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+static inline size_t mpsc_queue_capacity(const struct mpsc_queue *q) {
+    return q->mask + 1;
+}
+
+// Số phần tử đã giành chỗ mà luồng đọc chưa pop; gọi được từ bất kỳ luồng nào
+static inline size_t mpsc_queue_depth(const struct mpsc_queue *q) {
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
+
+// Luồng ghi: giành một slot, NULL nếu hàng đợi đầy
+static inline void *mpsc_queue_reserve(struct mpsc_queue *q, size_t *ticket) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        size_t seq = __atomic_load_n(mpsc_queue_seq(q, pos), __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *ticket = pos;
+                return mpsc_queue_item(q, pos);
+            }
+            // CAS thất bại đã nạp lại pos
+        } else if (diff < 0) {
+            // Slot vẫn giữ phần tử của vòng trước: đầy
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Luồng ghi: phần tử trong slot đã ghi xong, luồng đọc được thấy
+static inline void mpsc_queue_commit(struct mpsc_queue *q, size_t ticket) {
+    __atomic_store_n(mpsc_queue_seq(q, ticket), ticket + 1, __ATOMIC_RELEASE);
+}
+
+// Luồng đọc: phần tử đầu tiên, NULL nếu chưa có
+static inline void *mpsc_queue_front(const struct mpsc_queue *q) {
+    size_t head = q->head;
+
+    if (__atomic_load_n(mpsc_queue_seq(q, head), __ATOMIC_ACQUIRE) != head + 1) {
+        return NULL;
+    }
+    return mpsc_queue_item(q, head);
+}
+
+// Luồng đọc: trả slot đầu tiên cho luồng ghi (sau khi mpsc_queue_front() khác NULL)
+static inline void mpsc_queue_pop(struct mpsc_queue *q) {
+    size_t head = q->head;
+
+    __atomic_store_n(mpsc_queue_seq(q, head), head + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELAXED);
+}
+
+#endif /* MPSC_QUEUE_H */
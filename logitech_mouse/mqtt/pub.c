@@ -3,8 +3,24 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <math.h>
-#include <MQTTClient.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <MQTTAsync.h>
+
+#include "../mouse_ring.h"
+#include "metrics_batch.h"
+#include "spool.h"
 
 /*
 Broker: broker.emqx.io
@@ -13,163 +29,1063 @@ TCP Port: 1883
 #define ADDRESS     "tcp://broker.emqx.io:1883"
 #define CLIENTID    "publisher_mouse_driver"
 #define PUB_TOPIC   "mouse_driver/speed_and_accuracy"
-#define DEVICE_PATH "/dev/logitech_mouse"
-#define MAX_EVENTS  10000 // Tương tự MAX_POINTS trong mouse_listener.c
+#define DEVICE_PATH "/dev/logitech_mouse0" // Mỗi trạm chạy một pub cho chuột của mình (argv[1])
 #define COSINE_TOLERANCE 0.98 // cos(11.5 độ) ~ 0.98
 #define MIN_VECTOR_LENGTH 1.0 // Độ dài vector tối thiểu để tính accuracy
+#define MQTT_TICK_MS 1000     // Chu kỳ thử kết nối lại với broker
+#define READ_BATCH  64        // Số sự kiện lấy ra khỏi ring mỗi lần
+#define WAKE_TIMEOUT_US 250000 // Luồng đọc thức dậy khi đủ READ_BATCH sự kiện, sau chừng này, hoặc ở CLICK/WHEEL
+#define PUB_WINDOW  16        // Số message QoS1 đang chờ broker xác nhận tối đa (-w)
+#define PUB_MAX_WINDOW 256
+#define PUB_QUEUE_SIZE 1024   // Số message chờ gửi tối đa, đầy thì bỏ message cũ nhất
+#define PUB_MAX_ATTEMPTS 5    // Số lần gửi một message trước khi bỏ
+#define SHUTDOWN_FLUSH_MS 2000 // Thời gian chờ gửi nốt khi thoát
+#define BATCH_RECORDS 32      // Đóng gói khi đủ số quỹ đạo này (-b)
+#define BATCH_MAX_AGE_MS 1000 // hoặc khi quỹ đạo đầu tiên đã chờ lâu thế này (-B)
+#define EVENT_QUEUE_SIZE 65536 // Sự kiện chờ tính toán giữa luồng đọc và luồng chính (lũy thừa của 2)
+#define SPOOL_MAX_MB 256      // Mặc định: dung lượng đĩa tối đa của spool (-S)
 
-// Cấu trúc dữ liệu sự kiện chuột từ driver
-struct mouse_event {
-    long long timestamp_sec; // Giây
-    long timestamp_nsec;     // Nano giây
-    int type;                // 0: MOVE, 1: CLICK, 2: WHEEL
-    int x;                   // Tọa độ x
-    int y;                   // Tọa độ y
-    int button;              // 0: LEFT, 1: RIGHT, 2: MIDDLE
-    int action;              // 0: RELEASE, 1: PRESS
-    int wheel_value;         // Giá trị cuộn
+/*
+ * Quỹ đạo đang được thu thập. Không giữ lại sự kiện: mỗi sự kiện chỉ cập nhật
+ * các tổng tích lũy nên quỹ đạo dài bao nhiêu cũng dùng cùng một lượng bộ nhớ,
+ * và kết quả có ngay khi CLICK/WHEEL kết thúc quỹ đạo tới.
+ */
+struct trajectory {
+    uint64_t start_ns;          // timestamp_ns của sự kiện đầu tiên
+    int event_count;
+    double trajectory_time;     // Giây, tính tới sự kiện mới nhất
+    int move_run;               // Số MOVE liên tiếp tính tới sự kiện mới nhất (tối đa 3)
+    double prev_dx, prev_dy;    // MOVE trước đó trong chuỗi
+    double total_distance;
+    int eqdir_count;            // Số cặp đoạn MOVE cùng hướng
+    int valid_segments;         // Số cặp đoạn MOVE đủ dài để xét hướng
 };
 
-// Hàm gửi dữ liệu lên MQTT
-void publish(MQTTClient client, char* topic, char* payload) {
-    MQTTClient_message pubmsg = MQTTClient_message_initializer;
-    pubmsg.payload = payload;
-    pubmsg.payloadlen = strlen(pubmsg.payload);
-    pubmsg.qos = 1;
-    pubmsg.retained = 0;
-    MQTTClient_deliveryToken token;
-    MQTTClient_publishMessage(client, topic, &pubmsg, &token);
-    MQTTClient_waitForCompletion(client, token, 1000L);
-    printf("Message '%s' with delivery token %d delivered\n", payload, token);
-}
-
-// Tính tốc độ và độ chính xác từ dữ liệu chuột
-void calculate_speed_and_accuracy(struct mouse_event events[], int count, double* speed, double* accuracy) {
-    if (count < 2) {
-        *speed = 0.0;
-        *accuracy = 0.0;
+/*
+ * Chế độ tracing (-t file): với mỗi quỹ đạo được gửi, ghi một dòng
+ *   pub,<id>,<arrival>,<flush>,<read>,<close>,<publish>
+ * là các mốc CLOCK_MONOTONIC (ns) của sự kiện kết thúc quỹ đạo: driver nhận
+ * report, driver ghi vào ring, pub lấy ra khỏi ring, tính xong, broker xác nhận.
+ * Bản ghi (hoặc payload JSON với -j) mang thêm trace_id, cùng sent_ns
+ * (CLOCK_REALTIME) của batch, để sub ghi tiếp phần
+ * của mình; test/latency_report.c tính phân vị độ trễ từng chặng.
+ */
+static FILE* trace_file;
+static uint64_t trace_seq;
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Luồng đọc chỉ chép sự kiện từ ring của driver sang event_queue nên ring không
+ * bị tràn khi luồng chính (tính quỹ đạo, gửi, ghi spool) chậm lại. Hàng đợi một
+ * luồng ghi - một luồng đọc, không khóa; luồng đọc báo luồng chính qua wake_fd.
+ * Đầy thì bỏ sự kiện và chèn GAP trước sự kiện kế tiếp, như driver làm khi ring tràn.
+ *
+ * Không map được ring (FIFO của offline/mouse_replay, file sự kiện thô, driver cũ)
+ * thì luồng đọc dùng read() trên fd: nguồn này tự chờ được nên hàng đợi đầy thì
+ * luồng đọc chờ chứ không bỏ, và hết dữ liệu thì đặt eof để luồng chính dừng.
+ */
+struct queued_event {
+    struct mouse_event_v2 event;
+    uint64_t read_ns;           // Lúc lấy ra khỏi ring, chỉ dùng khi có -t
+};
+
+struct event_queue {
+    struct queued_event slots[EVENT_QUEUE_SIZE];
+    unsigned int tail __attribute__((aligned(64)));     // Chỉ luồng đọc ghi
+    unsigned int head __attribute__((aligned(64)));     // Chỉ luồng chính ghi
+    int wake_fd;                // Luồng đọc báo có sự kiện mới
+    int stop_fd;                // Luồng chính báo luồng đọc dừng
+    int gap;                    // Vừa bỏ sự kiện, chèn GAP trước sự kiện kế tiếp
+    unsigned long long overflow;    // Chỉ luồng đọc dùng
+    struct mouse_ring* ring;    // NULL: đọc bằng read() trên fd
+    int fd;
+    int eof;                    // Luồng đọc đã đọc hết fd
+    pthread_t thread;
+};
+
+/*
+ * Gửi kết quả lên broker không chặn việc đọc ring. process_event() chỉ xếp kết
+ * quả vào hàng đợi; publisher_pump() gửi tới khi có `window` message đang chờ
+ * broker xác nhận. Callback của Paho chạy trên luồng riêng, trả slot rồi báo
+ * vòng epoll qua wake_fd để gửi tiếp. Message gửi lỗi được đưa lại đầu hàng đợi,
+ * tối đa PUB_MAX_ATTEMPTS lần.
+ *
+ * Với spool (-s dir), khi hàng đợi gần đầy vì broker chậm hoặc mất kết nối, message
+ * mới được ghi nối đuôi vào spool trên đĩa (spool.h) thay vì bỏ message cũ nhất; từ
+ * lúc đó mọi message mới đều vào spool để giữ thứ tự. Có kết nối lại thì
+ * publisher_refill() đọc spool theo thứ tự, mỗi lần vừa đủ lấp cửa sổ gửi.
+ */
+struct trace_stamp {
+    uint64_t trace_id, arrival_ns, flush_ns, read_ns, close_ns;
+};
+
+struct outgoing {
+    unsigned char payload[METRICS_BATCH_MAX_BYTES];
+    int len;
+    int attempts;
+    int records;                // Số quỹ đạo trong message
+    uint64_t batch_seq;         // 0 với message JSON
+    // Mốc tracing của sự kiện kết thúc từng quỹ đạo, chỉ dùng khi có -t
+    struct trace_stamp trace[METRICS_BATCH_MAX_RECORDS];
+};
+
+/*
+ * Các quỹ đạo chờ đóng gói thành một batch (định dạng trong metrics_batch.h).
+ * Batch được gửi khi đủ max_records quỹ đạo, hoặc khi timer_fd (đặt lúc quỹ đạo
+ * đầu tiên vào batch) hết hạn sau max_age_ms. Chỉ luồng chính dùng.
+ */
+struct batch_builder {
+    struct metrics_batch_header header;
+    struct metrics_record records[METRICS_BATCH_MAX_RECORDS];
+    struct trace_stamp trace[METRICS_BATCH_MAX_RECORDS];
+    int count;
+    int max_records;
+    int max_age_ms;
+    int json;                   // -j: mỗi quỹ đạo một message JSON như trước
+    int timer_fd;
+    uint64_t record_seq;
+};
+
+struct publisher;
+
+struct inflight_slot {
+    struct outgoing msg;
+    struct publisher* pub;
+    int in_use;
+};
+
+struct publisher {
+    MQTTAsync client;
+    MQTTAsync_connectOptions conn_opts;
+    pthread_mutex_t lock;           // Bảo vệ mọi trường bên dưới
+    int wake_fd;
+    int window;
+    int connected, connecting;
+    struct outgoing queue[PUB_QUEUE_SIZE];  // Hàng đợi vòng các message chưa gửi
+    unsigned int head, count;
+    struct inflight_slot inflight[PUB_MAX_WINDOW];
+    int inflight_count;
+    unsigned long long delivered, retried, dropped;
+    struct batch_builder batch;     // Không cần lock, chỉ luồng chính dùng
+    struct spool* spool;            // NULL nếu không có -s; chỉ luồng chính dùng
+    int spooling;                   // Đang có message nằm trong spool
+};
+
+static void publisher_wake(struct publisher* pub) {
+    uint64_t one = 1;
+    if (write(pub->wake_fd, &one, sizeof(one)) < 0) {
+        perror("eventfd");
+    }
+}
+
+// Gọi khi giữ pub->lock. Đầy thì bỏ message cũ nhất (push cuối) hoặc chính message (push đầu)
+static void queue_push_locked(struct publisher* pub, const struct outgoing* msg, int front) {
+    if (pub->count == PUB_QUEUE_SIZE) {
+        pub->dropped++;
+        if (front) {
+            return;
+        }
+        pub->head = (pub->head + 1) % PUB_QUEUE_SIZE;
+        pub->count--;
+    }
+    if (front) {
+        pub->head = (pub->head + PUB_QUEUE_SIZE - 1) % PUB_QUEUE_SIZE;
+        pub->queue[pub->head] = *msg;
+    } else {
+        pub->queue[(pub->head + pub->count) % PUB_QUEUE_SIZE] = *msg;
+    }
+    pub->count++;
+}
+
+static void release_slot_locked(struct inflight_slot* slot) {
+    slot->in_use = 0;
+    slot->pub->inflight_count--;
+}
+
+static void on_send_success(void* context, MQTTAsync_successData* response) {
+    struct inflight_slot* slot = context;
+    struct publisher* pub = slot->pub;
+
+    if (trace_file) {
+        uint64_t publish_ns = now_ns(CLOCK_MONOTONIC);
+        for (int i = 0; i < slot->msg.records; i++) {
+            const struct trace_stamp* t = &slot->msg.trace[i];
+            // Message đọc lại từ spool không còn mốc thời gian của pub
+            if (!t->trace_id) {
+                continue;
+            }
+            fprintf(trace_file, "pub,%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)t->trace_id,
+                    (unsigned long long)t->arrival_ns, (unsigned long long)t->flush_ns,
+                    (unsigned long long)t->read_ns, (unsigned long long)t->close_ns,
+                    (unsigned long long)publish_ns);
+        }
+    }
+    if (slot->msg.batch_seq) {
+        printf("Batch %llu (%d trajectories, %d bytes) delivered\n",
+               (unsigned long long)slot->msg.batch_seq, slot->msg.records, slot->msg.len);
+    } else {
+        printf("Message '%s' delivered\n", (const char*)slot->msg.payload);
+    }
+
+    pthread_mutex_lock(&pub->lock);
+    release_slot_locked(slot);
+    pub->delivered++;
+    pthread_mutex_unlock(&pub->lock);
+    publisher_wake(pub);
+}
+
+static void on_send_failure(void* context, MQTTAsync_failureData* response) {
+    struct inflight_slot* slot = context;
+    struct publisher* pub = slot->pub;
+    static struct outgoing msg;     // Lớn, chỉ dùng khi giữ pub->lock
+
+    pthread_mutex_lock(&pub->lock);
+    msg = slot->msg;
+    release_slot_locked(slot);
+    if (++msg.attempts < PUB_MAX_ATTEMPTS) {
+        queue_push_locked(pub, &msg, 1);
+        pub->retried++;
+    } else {
+        pub->dropped++;
+        printf("Message with %d trajectories dropped after %d attempts, return code %d\n",
+               msg.records, msg.attempts, response ? response->code : 0);
+    }
+    pthread_mutex_unlock(&pub->lock);
+    publisher_wake(pub);
+}
+
+// Đưa message từ spool lên hàng đợi, vừa đủ lấp cửa sổ gửi. Chỉ gọi từ luồng chính
+static void publisher_refill(struct publisher* pub) {
+    static struct outgoing msg;     // Lớn, chỉ luồng chính dùng
+    struct spool_entry e;
+
+    if (!pub->spool) {
         return;
     }
+    while (spool_peek(pub->spool, &e)) {
+        int room;
 
+        if (e.len > sizeof(msg.payload)) {
+            spool_consume(pub->spool);
+            continue;
+        }
+        pthread_mutex_lock(&pub->lock);
+        room = pub->connected && pub->count < (unsigned int)pub->window;
+        if (room) {
+            memcpy(msg.payload, e.payload, e.len);
+            msg.len = e.len;
+            msg.attempts = 0;
+            msg.records = e.records;
+            msg.batch_seq = e.batch_seq;
+            memset(msg.trace, 0, sizeof(msg.trace));
+            queue_push_locked(pub, &msg, 0);
+        }
+        pthread_mutex_unlock(&pub->lock);
+        if (!room) {
+            return;
+        }
+        spool_consume(pub->spool);
+    }
+    if (pub->spooling) {
+        pub->spooling = 0;
+        printf("Đã gửi hết spool (%llu message đọc lại)\n", pub->spool->replayed);
+    }
+}
+
+// Gửi từ hàng đợi cho tới khi đầy cửa sổ. Chỉ gọi từ luồng chính
+static void publisher_pump(struct publisher* pub) {
+    while (1) {
+        struct inflight_slot* slot = NULL;
+
+        publisher_refill(pub);
+
+        pthread_mutex_lock(&pub->lock);
+        if (!pub->connected || pub->count == 0 || pub->inflight_count >= pub->window) {
+            pthread_mutex_unlock(&pub->lock);
+            return;
+        }
+        for (int i = 0; i < pub->window; i++) {
+            if (!pub->inflight[i].in_use) {
+                slot = &pub->inflight[i];
+                break;
+            }
+        }
+        slot->msg = pub->queue[pub->head];
+        slot->in_use = 1;
+        pub->head = (pub->head + 1) % PUB_QUEUE_SIZE;
+        pub->count--;
+        pub->inflight_count++;
+        pthread_mutex_unlock(&pub->lock);
+
+        // Paho copy payload nên slot chỉ cần giữ tới khi có callback
+        MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+        MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+        pubmsg.payload = slot->msg.payload;
+        pubmsg.payloadlen = slot->msg.len;
+        pubmsg.qos = 1;
+        pubmsg.retained = 0;
+        opts.onSuccess = on_send_success;
+        opts.onFailure = on_send_failure;
+        opts.context = slot;
+
+        int rc = MQTTAsync_sendMessage(pub->client, PUB_TOPIC, &pubmsg, &opts);
+        if (rc != MQTTASYNC_SUCCESS) {
+            // Chưa tới broker nên không tính là một lần thử; đợi kết nối lại
+            pthread_mutex_lock(&pub->lock);
+            release_slot_locked(slot);
+            queue_push_locked(pub, &slot->msg, 1);
+            pthread_mutex_unlock(&pub->lock);
+            printf("Failed to send message, return code %d\n", rc);
+            return;
+        }
+    }
+}
+
+static void on_connect_success(void* context, MQTTAsync_successData* response) {
+    struct publisher* pub = context;
+
+    pthread_mutex_lock(&pub->lock);
+    pub->connected = 1;
+    pub->connecting = 0;
+    pthread_mutex_unlock(&pub->lock);
+    printf("Connected to %s\n", ADDRESS);
+    publisher_wake(pub);
+}
+
+static void on_connect_failure(void* context, MQTTAsync_failureData* response) {
+    struct publisher* pub = context;
+
+    pthread_mutex_lock(&pub->lock);
+    pub->connecting = 0;
+    pthread_mutex_unlock(&pub->lock);
+    printf("Failed to connect, return code %d\n", response ? response->code : 0);
+}
+
+static void on_connection_lost(void* context, char* cause) {
+    struct publisher* pub = context;
+
+    pthread_mutex_lock(&pub->lock);
+    pub->connected = 0;
+    pthread_mutex_unlock(&pub->lock);
+    printf("Connection lost: %s\n", cause ? cause : "unknown");
+}
+
+// pub không subscribe nhưng Paho bắt buộc có callback này
+static int on_message_arrived(void* context, char* topic_name, int topic_len, MQTTAsync_message* message) {
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topic_name);
+    return 1;
+}
+
+// Kết nối lại nếu bị mất; kết quả báo qua on_connect_success/on_connect_failure
+int service_broker(struct publisher* pub) {
+    pthread_mutex_lock(&pub->lock);
+    if (pub->connected || pub->connecting) {
+        pthread_mutex_unlock(&pub->lock);
+        return MQTTASYNC_SUCCESS;
+    }
+    pub->connecting = 1;
+    pthread_mutex_unlock(&pub->lock);
+
+    int rc = MQTTAsync_connect(pub->client, &pub->conn_opts);
+    if (rc != MQTTASYNC_SUCCESS) {
+        pthread_mutex_lock(&pub->lock);
+        pub->connecting = 0;
+        pthread_mutex_unlock(&pub->lock);
+        printf("Reconnect failed, return code %d\n", rc);
+    }
+    return rc;
+}
+
+static void trajectory_reset(struct trajectory* traj) {
+    memset(traj, 0, sizeof(*traj));
+}
+
+/*
+ * Cập nhật quỹ đạo với một sự kiện, cùng quy tắc với cách tính hai lượt cũ:
+ * độ dài cộng từ MOVE thứ hai của mỗi chuỗi MOVE liên tiếp, hướng so sánh
+ * giữa hai MOVE liền nhau kể từ MOVE thứ ba.
+ */
+static void trajectory_add(struct trajectory* traj, const struct mouse_event_v2* event) {
+    if (traj->event_count++ == 0) {
+        traj->start_ns = event->timestamp_ns;
+    }
+    traj->trajectory_time = (double)(event->timestamp_ns - traj->start_ns) / 1e9;
+
+    if (MOUSE_EVENT_TYPE(event->info) != MOUSE_EVENT_MOVE) {
+        traj->move_run = 0;
+        return;
+    }
+
+    double dx = (double)event->dx;
+    double dy = (double)event->dy;
+    double len = sqrt(dx * dx + dy * dy);
+
+    if (traj->move_run < 3) {
+        traj->move_run++;
+    }
+    if (traj->move_run >= 2) {
+        traj->total_distance += len;
+    }
+    if (traj->move_run == 3) {
+        double prev_len = sqrt(traj->prev_dx * traj->prev_dx + traj->prev_dy * traj->prev_dy);
+
+        // Chỉ tính nếu cả hai đoạn đủ dài
+        if (prev_len >= MIN_VECTOR_LENGTH && len >= MIN_VECTOR_LENGTH) {
+            double cos_theta = (traj->prev_dx * dx + traj->prev_dy * dy) / (prev_len * len);
+
+            if (cos_theta > 1.0) cos_theta = 1.0;
+            if (cos_theta < -1.0) cos_theta = -1.0;
+
+            if (cos_theta >= COSINE_TOLERANCE) {
+                traj->eqdir_count++;
+            }
+            traj->valid_segments++;
+        }
+    }
+    traj->prev_dx = dx;
+    traj->prev_dy = dy;
+}
+
+// Tốc độ và độ chính xác của quỹ đạo tính tới sự kiện mới nhất
+static void trajectory_result(const struct trajectory* traj, double* speed, double* accuracy) {
     // Tổng thời gian bao gồm cả điểm cuối (CLICK hoặc WHEEL)
-    double total_time = (double)(events[count - 1].timestamp_sec - events[0].timestamp_sec) +
-                        (double)(events[count - 1].timestamp_nsec - events[0].timestamp_nsec) / 1e9;
-    if (total_time < 1.0 || total_time > 10.0) {
+    if (traj->event_count < 2 || traj->trajectory_time < 1.0 || traj->trajectory_time > 10.0) {
         *speed = 0.0;
         *accuracy = 0.0;
         return;
     }
+    *speed = traj->total_distance / traj->trajectory_time;
+    *accuracy = (traj->valid_segments > 0) ? (double)traj->eqdir_count / traj->valid_segments : 1.0;
+}
+
+static void publisher_spill(struct publisher* pub, const struct outgoing* msg) {
+    struct spool_entry e = { msg->payload, msg->len, msg->records, msg->batch_seq };
+
+    if (spool_append(pub->spool, &e) < 0) {
+        perror("spool");
+        pthread_mutex_lock(&pub->lock);
+        pub->dropped++;
+        pthread_mutex_unlock(&pub->lock);
+        return;
+    }
+    if (!pub->spooling) {
+        pub->spooling = 1;
+        printf("Broker chậm, ghi message vào spool %s\n", pub->spool->dir);
+    }
+}
+
+static void publisher_enqueue(struct publisher* pub, const struct outgoing* msg) {
+    int spill = 0;
+
+    pthread_mutex_lock(&pub->lock);
+    // Chừa PUB_MAX_WINDOW chỗ để message gửi lỗi luôn quay lại được đầu hàng đợi
+    if (pub->spool && (!spool_empty(pub->spool) ||
+                       pub->count + pub->inflight_count >= PUB_QUEUE_SIZE - PUB_MAX_WINDOW)) {
+        spill = 1;
+    } else {
+        queue_push_locked(pub, msg, 0);
+    }
+    pthread_mutex_unlock(&pub->lock);
+    if (spill) {
+        publisher_spill(pub, msg);
+    }
+    publisher_pump(pub);
+}
+
+// Đóng gói các quỹ đạo đang chờ thành một batch và xếp vào hàng đợi gửi
+void flush_batch(struct publisher* pub) {
+    struct batch_builder* b = &pub->batch;
+    static struct outgoing msg;     // Lớn, chỉ luồng chính dùng
+    struct itimerspec disarm = { { 0, 0 }, { 0, 0 } };
+
+    if (b->count == 0) {
+        return;
+    }
+    timerfd_settime(b->timer_fd, 0, &disarm, NULL);
+
+    b->header.batch_seq++;
+    b->header.sent_ns = now_ns(CLOCK_REALTIME);
+    msg.len = metrics_batch_encode(&b->header, b->records, b->count, msg.payload);
+    msg.attempts = 0;
+    msg.records = b->count;
+    msg.batch_seq = b->header.batch_seq;
+    memcpy(msg.trace, b->trace, b->count * sizeof(b->trace[0]));
+    b->count = 0;
+    if (msg.len < 0) {
+        return;
+    }
+    publisher_enqueue(pub, &msg);
+}
+
+// Thêm kết quả một quỹ đạo vào batch (hoặc gửi ngay dạng JSON), kèm mốc thời gian khi đang tracing
+void publish_metrics(struct publisher* pub, const struct trajectory* traj, double speed, double accuracy,
+                     const struct mouse_event_v2* last, uint64_t read_ns) {
+    struct batch_builder* b = &pub->batch;
+    struct trace_stamp stamp = { 0 };
+    uint64_t mono = now_ns(CLOCK_MONOTONIC), real = now_ns(CLOCK_REALTIME);
+
+    if (trace_file) {
+        // pid ở 32 bit cao để nhiều pub (mỗi chuột một pub) không trùng id
+        stamp.trace_id = ((uint64_t)getpid() << 32) | trace_seq++;
+        stamp.arrival_ns = last->timestamp_ns;
+        stamp.flush_ns = mouse_event_flush_ns(last);
+        stamp.read_ns = read_ns;
+        stamp.close_ns = mono;
+    }
 
-    // Tính tổng khoảng cách (chỉ giữa các MOVE)
-    double total_distance = 0.0;
-    for (int i = 0; i < count - 1; i++) {
-        if (events[i].type == 0 && events[i + 1].type == 0) {
-            double dx = (double)events[i + 1].x;
-            double dy = (double)events[i + 1].y;
-            total_distance += sqrt(dx * dx + dy * dy);
+    if (b->json) {
+        static struct outgoing msg;
+
+        if (!trace_file) {
+            snprintf((char*)msg.payload, sizeof(msg.payload), "{\"speed\": %.2f, \"accuracy\": %.2f}", speed, accuracy);
+        } else {
+            snprintf((char*)msg.payload, sizeof(msg.payload),
+                     "{\"speed\": %.2f, \"accuracy\": %.2f, \"trace_id\": %llu, \"sent_ns\": %llu}",
+                     speed, accuracy, (unsigned long long)stamp.trace_id, (unsigned long long)real);
         }
+        msg.len = strlen((char*)msg.payload);
+        msg.attempts = 0;
+        msg.records = 1;
+        msg.batch_seq = 0;
+        msg.trace[0] = stamp;
+        publisher_enqueue(pub, &msg);
+        return;
     }
 
-    *speed = total_distance / total_time;
+    struct metrics_record* r = &b->records[b->count];
+    r->seq = ++b->record_seq;
+    r->trace_id = stamp.trace_id;
+    // timestamp_ns là CLOCK_MONOTONIC của máy này, đổi sang giờ thật cho sub
+    r->end_ns = real - (mono - last->timestamp_ns);
+    r->duration_us = (uint32_t)(traj->trajectory_time * 1e6);
+    r->point_count = traj->event_count;
+    r->speed = speed;
+    r->accuracy = accuracy;
+    b->trace[b->count] = stamp;
 
-    // Tính accuracy dựa trên cosine của góc giữa các đoạn MOVE
-    int eqdir_count = 0;
-    int valid_segments = 0;
-    for (int i = 0; i < count - 2; i++) {
-        if (events[i].type == 0 && events[i + 1].type == 0 && events[i + 2].type == 0) {
-            double dx1 = (double)events[i + 1].x;
-            double dy1 = (double)events[i + 1].y;
-            double dx2 = (double)events[i + 2].x;
-            double dy2 = (double)events[i + 2].y;
+    if (b->count++ == 0) {
+        struct itimerspec age = {
+            .it_value = { b->max_age_ms / 1000, (b->max_age_ms % 1000) * 1000000L },
+        };
+        timerfd_settime(b->timer_fd, 0, &age, NULL);
+    }
+    if (b->count >= b->max_records) {
+        flush_batch(pub);
+    }
+}
 
-            // Tính độ dài vector
-            double len1 = sqrt(dx1 * dx1 + dy1 * dy1);
-            double len2 = sqrt(dx2 * dx2 + dy2 * dy2);
+// Thêm một sự kiện vào quỹ đạo, gửi kết quả khi quỹ đạo kết thúc
+void process_event(struct publisher* pub, struct trajectory* traj, const struct mouse_event_v2* event, uint64_t read_ns) {
+    int type = MOUSE_EVENT_TYPE(event->info);
 
-            // Chỉ tính nếu cả hai đoạn đủ dài
-            if (len1 >= MIN_VECTOR_LENGTH && len2 >= MIN_VECTOR_LENGTH) {
-                double dot_product = dx1 * dx2 + dy1 * dy2;
-                double cos_theta = dot_product / (len1 * len2);
+    // Quỹ đạo có chỗ bị mất sự kiện thì tốc độ và độ chính xác không còn đúng
+    if (type == MOUSE_EVENT_GAP) {
+        trajectory_reset(traj);
+        return;
+    }
 
-                if (cos_theta > 1.0) cos_theta = 1.0;
-                if (cos_theta < -1.0) cos_theta = -1.0;
+    trajectory_add(traj, event);
 
-                if (cos_theta >= COSINE_TOLERANCE) {
-                    eqdir_count++;
+    // Kết thúc quỹ đạo khi gặp CLICK/WHEEL hoặc thời gian vượt 10s
+    if (type == MOUSE_EVENT_CLICK || type == MOUSE_EVENT_WHEEL || traj->trajectory_time > 10.0) {
+        if (traj->trajectory_time >= 1.0 && traj->trajectory_time <= 10.0 && traj->event_count > 1) { // Chỉ xét quỹ đạo từ 1-10s
+            double speed, accuracy;
+            trajectory_result(traj, &speed, &accuracy);
+            publish_metrics(pub, traj, speed, accuracy, event, read_ns);
+        }
+        trajectory_reset(traj);
+    }
+}
+
+// Luồng đọc: chép n sự kiện vào event_queue, đầy thì bỏ phần còn lại
+static void event_queue_push(struct event_queue* q, const struct mouse_event_v2* events, unsigned int n,
+                             uint64_t read_ns) {
+    unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    unsigned int tail = q->tail;
+
+    for (unsigned int i = 0; i < n; i++) {
+        if (tail - head >= (unsigned int)(EVENT_QUEUE_SIZE - q->gap)) {
+            q->overflow += n - i;
+            q->gap = 1;
+            break;
+        }
+        if (q->gap) {
+            struct queued_event* gap = &q->slots[tail++ % EVENT_QUEUE_SIZE];
+            memset(gap, 0, sizeof(*gap));
+            gap->event.timestamp_ns = events[i].timestamp_ns;
+            gap->event.info = MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0);
+            q->gap = 0;
+        }
+        q->slots[tail % EVENT_QUEUE_SIZE].event = events[i];
+        q->slots[tail % EVENT_QUEUE_SIZE].read_ns = read_ns;
+        tail++;
+    }
+    __atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+}
+
+// Luồng đọc: lấy sự kiện ra khỏi ring theo ngưỡng đánh thức, tới khi stop_fd báo dừng
+static void* reader_main(void* arg) {
+    struct event_queue* q = arg;
+    struct mouse_event_v2 batch[READ_BATCH];
+    unsigned long long reported_lost = 0, reported_overflow = 0;
+    struct pollfd pfd[2] = {
+        { .fd = q->ring->fd, .events = POLLIN },
+        { .fd = q->stop_fd, .events = POLLIN },
+    };
+    uint64_t one = 1;
+
+    while (1) {
+        // Copy ra mảng cục bộ để driver có thể ghi đè slot ngay sau đó
+        unsigned int n = mouse_ring_read(q->ring, batch, READ_BATCH);
+        if (n > 0) {
+            event_queue_push(q, batch, n, trace_file ? now_ns(CLOCK_MONOTONIC) : 0);
+            if (write(q->wake_fd, &one, sizeof(one)) < 0) {
+                perror("eventfd");
+            }
+            continue;
+        }
+
+        if (mouse_ring_lost(q->ring) != reported_lost) {
+            printf("Mất %llu sự kiện do đọc chậm\n", mouse_ring_lost(q->ring) - reported_lost);
+            reported_lost = mouse_ring_lost(q->ring);
+        }
+        if (q->overflow != reported_overflow) {
+            printf("Mất %llu sự kiện do luồng chính xử lý chậm\n", q->overflow - reported_overflow);
+            reported_overflow = q->overflow;
+        }
+        if (poll(pfd, 2, -1) < 0) {
+            continue; // EINTR
+        }
+        if (pfd[1].revents & POLLIN) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Luồng đọc khi không có ring: read() các bản ghi mouse_event_v2 từ fd tới khi hết
+static void* stream_reader_main(void* arg) {
+    struct event_queue* q = arg;
+    union {
+        struct mouse_event_v2 events[READ_BATCH];
+        unsigned char bytes[READ_BATCH * sizeof(struct mouse_event_v2)];
+    } buf;
+    size_t have = 0;    // Byte đã đọc, có thể dừng giữa một bản ghi
+    struct pollfd pfd[2] = {
+        { .fd = q->fd, .events = POLLIN },
+        { .fd = q->stop_fd, .events = POLLIN },
+    };
+    uint64_t one = 1;
+
+    while (1) {
+        if (poll(pfd, 2, -1) < 0) {
+            continue; // EINTR
+        }
+        if (pfd[1].revents & POLLIN) {
+            return NULL;
+        }
+        ssize_t len = read(q->fd, buf.bytes + have, sizeof(buf) - have);
+        if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (len <= 0) {
+            if (len < 0) {
+                perror("read");
+            } else if (have > 0) {
+                printf("Bỏ %zu byte lẻ ở cuối dữ liệu\n", have);
+            }
+            break;
+        }
+        have += len;
+
+        unsigned int n = have / sizeof(struct mouse_event_v2), done = 0;
+        uint64_t read_ns = trace_file ? now_ns(CLOCK_MONOTONIC) : 0;
+        while (done < n) {
+            unsigned int used = q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+            unsigned int space = EVENT_QUEUE_SIZE - used;
+            if (space == 0) {
+                // Chờ luồng chính lấy bớt, vẫn dừng được khi được yêu cầu
+                if (poll(&pfd[1], 1, 1) > 0) {
+                    return NULL;
                 }
-                valid_segments++;
+                continue;
+            }
+            unsigned int chunk = n - done < space ? n - done : space;
+            event_queue_push(q, buf.events + done, chunk, read_ns);
+            if (write(q->wake_fd, &one, sizeof(one)) < 0) {
+                perror("eventfd");
             }
+            done += chunk;
         }
+        have -= n * sizeof(struct mouse_event_v2);
+        memmove(buf.bytes, buf.bytes + n * sizeof(struct mouse_event_v2), have);
     }
-    *accuracy = (valid_segments > 0) ? (double)eqdir_count / valid_segments : 1.0;
+
+    __atomic_store_n(&q->eof, 1, __ATOMIC_RELEASE);
+    if (write(q->wake_fd, &one, sizeof(one)) < 0) {
+        perror("eventfd");
+    }
+    return NULL;
 }
 
-int main(int argc, char* argv[]) {
-    MQTTClient client;
-    MQTTClient_create(&client, ADDRESS, CLIENTID, MQTTCLIENT_PERSISTENCE_NONE, NULL);
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+// Luồng chính: xử lý toàn bộ sự kiện luồng đọc đã chuyển sang
+void drain_events(struct publisher* pub, struct event_queue* q, struct trajectory* traj) {
+    unsigned int head = q->head;
+    unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
 
-    int rc;
-    if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
-        printf("Failed to connect, return code %d\n", rc);
-        exit(-1);
+    while (head != tail) {
+        const struct queued_event* e = &q->slots[head % EVENT_QUEUE_SIZE];
+        process_event(pub, traj, &e->event, e->read_ns);
+        // Trả slot ngay để luồng đọc không thấy đầy trong lúc đang gửi
+        __atomic_store_n(&q->head, ++head, __ATOMIC_RELEASE);
+        if (head == tail) {
+            tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        }
     }
+}
 
-    // Mở file thiết bị chuột
-    int fd = open(DEVICE_PATH, O_RDONLY);
-    if (fd < 0) {
-        printf("Failed to open device %s\n", DEVICE_PATH);
-        MQTTClient_disconnect(client, 1000);
-        MQTTClient_destroy(&client);
-        exit(-1);
+static void on_disconnected(void* context, MQTTAsync_successData* response) {
+    publisher_wake(context);
+}
+
+static void on_disconnect_failure(void* context, MQTTAsync_failureData* response) {
+    publisher_wake(context);
+}
+
+// Chờ eventfd tối đa timeout_ms; trả về 1 nếu có callback báo
+static int publisher_wait(struct publisher* pub, int timeout_ms) {
+    struct pollfd pfd = { .fd = pub->wake_fd, .events = POLLIN };
+    uint64_t value;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
     }
+    return read(pub->wake_fd, &value, sizeof(value)) == sizeof(value);
+}
 
-    struct mouse_event events[MAX_EVENTS];
-    int event_count = 0;
-    double trajectory_time = 0.0;
+/*
+ * Cất các message chưa được broker xác nhận vào đầu spool (sau khi đã hủy client
+ * nên không còn callback). Chúng cũ hơn mọi thứ đang có trong spool nên được ghi
+ * vào segment đứng trước, lần chạy sau gửi lại đầu tiên.
+ */
+static void publisher_save(struct publisher* pub) {
+    static struct spool_entry entries[PUB_MAX_WINDOW + PUB_QUEUE_SIZE];
+    int n = 0;
 
-    printf("Bắt đầu theo dõi sự kiện chuột và gửi lên MQTT...\n");
+    for (int i = 0; i < PUB_MAX_WINDOW; i++) {
+        const struct outgoing* msg = &pub->inflight[i].msg;
+        if (pub->inflight[i].in_use) {
+            entries[n++] = (struct spool_entry){ msg->payload, msg->len, msg->records, msg->batch_seq };
+        }
+    }
+    for (unsigned int i = 0; i < pub->count; i++) {
+        const struct outgoing* msg = &pub->queue[(pub->head + i) % PUB_QUEUE_SIZE];
+        entries[n++] = (struct spool_entry){ msg->payload, msg->len, msg->records, msg->batch_seq };
+    }
+    if (n > 0) {
+        printf("Cất %d message chưa gửi vào spool\n", spool_push_front(pub->spool, entries, n));
+    }
+}
+
+// Khi thoát: gửi nốt hàng đợi trong SHUTDOWN_FLUSH_MS rồi ngắt kết nối
+static void publisher_shutdown(struct publisher* pub) {
+    uint64_t deadline = now_ns(CLOCK_MONOTONIC) + SHUTDOWN_FLUSH_MS * 1000000ULL;
+    int pending;
 
     while (1) {
-        struct mouse_event event;
-        ssize_t bytes_read = read(fd, &event, sizeof(struct mouse_event));
-        if (bytes_read != sizeof(struct mouse_event)) {
-            usleep(10000); // Đợi 10ms nếu không có dữ liệu
-            continue;
+        publisher_pump(pub);
+        pthread_mutex_lock(&pub->lock);
+        pending = pub->count + pub->inflight_count;
+        pthread_mutex_unlock(&pub->lock);
+
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        if (pending == 0 || now >= deadline) {
+            break;
+        }
+        publisher_wait(pub, (int)((deadline - now) / 1000000ULL) + 1);
+    }
+    printf("Đã gửi %llu kết quả, gửi lại %llu lần, bỏ %llu, còn %d chưa gửi\n",
+           pub->delivered, pub->retried, pub->dropped, pending);
+
+    if (MQTTAsync_isConnected(pub->client)) {
+        MQTTAsync_disconnectOptions disc_opts = MQTTAsync_disconnectOptions_initializer;
+        disc_opts.timeout = 1000;
+        disc_opts.onSuccess = on_disconnected;
+        disc_opts.onFailure = on_disconnect_failure;
+        disc_opts.context = pub;
+        if (MQTTAsync_disconnect(pub->client, &disc_opts) == MQTTASYNC_SUCCESS) {
+            publisher_wait(pub, 2000);
+        }
+    }
+    MQTTAsync_destroy(&pub->client);
+    if (pub->spool) {
+        publisher_save(pub);
+        printf("Spool: ghi %llu, đọc lại %llu, bỏ %llu, còn %llu message\n", pub->spool->spilled,
+               pub->spool->replayed, pub->spool->dropped, pub->spool->pending);
+        spool_close(pub->spool);
+    }
+    close(pub->batch.timer_fd);
+    close(pub->wake_fd);
+    pthread_mutex_destroy(&pub->lock);
+}
+
+int main(int argc, char* argv[]) {
+    // Trạng thái publisher lớn (hàng đợi), để ngoài stack
+    static struct publisher pub;
+    static struct event_queue events;
+    static struct spool spool;
+    const char* spool_dir = NULL;
+    int spool_mb = SPOOL_MAX_MB;
+    int window = PUB_WINDOW;
+    int opt;
+
+    pub.batch.max_records = BATCH_RECORDS;
+    pub.batch.max_age_ms = BATCH_MAX_AGE_MS;
+    while ((opt = getopt(argc, argv, "t:w:b:B:jzs:S:")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_file = fopen(optarg, "a");
+            if (!trace_file) {
+                perror(optarg);
+                exit(-1);
+            }
+            setvbuf(trace_file, NULL, _IOLBF, 0);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            if (window < 1 || window > PUB_MAX_WINDOW) {
+                fprintf(stderr, "Window must be 1..%d\n", PUB_MAX_WINDOW);
+                exit(-1);
+            }
+            break;
+        case 'b':
+            pub.batch.max_records = atoi(optarg);
+            if (pub.batch.max_records < 1 || pub.batch.max_records > METRICS_BATCH_MAX_RECORDS) {
+                fprintf(stderr, "Batch size must be 1..%d\n", METRICS_BATCH_MAX_RECORDS);
+                exit(-1);
+            }
+            break;
+        case 'B':
+            pub.batch.max_age_ms = atoi(optarg);
+            if (pub.batch.max_age_ms < 1) {
+                fprintf(stderr, "Batch age must be at least 1 ms\n");
+                exit(-1);
+            }
+            break;
+        case 'j':
+            pub.batch.json = 1;
+            break;
+        case 'z':
+            pub.batch.header.flags |= METRICS_BATCH_ZLIB;
+            break;
+        case 's':
+            spool_dir = optarg;
+            break;
+        case 'S':
+            spool_mb = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t trace_file] [-w window] [-b batch_records] [-B batch_ms] [-j] [-z] "
+                    "[-s spool_dir] [-S spool_mb] [device]\n", argv[0]);
+            exit(-1);
         }
+    }
+    const char* device_path = optind < argc ? argv[optind] : DEVICE_PATH;
 
-        if (event_count >= MAX_EVENTS) {
-            printf("Trajectory quá dài, bỏ qua...\n");
-            event_count = 0;
-            trajectory_time = 0.0;
+    // Broker ngắt client trùng ID, nên mỗi chuột trên cùng máy cần một ID riêng
+    char client_id[64];
+    const char* device_name = strrchr(device_path, '/');
+    snprintf(client_id, sizeof(client_id), "%s_%s", CLIENTID, device_name ? device_name + 1 : device_path);
+
+    // Batch mang định danh máy và số N của /dev/logitech_mouseN để sub tách luồng
+    const char* device_digits = device_path + strlen(device_path);
+    while (device_digits > device_path && device_digits[-1] >= '0' && device_digits[-1] <= '9') {
+        device_digits--;
+    }
+    pub.batch.header.host_id = metrics_host_id();
+    pub.batch.header.device_id = strtoul(device_digits, NULL, 10);
+    pub.batch.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    // SIGINT/SIGTERM được nhận qua signalfd để thoát sạch trong vòng epoll. Chặn
+    // trước khi Paho và luồng đọc tạo luồng để mọi luồng kế thừa mask
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    // Message còn trong spool từ lần chạy trước được gửi trước message mới
+    if (spool_dir) {
+        if (spool_open(&spool, spool_dir, (size_t)spool_mb << 20) < 0) {
+            perror(spool_dir);
+            exit(-1);
+        }
+        pub.spool = &spool;
+        pub.spooling = !spool_empty(&spool);
+        if (pub.spooling) {
+            printf("Spool %s còn %llu message chưa gửi\n", spool_dir, spool.pending);
         }
+    }
+
+    pthread_mutex_init(&pub.lock, NULL);
+    pub.window = window;
+    for (int i = 0; i < PUB_MAX_WINDOW; i++) {
+        pub.inflight[i].pub = &pub;
+    }
+    pub.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    MQTTAsync_create(&pub.client, ADDRESS, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    MQTTAsync_setCallbacks(pub.client, &pub, on_connection_lost, on_message_arrived, NULL);
+    pub.conn_opts = (MQTTAsync_connectOptions)MQTTAsync_connectOptions_initializer;
+    pub.conn_opts.maxInflight = window;
+    pub.conn_opts.onSuccess = on_connect_success;
+    pub.conn_opts.onFailure = on_connect_failure;
+    pub.conn_opts.context = &pub;
 
-        events[event_count++] = event;
+    // Kết nối chạy nền; kết quả chờ gửi được giữ trong hàng đợi tới khi kết nối xong
+    int rc;
+    if ((rc = service_broker(&pub)) != MQTTASYNC_SUCCESS) {
+        printf("Failed to connect, return code %d\n", rc);
+        exit(-1);
+    }
 
-        // Tính thời gian quỹ đạo
-        if (event_count > 1) {
-            trajectory_time = (double)(event.timestamp_sec - events[0].timestamp_sec) +
-                              (double)(event.timestamp_nsec - events[0].timestamp_nsec) / 1e9;
+    // Map ring sự kiện của driver, đọc trực tiếp không qua read(). Không được thì
+    // đọc bằng read(): thiết bị thì chọn MOUSE_ABI_V2, FIFO/file đã là bản ghi v2
+    struct mouse_ring ring;
+    events.fd = -1;
+    if (mouse_ring_open(&ring, device_path) == 0) {
+        events.ring = &ring;
+        // Quỹ đạo chỉ xong ở CLICK/WHEEL nên không cần thức dậy theo từng MOVE
+        if (mouse_ring_set_wakeup(&ring, READ_BATCH, WAKE_TIMEOUT_US, MOUSE_WAKEUP_CLICK | MOUSE_WAKEUP_WHEEL) < 0) {
+            printf("Driver không hỗ trợ ngưỡng đánh thức, thức dậy theo từng sự kiện\n");
         }
+    } else {
+        struct stat st;
+        __u32 abi = MOUSE_ABI_V2;
+        events.fd = open(device_path, O_RDONLY | O_CLOEXEC);
+        if (events.fd < 0 || fstat(events.fd, &st) < 0 ||
+            (S_ISCHR(st.st_mode) && ioctl(events.fd, MOUSE_IOC_SET_ABI, &abi) < 0)) {
+            printf("Failed to open device %s\n", device_path);
+            publisher_shutdown(&pub);
+            exit(-1);
+        }
+        printf("Không map được ring của %s, đọc bằng read()\n", device_path);
+    }
+
+    events.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    events.stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pthread_create(&events.thread, NULL, events.ring ? reader_main : stream_reader_main, &events) != 0) {
+        perror("pthread_create");
+        if (events.ring) {
+            mouse_ring_close(&ring);
+        } else {
+            close(events.fd);
+        }
+        publisher_shutdown(&pub);
+        exit(-1);
+    }
+
+    // Timer định kỳ để kết nối lại khi mất kết nối (keepalive do luồng của Paho lo)
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec tick = {
+        .it_interval = { MQTT_TICK_MS / 1000, (MQTT_TICK_MS % 1000) * 1000000L },
+        .it_value = { MQTT_TICK_MS / 1000, (MQTT_TICK_MS % 1000) * 1000000L },
+    };
+    timerfd_settime(timer_fd, 0, &tick, NULL);
 
-        // Kết thúc quỹ đạo khi gặp CLICK/WHEEL hoặc thời gian vượt 10s
-        if (event.type == 1 || event.type == 2 || trajectory_time > 10.0) {
-            if (trajectory_time >= 1.0 && trajectory_time <= 10.0 && event_count > 1) { // Chỉ xét quỹ đạo từ 1-10s
-                double speed, accuracy;
-                calculate_speed_and_accuracy(events, event_count, &speed, &accuracy);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = events.wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, events.wake_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    ev.data.fd = sig_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sig_fd, &ev);
+    ev.data.fd = pub.wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pub.wake_fd, &ev);
+    ev.data.fd = pub.batch.timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pub.batch.timer_fd, &ev);
 
-                // Tạo payload JSON
-                char payload[256];
-                snprintf(payload, sizeof(payload), "{\"speed\": %.2f, \"accuracy\": %.2f}", speed, accuracy);
-                publish(client, PUB_TOPIC, payload);
+    struct trajectory traj;
+    trajectory_reset(&traj);
+    int running = 1;
+
+    printf("Bắt đầu theo dõi sự kiện chuột và gửi lên MQTT...\n");
+
+    while (running) {
+        struct epoll_event ready[4];
+        int n = epoll_wait(epoll_fd, ready, 4, -1);
+        if (n < 0) {
+            continue; // EINTR
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = ready[i].data.fd;
+            if (fd == events.wake_fd) {
+                uint64_t value;
+                if (read(events.wake_fd, &value, sizeof(value)) == sizeof(value)) {
+                    // eof đặt sau sự kiện cuối nên đọc eof trước khi xử lý là đủ
+                    int eof = __atomic_load_n(&events.eof, __ATOMIC_ACQUIRE);
+                    drain_events(&pub, &events, &traj);
+                    if (eof) {
+                        printf("Hết dữ liệu từ %s, dừng...\n", device_path);
+                        running = 0;
+                    }
+                }
+            } else if (fd == pub.wake_fd) {
+                uint64_t value;
+                if (read(pub.wake_fd, &value, sizeof(value)) == sizeof(value)) {
+                    publisher_pump(&pub);
+                }
+            } else if (fd == pub.batch.timer_fd) {
+                uint64_t expirations;
+                if (read(pub.batch.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    flush_batch(&pub);
+                }
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    service_broker(&pub);
+                }
+            } else if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                if (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                    printf("Nhận tín hiệu %u, dừng...\n", si.ssi_signo);
+                }
+                running = 0;
             }
-            event_count = 0; // Reset buffer
-            trajectory_time = 0.0;
         }
     }
 
-    close(fd);
-    MQTTClient_disconnect(client, 1000);
-    MQTTClient_destroy(&client);
+    // Dừng luồng đọc rồi xử lý nốt các sự kiện nó đã chuyển sang
+    uint64_t one = 1;
+    if (write(events.stop_fd, &one, sizeof(one)) < 0) {
+        perror("eventfd");
+    }
+    pthread_join(events.thread, NULL);
+    drain_events(&pub, &events, &traj);
+
+    close(epoll_fd);
+    close(timer_fd);
+    close(sig_fd);
+    close(events.wake_fd);
+    close(events.stop_fd);
+    if (events.ring) {
+        mouse_ring_close(&ring);
+    } else {
+        close(events.fd);
+    }
+    flush_batch(&pub);
+    publisher_shutdown(&pub);
+    if (trace_file) {
+        fclose(trace_file);
+    }
     return 0;
-}
\ No newline at end of file
+}
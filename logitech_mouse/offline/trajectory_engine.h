@@ -0,0 +1,760 @@
+#ifndef TRAJECTORY_ENGINE_H
+#define TRAJECTORY_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TE_X86 1
+#endif
+
+#include "../logitech_mouse.h"
+#include "capture.h"
+
+/*
+ * Engine tính lại speed/accuracy offline cho các sự kiện đã ghi (header-only).
+ *
+ * Quỹ đạo được cắt theo đúng quy tắc của pub.c (GAP bỏ quỹ đạo, CLICK/WHEEL hoặc
+ * quá 10s thì đóng, chỉ giữ quỹ đạo 1-10s) rồi lưu dạng struct-of-arrays:
+ *   - các MOVE được cộng vào quãng đường (MOVE thứ hai trở đi của mỗi chuỗi MOVE)
+ *   - các cặp MOVE liền nhau được xét hướng (từ MOVE thứ ba của chuỗi)
+ * Mỗi luồng lấy một dải quỹ đạo; với mỗi quỹ đạo, kernel SIMD tính độ dài, cosin
+ * của từng cặp một lần vào bộ đệm nằm trong L1, rồi đếm cho mọi bộ tham số.
+ *
+ * Hai cách tính accuracy đang có trong repo thực ra là cùng một góc:
+ *   cosine (pub.c)            chỉ xét cặp có cả hai đoạn >= min_vector_length,
+ *                             cùng hướng khi cos >= cosine_tolerance
+ *   atan2 (mouse_listener.c)  xét mọi cặp, cùng hướng khi |góc1 - góc2| < angle_tolerance,
+ *                             tức cos(góc giữa hai vector) > cos(angle_tolerance)
+ * nên kernel chỉ cần so sánh trong miền cosin. Vector 0 (atan2 coi là góc 0)
+ * được tính riêng bằng atan2 như mouse_listener.c.
+ *
+ * Build: gcc -O3 -ffp-contract=off -pthread ... -lm -lz
+ * (-ffp-contract=off để tích vô hướng làm tròn giống hệt bản scalar trong pub.c).
+ */
+
+#define TE_MIN_DURATION_NS 1000000000ULL
+#define TE_MAX_DURATION_NS 10000000000ULL
+#define TE_MAX_PARAMS 32
+
+struct te_params {
+    double cosine_tolerance;    // COSINE_TOLERANCE của pub.c
+    double min_vector_length;   // MIN_VECTOR_LENGTH của pub.c
+    double angle_tolerance;     // ANGLE_TOLERANCE (radian) của mouse_listener.c
+};
+
+enum te_kernel {
+    TE_KERNEL_AUTO,
+    TE_KERNEL_SCALAR,
+    TE_KERNEL_SSE2,
+    TE_KERNEL_AVX2,
+};
+
+static const char *const te_kernel_names[] = {
+    [TE_KERNEL_AUTO] = "auto",
+    [TE_KERNEL_SCALAR] = "scalar",
+    [TE_KERNEL_SSE2] = "sse2",
+    [TE_KERNEL_AVX2] = "avx2",
+};
+
+struct te_dataset {
+    // Mỗi quỹ đạo hợp lệ
+    size_t traj_count, traj_cap;
+    uint64_t *start_ns;
+    double *duration;           // Giây, như trajectory_time của pub.c
+    uint32_t *points;           // Số sự kiện, kể cả CLICK/WHEEL cuối
+    uint8_t *end_type;          // MOUSE_EVENT_CLICK/WHEEL, hoặc MOVE nếu đóng vì quá 10s
+    size_t *move_off;           // [traj_count + 1], dải trong move_dx/move_dy
+    size_t *pair_off;           // [traj_count + 1], dải trong các mảng pair_*
+
+    // MOVE được cộng vào quãng đường
+    size_t move_count, move_cap;
+    int16_t *move_dx, *move_dy;
+
+    // Cặp MOVE liền nhau: (dx1, dy1) trước, (dx2, dy2) sau
+    size_t pair_count, pair_cap;
+    int16_t *pair_dx1, *pair_dy1, *pair_dx2, *pair_dy2;
+    size_t max_pairs;           // Số cặp lớn nhất của một quỹ đạo, để cấp bộ đệm
+
+    // Trạng thái cắt quỹ đạo, giữ giữa các lần te_add_events()
+    uint64_t cur_start_ns;
+    uint32_t cur_points;
+    int cur_run;                // Số MOVE liên tiếp tính tới sự kiện cuối (tối đa 3)
+    int16_t prev_dx, prev_dy;
+};
+
+// Kết quả: speed theo quỹ đạo, accuracy theo [quỹ đạo * nparams + tham số]
+struct te_output {
+    int nparams;
+    double *speed;
+    double *acc_cosine;
+    double *acc_atan2;
+};
+
+static inline void te_dataset_init(struct te_dataset *ds) {
+    memset(ds, 0, sizeof(*ds));
+    ds->move_off = calloc(1, sizeof(size_t));
+    ds->pair_off = calloc(1, sizeof(size_t));
+}
+
+static inline void te_dataset_free(struct te_dataset *ds) {
+    free(ds->start_ns);
+    free(ds->duration);
+    free(ds->points);
+    free(ds->end_type);
+    free(ds->move_off);
+    free(ds->pair_off);
+    free(ds->move_dx);
+    free(ds->move_dy);
+    free(ds->pair_dx1);
+    free(ds->pair_dy1);
+    free(ds->pair_dx2);
+    free(ds->pair_dy2);
+    memset(ds, 0, sizeof(*ds));
+}
+
+// realloc mảng khi đầy; trả về -1 nếu hết bộ nhớ
+static inline int te_grow(void **array, size_t elem_size, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 1024;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    void *p = realloc(*array, new_cap * elem_size);
+    if (!p) {
+        return -1;
+    }
+    *array = p;
+    *cap = new_cap;
+    return 0;
+}
+
+static inline int te_grow_moves(struct te_dataset *ds, size_t need) {
+    size_t cap = ds->move_cap;
+    if (te_grow((void **)&ds->move_dx, sizeof(int16_t), &cap, need) < 0) {
+        return -1;
+    }
+    cap = ds->move_cap;
+    if (te_grow((void **)&ds->move_dy, sizeof(int16_t), &cap, need) < 0) {
+        return -1;
+    }
+    ds->move_cap = cap;
+    return 0;
+}
+
+static inline int te_grow_pairs(struct te_dataset *ds, size_t need) {
+    int16_t **arrays[] = { &ds->pair_dx1, &ds->pair_dy1, &ds->pair_dx2, &ds->pair_dy2 };
+    size_t cap = ds->pair_cap;
+
+    for (int i = 0; i < 4; i++) {
+        cap = ds->pair_cap;
+        if (te_grow((void **)arrays[i], sizeof(int16_t), &cap, need) < 0) {
+            return -1;
+        }
+    }
+    ds->pair_cap = cap;
+    return 0;
+}
+
+static inline int te_grow_trajectories(struct te_dataset *ds, size_t need) {
+    size_t cap = ds->traj_cap ? ds->traj_cap : 1024;
+    void *p;
+
+    if (need <= ds->traj_cap) {
+        return 0;
+    }
+    while (cap < need) {
+        cap *= 2;
+    }
+    // move_off/pair_off có thêm một phần tử cho điểm kết thúc
+#define TE_GROW_TRAJ(field, extra)                                   \
+    p = realloc(ds->field, (cap + (extra)) * sizeof(ds->field[0]));  \
+    if (!p) {                                                        \
+        return -1;                                                   \
+    }                                                                \
+    ds->field = p;
+    TE_GROW_TRAJ(start_ns, 0)
+    TE_GROW_TRAJ(duration, 0)
+    TE_GROW_TRAJ(points, 0)
+    TE_GROW_TRAJ(end_type, 0)
+    TE_GROW_TRAJ(move_off, 1)
+    TE_GROW_TRAJ(pair_off, 1)
+#undef TE_GROW_TRAJ
+    ds->traj_cap = cap;
+    return 0;
+}
+
+// Bỏ quỹ đạo đang cắt dở: trả các MOVE/cặp đã thêm về quỹ đạo hợp lệ cuối cùng
+static inline void te_discard_current(struct te_dataset *ds) {
+    ds->move_count = ds->move_off[ds->traj_count];
+    ds->pair_count = ds->pair_off[ds->traj_count];
+    ds->cur_points = 0;
+    ds->cur_run = 0;
+}
+
+static inline int te_commit_current(struct te_dataset *ds, uint64_t end_ns, int end_type) {
+    size_t t = ds->traj_count;
+
+    if (te_grow_trajectories(ds, t + 1) < 0) {
+        return -1;
+    }
+    ds->start_ns[t] = ds->cur_start_ns;
+    ds->duration[t] = (double)(end_ns - ds->cur_start_ns) / 1e9;
+    ds->points[t] = ds->cur_points;
+    ds->end_type[t] = end_type;
+    ds->move_off[t + 1] = ds->move_count;
+    ds->pair_off[t + 1] = ds->pair_count;
+    if (ds->pair_count - ds->pair_off[t] > ds->max_pairs) {
+        ds->max_pairs = ds->pair_count - ds->pair_off[t];
+    }
+    ds->traj_count = t + 1;
+    return 0;
+}
+
+/*
+ * Thêm sự kiện (theo thứ tự thời gian) vào dataset. Có thể gọi nhiều lần liên
+ * tiếp cho các đoạn của cùng một bản ghi. Trả về -1 nếu hết bộ nhớ.
+ */
+static inline int te_add_events(struct te_dataset *ds, const struct mouse_event_v2 *events, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const struct mouse_event_v2 *event = &events[i];
+        int type = MOUSE_EVENT_TYPE(event->info);
+
+        if (type == MOUSE_EVENT_GAP) {
+            te_discard_current(ds);
+            continue;
+        }
+        if (ds->cur_points++ == 0) {
+            ds->cur_start_ns = event->timestamp_ns;
+        }
+
+        if (type == MOUSE_EVENT_MOVE) {
+            if (ds->cur_run < 3) {
+                ds->cur_run++;
+            }
+            if (ds->cur_run >= 2) {
+                if (te_grow_moves(ds, ds->move_count + 1) < 0) {
+                    return -1;
+                }
+                ds->move_dx[ds->move_count] = event->dx;
+                ds->move_dy[ds->move_count] = event->dy;
+                ds->move_count++;
+            }
+            if (ds->cur_run == 3) {
+                if (te_grow_pairs(ds, ds->pair_count + 1) < 0) {
+                    return -1;
+                }
+                ds->pair_dx1[ds->pair_count] = ds->prev_dx;
+                ds->pair_dy1[ds->pair_count] = ds->prev_dy;
+                ds->pair_dx2[ds->pair_count] = event->dx;
+                ds->pair_dy2[ds->pair_count] = event->dy;
+                ds->pair_count++;
+            }
+            ds->prev_dx = event->dx;
+            ds->prev_dy = event->dy;
+        } else {
+            ds->cur_run = 0;
+        }
+
+        uint64_t elapsed = event->timestamp_ns - ds->cur_start_ns;
+        double seconds = (double)elapsed / 1e9;
+        if (type == MOUSE_EVENT_CLICK || type == MOUSE_EVENT_WHEEL || seconds > 10.0) {
+            if (seconds >= 1.0 && seconds <= 10.0 && ds->cur_points > 1) {
+                if (te_commit_current(ds, event->timestamp_ns, type) < 0) {
+                    return -1;
+                }
+            }
+            te_discard_current(ds);
+        }
+    }
+    return 0;
+}
+
+// Đọc file capture (capture.h); block hỏng được thay bằng một GAP để không nối quỹ đạo qua chỗ mất
+static inline int te_load_capture(struct te_dataset *ds, const char *path) {
+    struct capture_reader r;
+    struct mouse_event_v2 *block;
+    int ret = 0;
+
+    if (capture_open(&r, path) < 0) {
+        return -1;
+    }
+    block = malloc(r.header.block_events * sizeof(block[0]));
+    if (!block) {
+        capture_close(&r);
+        return -1;
+    }
+    for (uint32_t i = 0; ret == 0 && i < r.block_count; i++) {
+        int n = capture_read_block(&r, i, block);
+        if (n < 0) {
+            block[0] = (struct mouse_event_v2){ .timestamp_ns = r.blocks[i].first_ns,
+                                                .info = MOUSE_EVENT_INFO(MOUSE_EVENT_GAP, 0, 0) };
+            n = 1;
+        }
+        ret = te_add_events(ds, block, n);
+    }
+    if (r.bad_blocks) {
+        fprintf(stderr, "%s: bỏ %llu block hỏng\n", path, r.bad_blocks);
+    }
+    free(block);
+    capture_close(&r);
+    return ret;
+}
+
+// Đọc file capture hoặc file gồm các bản ghi struct mouse_event_v2 liên tiếp
+static inline int te_load_file(struct te_dataset *ds, const char *path) {
+    struct mouse_event_v2 chunk[4096];
+    FILE *f;
+    size_t n;
+    int ret = 0;
+
+    if (capture_is_capture(path)) {
+        return te_load_capture(ds, path);
+    }
+    f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    while (ret == 0 && (n = fread(chunk, sizeof(chunk[0]), sizeof(chunk) / sizeof(chunk[0]), f)) > 0) {
+        ret = te_add_events(ds, chunk, n);
+    }
+    if (ferror(f)) {
+        ret = -1;
+    }
+    fclose(f);
+    return ret;
+}
+
+// Ngưỡng đã đổi sang miền cosin cho kernel
+struct te_thresholds {
+    double min_length[TE_MAX_PARAMS];
+    double cosine[TE_MAX_PARAMS];
+    double angle_cos[TE_MAX_PARAMS];    // cos(angle_tolerance)
+};
+
+// Bộ đệm của một quỹ đạo, mỗi cặp một phần tử
+struct te_scratch {
+    double *len_min;        // min(|v1|, |v2|)
+    double *cosine;         // dot / (|v1| * |v2|), NaN nếu có vector 0 (giống pub.c)
+    double *angle_cos;      // cos của góc theo atan2, giống mouse_listener.c
+};
+
+// Góc giữa hai vector đúng như mouse_listener.c (atan2(0, 0) = 0), trả về cos của góc đó
+static inline double te_atan2_angle_cos(double dx1, double dy1, double dx2, double dy2) {
+    double angle_diff = fabs(atan2(dy1, dx1) - atan2(dy2, dx2));
+    if (angle_diff > M_PI) angle_diff = 2 * M_PI - angle_diff;
+    return cos(angle_diff);
+}
+
+static inline void te_pair_scalar(double dx1, double dy1, double dx2, double dy2,
+                                  double *len_min, double *cosine, double *angle_cos) {
+    double len1 = sqrt(dx1 * dx1 + dy1 * dy1);
+    double len2 = sqrt(dx2 * dx2 + dy2 * dy2);
+    double c = (dx1 * dx2 + dy1 * dy2) / (len1 * len2);
+
+    *len_min = len1 < len2 ? len1 : len2;
+    *cosine = c;
+    if (len1 == 0.0 || len2 == 0.0) {
+        *angle_cos = te_atan2_angle_cos(dx1, dy1, dx2, dy2);
+    } else {
+        *angle_cos = c > 1.0 ? 1.0 : (c < -1.0 ? -1.0 : c);
+    }
+}
+
+// ---- Kernel scalar ----
+
+static double te_prepare_scalar(const struct te_dataset *ds, size_t t, struct te_scratch *s) {
+    size_t p0 = ds->pair_off[t], n = ds->pair_off[t + 1] - p0;
+    double distance = 0.0;
+
+    for (size_t i = ds->move_off[t]; i < ds->move_off[t + 1]; i++) {
+        double dx = ds->move_dx[i], dy = ds->move_dy[i];
+        distance += sqrt(dx * dx + dy * dy);
+    }
+    for (size_t i = 0; i < n; i++) {
+        te_pair_scalar(ds->pair_dx1[p0 + i], ds->pair_dy1[p0 + i], ds->pair_dx2[p0 + i], ds->pair_dy2[p0 + i],
+                       &s->len_min[i], &s->cosine[i], &s->angle_cos[i]);
+    }
+    return distance;
+}
+
+static void te_count_scalar(const struct te_scratch *s, size_t n, const struct te_thresholds *th, int np,
+                            uint64_t *valid, uint64_t *eq_cosine, uint64_t *eq_atan2) {
+    for (int p = 0; p < np; p++) {
+        uint64_t v = 0, ec = 0, ea = 0;
+        for (size_t i = 0; i < n; i++) {
+            int ok = s->len_min[i] >= th->min_length[p];
+            v += ok;
+            ec += ok && s->cosine[i] >= th->cosine[p];
+            ea += s->angle_cos[i] > th->angle_cos[p];
+        }
+        valid[p] = v;
+        eq_cosine[p] = ec;
+        eq_atan2[p] = ea;
+    }
+}
+
+#ifdef TE_X86
+// ---- Kernel SSE2 (2 cặp mỗi lần) ----
+
+static inline __m128d te_load2_i16(const int16_t *p) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    __m128i x = _mm_cvtsi32_si128(v);
+    // Mở rộng dấu int16 -> int32 bằng unpack rồi dịch phải số học
+    return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+
+__attribute__((target("sse2")))
+static double te_prepare_sse2(const struct te_dataset *ds, size_t t, struct te_scratch *s) {
+    size_t m0 = ds->move_off[t], m1 = ds->move_off[t + 1];
+    size_t p0 = ds->pair_off[t], n = ds->pair_off[t + 1] - p0;
+    __m128d sum = _mm_setzero_pd();
+    double lanes[2], distance;
+    size_t i;
+
+    for (i = m0; i + 2 <= m1; i += 2) {
+        __m128d dx = te_load2_i16(&ds->move_dx[i]), dy = te_load2_i16(&ds->move_dy[i]);
+        sum = _mm_add_pd(sum, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))));
+    }
+    _mm_storeu_pd(lanes, sum);
+    distance = lanes[0] + lanes[1];
+    for (; i < m1; i++) {
+        double dx = ds->move_dx[i], dy = ds->move_dy[i];
+        distance += sqrt(dx * dx + dy * dy);
+    }
+
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0), minus_one = _mm_set1_pd(-1.0);
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128d x1 = te_load2_i16(&ds->pair_dx1[p0 + i]), y1 = te_load2_i16(&ds->pair_dy1[p0 + i]);
+        __m128d x2 = te_load2_i16(&ds->pair_dx2[p0 + i]), y2 = te_load2_i16(&ds->pair_dy2[p0 + i]);
+        __m128d l1 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x1, x1), _mm_mul_pd(y1, y1)));
+        __m128d l2 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x2, x2), _mm_mul_pd(y2, y2)));
+        __m128d dot = _mm_add_pd(_mm_mul_pd(x1, x2), _mm_mul_pd(y1, y2));
+        __m128d c = _mm_div_pd(dot, _mm_mul_pd(l1, l2));
+        __m128d lm = _mm_min_pd(l1, l2);
+
+        _mm_storeu_pd(&s->len_min[i], lm);
+        _mm_storeu_pd(&s->cosine[i], c);
+        _mm_storeu_pd(&s->angle_cos[i], _mm_min_pd(_mm_max_pd(c, minus_one), one));
+        // Có vector 0: tính lại góc bằng atan2 cho các làn đó
+        int zero_mask = _mm_movemask_pd(_mm_cmpeq_pd(lm, zero));
+        for (int lane = 0; zero_mask; lane++, zero_mask >>= 1) {
+            if (zero_mask & 1) {
+                size_t k = p0 + i + lane;
+                s->angle_cos[i + lane] = te_atan2_angle_cos(ds->pair_dx1[k], ds->pair_dy1[k],
+                                                            ds->pair_dx2[k], ds->pair_dy2[k]);
+            }
+        }
+    }
+    for (; i < n; i++) {
+        te_pair_scalar(ds->pair_dx1[p0 + i], ds->pair_dy1[p0 + i], ds->pair_dx2[p0 + i], ds->pair_dy2[p0 + i],
+                       &s->len_min[i], &s->cosine[i], &s->angle_cos[i]);
+    }
+    return distance;
+}
+
+static inline uint64_t te_hsum_epi64_sse2(__m128i v) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2")))
+static void te_count_sse2(const struct te_scratch *s, size_t n, const struct te_thresholds *th, int np,
+                          uint64_t *valid, uint64_t *eq_cosine, uint64_t *eq_atan2) {
+    for (int p = 0; p < np; p++) {
+        const __m128d min_length = _mm_set1_pd(th->min_length[p]);
+        const __m128d cosine = _mm_set1_pd(th->cosine[p]);
+        const __m128d angle_cos = _mm_set1_pd(th->angle_cos[p]);
+        __m128i v = _mm_setzero_si128(), ec = _mm_setzero_si128(), ea = _mm_setzero_si128();
+        size_t i;
+
+        // Mặt nạ so sánh là -1 ở làn đúng, trừ đi để đếm
+        for (i = 0; i + 2 <= n; i += 2) {
+            __m128d ok = _mm_cmpge_pd(_mm_loadu_pd(&s->len_min[i]), min_length);
+            __m128d same = _mm_and_pd(ok, _mm_cmpge_pd(_mm_loadu_pd(&s->cosine[i]), cosine));
+            __m128d same_angle = _mm_cmpgt_pd(_mm_loadu_pd(&s->angle_cos[i]), angle_cos);
+            v = _mm_sub_epi64(v, _mm_castpd_si128(ok));
+            ec = _mm_sub_epi64(ec, _mm_castpd_si128(same));
+            ea = _mm_sub_epi64(ea, _mm_castpd_si128(same_angle));
+        }
+        valid[p] = te_hsum_epi64_sse2(v);
+        eq_cosine[p] = te_hsum_epi64_sse2(ec);
+        eq_atan2[p] = te_hsum_epi64_sse2(ea);
+        for (; i < n; i++) {
+            int ok = s->len_min[i] >= th->min_length[p];
+            valid[p] += ok;
+            eq_cosine[p] += ok && s->cosine[i] >= th->cosine[p];
+            eq_atan2[p] += s->angle_cos[i] > th->angle_cos[p];
+        }
+    }
+}
+
+// ---- Kernel AVX2 (4 cặp mỗi lần) ----
+
+__attribute__((target("avx2")))
+static inline __m256d te_load4_i16(const int16_t *p) {
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+__attribute__((target("avx2")))
+static double te_prepare_avx2(const struct te_dataset *ds, size_t t, struct te_scratch *s) {
+    size_t m0 = ds->move_off[t], m1 = ds->move_off[t + 1];
+    size_t p0 = ds->pair_off[t], n = ds->pair_off[t + 1] - p0;
+    __m256d sum = _mm256_setzero_pd();
+    double lanes[4], distance;
+    size_t i;
+
+    for (i = m0; i + 4 <= m1; i += 4) {
+        __m256d dx = te_load4_i16(&ds->move_dx[i]), dy = te_load4_i16(&ds->move_dy[i]);
+        sum = _mm256_add_pd(sum, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))));
+    }
+    _mm256_storeu_pd(lanes, sum);
+    distance = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < m1; i++) {
+        double dx = ds->move_dx[i], dy = ds->move_dy[i];
+        distance += sqrt(dx * dx + dy * dy);
+    }
+
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0), minus_one = _mm256_set1_pd(-1.0);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256d x1 = te_load4_i16(&ds->pair_dx1[p0 + i]), y1 = te_load4_i16(&ds->pair_dy1[p0 + i]);
+        __m256d x2 = te_load4_i16(&ds->pair_dx2[p0 + i]), y2 = te_load4_i16(&ds->pair_dy2[p0 + i]);
+        __m256d l1 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x1, x1), _mm256_mul_pd(y1, y1)));
+        __m256d l2 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x2, x2), _mm256_mul_pd(y2, y2)));
+        __m256d dot = _mm256_add_pd(_mm256_mul_pd(x1, x2), _mm256_mul_pd(y1, y2));
+        __m256d c = _mm256_div_pd(dot, _mm256_mul_pd(l1, l2));
+        __m256d lm = _mm256_min_pd(l1, l2);
+
+        _mm256_storeu_pd(&s->len_min[i], lm);
+        _mm256_storeu_pd(&s->cosine[i], c);
+        _mm256_storeu_pd(&s->angle_cos[i], _mm256_min_pd(_mm256_max_pd(c, minus_one), one));
+        int zero_mask = _mm256_movemask_pd(_mm256_cmp_pd(lm, zero, _CMP_EQ_OQ));
+        for (int lane = 0; zero_mask; lane++, zero_mask >>= 1) {
+            if (zero_mask & 1) {
+                size_t k = p0 + i + lane;
+                s->angle_cos[i + lane] = te_atan2_angle_cos(ds->pair_dx1[k], ds->pair_dy1[k],
+                                                            ds->pair_dx2[k], ds->pair_dy2[k]);
+            }
+        }
+    }
+    for (; i < n; i++) {
+        te_pair_scalar(ds->pair_dx1[p0 + i], ds->pair_dy1[p0 + i], ds->pair_dx2[p0 + i], ds->pair_dy2[p0 + i],
+                       &s->len_min[i], &s->cosine[i], &s->angle_cos[i]);
+    }
+    return distance;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t te_hsum_epi64_avx2(__m256i v) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static void te_count_avx2(const struct te_scratch *s, size_t n, const struct te_thresholds *th, int np,
+                          uint64_t *valid, uint64_t *eq_cosine, uint64_t *eq_atan2) {
+    for (int p = 0; p < np; p++) {
+        const __m256d min_length = _mm256_set1_pd(th->min_length[p]);
+        const __m256d cosine = _mm256_set1_pd(th->cosine[p]);
+        const __m256d angle_cos = _mm256_set1_pd(th->angle_cos[p]);
+        __m256i v = _mm256_setzero_si256(), ec = _mm256_setzero_si256(), ea = _mm256_setzero_si256();
+        size_t i;
+
+        for (i = 0; i + 4 <= n; i += 4) {
+            __m256d ok = _mm256_cmp_pd(_mm256_loadu_pd(&s->len_min[i]), min_length, _CMP_GE_OQ);
+            __m256d same = _mm256_and_pd(ok, _mm256_cmp_pd(_mm256_loadu_pd(&s->cosine[i]), cosine, _CMP_GE_OQ));
+            __m256d same_angle = _mm256_cmp_pd(_mm256_loadu_pd(&s->angle_cos[i]), angle_cos, _CMP_GT_OQ);
+            v = _mm256_sub_epi64(v, _mm256_castpd_si256(ok));
+            ec = _mm256_sub_epi64(ec, _mm256_castpd_si256(same));
+            ea = _mm256_sub_epi64(ea, _mm256_castpd_si256(same_angle));
+        }
+        valid[p] = te_hsum_epi64_avx2(v);
+        eq_cosine[p] = te_hsum_epi64_avx2(ec);
+        eq_atan2[p] = te_hsum_epi64_avx2(ea);
+        for (; i < n; i++) {
+            int ok = s->len_min[i] >= th->min_length[p];
+            valid[p] += ok;
+            eq_cosine[p] += ok && s->cosine[i] >= th->cosine[p];
+            eq_atan2[p] += s->angle_cos[i] > th->angle_cos[p];
+        }
+    }
+}
+#endif /* TE_X86 */
+
+// Chọn kernel tốt nhất mà CPU hỗ trợ; kernel yêu cầu không có thì lùi về mức thấp hơn
+static inline enum te_kernel te_pick_kernel(enum te_kernel wanted) {
+#ifdef TE_X86
+    __builtin_cpu_init();
+    if ((wanted == TE_KERNEL_AUTO || wanted == TE_KERNEL_AVX2) && __builtin_cpu_supports("avx2")) {
+        return TE_KERNEL_AVX2;
+    }
+    if (wanted != TE_KERNEL_SCALAR && __builtin_cpu_supports("sse2")) {
+        return TE_KERNEL_SSE2;
+    }
+#else
+    (void)wanted;
+#endif
+    return TE_KERNEL_SCALAR;
+}
+
+struct te_job {
+    const struct te_dataset *ds;
+    const struct te_thresholds *th;
+    int nparams;
+    enum te_kernel kernel;
+    size_t first, last;         // Dải quỹ đạo [first, last)
+    struct te_output *out;
+    int error;
+};
+
+static void *te_worker(void *arg) {
+    struct te_job *job = arg;
+    const struct te_dataset *ds = job->ds;
+    size_t cap = ds->max_pairs ? ds->max_pairs : 1;
+    struct te_scratch s;
+    uint64_t valid[TE_MAX_PARAMS], eq_cosine[TE_MAX_PARAMS], eq_atan2[TE_MAX_PARAMS];
+    int np = job->nparams;
+
+    s.len_min = malloc(cap * sizeof(double));
+    s.cosine = malloc(cap * sizeof(double));
+    s.angle_cos = malloc(cap * sizeof(double));
+    if (!s.len_min || !s.cosine || !s.angle_cos) {
+        job->error = -1;
+        goto out;
+    }
+
+    for (size_t t = job->first; t < job->last; t++) {
+        size_t n = ds->pair_off[t + 1] - ds->pair_off[t];
+        double distance;
+
+        switch (job->kernel) {
+#ifdef TE_X86
+        case TE_KERNEL_AVX2:
+            distance = te_prepare_avx2(ds, t, &s);
+            te_count_avx2(&s, n, job->th, np, valid, eq_cosine, eq_atan2);
+            break;
+        case TE_KERNEL_SSE2:
+            distance = te_prepare_sse2(ds, t, &s);
+            te_count_sse2(&s, n, job->th, np, valid, eq_cosine, eq_atan2);
+            break;
+#endif
+        default:
+            distance = te_prepare_scalar(ds, t, &s);
+            te_count_scalar(&s, n, job->th, np, valid, eq_cosine, eq_atan2);
+            break;
+        }
+
+        job->out->speed[t] = distance / ds->duration[t];
+        for (int p = 0; p < np; p++) {
+            job->out->acc_cosine[t * np + p] = valid[p] ? (double)eq_cosine[p] / valid[p] : 1.0;
+            job->out->acc_atan2[t * np + p] = n ? (double)eq_atan2[p] / n : 1.0;
+        }
+    }
+
+out:
+    free(s.len_min);
+    free(s.cosine);
+    free(s.angle_cos);
+    return NULL;
+}
+
+/*
+ * Tính speed và accuracy (cả hai cách) của mọi quỹ đạo cho nparams bộ tham số
+ * trong một lượt. threads <= 0: dùng mọi CPU. out phải được te_output_alloc().
+ * Trả về kernel đã dùng, hoặc -1 nếu lỗi.
+ */
+static inline int te_run(const struct te_dataset *ds, const struct te_params *params, int nparams,
+                         int threads, enum te_kernel kernel, struct te_output *out) {
+    struct te_thresholds th;
+    size_t total, per_thread, acc, t;
+    int i, used = 0, ret;
+
+    if (nparams < 1 || nparams > TE_MAX_PARAMS || out->nparams != nparams) {
+        return -1;
+    }
+    for (i = 0; i < nparams; i++) {
+        th.min_length[i] = params[i].min_vector_length;
+        th.cosine[i] = params[i].cosine_tolerance;
+        th.angle_cos[i] = cos(params[i].angle_tolerance);
+    }
+    kernel = te_pick_kernel(kernel);
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if ((size_t)threads > ds->traj_count) {
+        threads = ds->traj_count ? (int)ds->traj_count : 1;
+    }
+
+    struct te_job jobs[threads];
+    pthread_t tids[threads];
+
+    // Chia theo số MOVE + cặp để các luồng có lượng việc gần bằng nhau
+    total = ds->move_count + ds->pair_count + ds->traj_count;
+    per_thread = total / threads + 1;
+    acc = 0;
+    t = 0;
+    for (i = 0; i < threads; i++) {
+        jobs[i] = (struct te_job){ .ds = ds, .th = &th, .nparams = nparams, .kernel = kernel, .out = out };
+        jobs[i].first = t;
+        while (t < ds->traj_count && (i == threads - 1 || acc < per_thread * (i + 1))) {
+            acc += (ds->move_off[t + 1] - ds->move_off[t]) + (ds->pair_off[t + 1] - ds->pair_off[t]) + 1;
+            t++;
+        }
+        jobs[i].last = t;
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, te_worker, &jobs[i]) != 0) {
+            break;
+        }
+        used++;
+    }
+    // Luồng nào không tạo được thì làm ngay trên luồng gọi
+    for (i = used; i < threads; i++) {
+        te_worker(&jobs[i]);
+    }
+    ret = kernel;
+    for (i = 0; i < threads; i++) {
+        if (i < used) {
+            pthread_join(tids[i], NULL);
+        }
+        if (jobs[i].error) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static inline int te_output_alloc(struct te_output *out, const struct te_dataset *ds, int nparams) {
+    size_t n = ds->traj_count ? ds->traj_count : 1;
+
+    out->nparams = nparams;
+    out->speed = malloc(n * sizeof(double));
+    out->acc_cosine = malloc(n * nparams * sizeof(double));
+    out->acc_atan2 = malloc(n * nparams * sizeof(double));
+    return out->speed && out->acc_cosine && out->acc_atan2 ? 0 : -1;
+}
+
+static inline void te_output_free(struct te_output *out) {
+    free(out->speed);
+    free(out->acc_cosine);
+    free(out->acc_atan2);
+    memset(out, 0, sizeof(*out));
+}
+
+#endif /* TRAJECTORY_ENGINE_H */
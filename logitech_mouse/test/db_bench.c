@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mqtt/metrics_db.h"
+
+/*
+ * Đo tốc độ ghi kết quả vào MySQL/MariaDB chạy trên máy:
+ *
+ *   ./db_bench [-h host] [-u user] [-p password] [-d database] [-n rows] [-c connect_rows] [-b flush_rows]
+ *
+ *   connect   cách cũ của sub: mỗi dòng một lần kết nối + sprintf + INSERT
+ *   prepared  một kết nối, INSERT một dòng đã prepare, autocommit từng dòng
+ *   batched   metrics_db.h: bộ đệm write-behind, INSERT nhiều dòng trong một transaction
+ *
+ * Ghi vào bảng tạm mouse_metrics_bench (tạo LIKE mouse_metrics, xóa khi xong).
+ * Build: gcc -O2 -o db_bench db_bench.c $(mysql_config --cflags --libs) -lm
+ */
+
+#define BENCH_TABLE "mouse_metrics_bench"
+
+static const char *host = "localhost";
+static const char *user = "root";
+static const char *password = "123456";
+static const char *database = "mouse_data";
+
+static MYSQL *connect_db(void) {
+    MYSQL *conn = mysql_init(NULL);
+    if (mysql_real_connect(conn, host, user, password, database, 0, NULL, 0) == NULL) {
+        fprintf(stderr, "%s\n", mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+static int run_sql(MYSQL *conn, const char *sql) {
+    if (mysql_query(conn, sql) != 0) {
+        fprintf(stderr, "%s: %s\n", sql, mysql_error(conn));
+        return -1;
+    }
+    return 0;
+}
+
+static void report(const char *name, int rows, uint64_t elapsed_ns) {
+    printf("%-9s %8d rows %10.1f ms %12.0f rows/s\n", name, rows, elapsed_ns / 1e6, rows / (elapsed_ns / 1e9));
+}
+
+static int bench_connect(int rows) {
+    uint64_t start = metrics_db_now();
+    for (int i = 0; i < rows; i++) {
+        MYSQL *conn = connect_db();
+        char sql[200];
+        if (!conn) {
+            return -1;
+        }
+        sprintf(sql, "insert into " BENCH_TABLE "(speed, accuracy) values (%.2f, %.2f)", i * 0.01, 0.5);
+        mysql_query(conn, sql);
+        mysql_close(conn);
+    }
+    report("connect", rows, metrics_db_now() - start);
+    return 0;
+}
+
+static int bench_prepared(int rows) {
+    const char *sql = "insert into " BENCH_TABLE "(speed, accuracy) values (?, ?)";
+    MYSQL *conn = connect_db();
+    MYSQL_STMT *stmt;
+    MYSQL_BIND bind[2];
+    double speed, accuracy = 0.5;
+    int ret = 0;
+
+    if (!conn) {
+        return -1;
+    }
+    stmt = mysql_stmt_init(conn);
+    if (!stmt || mysql_stmt_prepare(stmt, sql, strlen(sql)) != 0) {
+        fprintf(stderr, "prepare: %s\n", stmt ? mysql_stmt_error(stmt) : mysql_error(conn));
+        ret = -1;
+        goto out;
+    }
+    memset(bind, 0, sizeof(bind));
+    bind[0].buffer_type = MYSQL_TYPE_DOUBLE;
+    bind[0].buffer = &speed;
+    bind[1].buffer_type = MYSQL_TYPE_DOUBLE;
+    bind[1].buffer = &accuracy;
+    mysql_stmt_bind_param(stmt, bind);
+
+    uint64_t start = metrics_db_now();
+    for (int i = 0; i < rows; i++) {
+        speed = i * 0.01;
+        if (mysql_stmt_execute(stmt) != 0) {
+            fprintf(stderr, "execute: %s\n", mysql_stmt_error(stmt));
+            ret = -1;
+            goto out;
+        }
+    }
+    report("prepared", rows, metrics_db_now() - start);
+
+out:
+    if (stmt) {
+        mysql_stmt_close(stmt);
+    }
+    mysql_close(conn);
+    return ret;
+}
+
+static int bench_batched(int rows, int flush_rows) {
+    struct metrics_db db = {
+        .host = host, .user = user, .password = password, .database = database,
+        .table = BENCH_TABLE, .flush_rows = flush_rows,
+    };
+
+    if (metrics_db_init(&db) < 0 || metrics_db_connect(&db) < 0) {
+        return -1;
+    }
+    uint64_t start = metrics_db_now();
+    for (int i = 0; i < rows; i++) {
+        struct metrics_row row = { .speed = i * 0.01, .accuracy = 0.5 };
+        metrics_db_add(&db, &row);
+    }
+    metrics_db_flush(&db);
+    uint64_t elapsed = metrics_db_now() - start;
+
+    report("batched", rows, elapsed);
+    printf("          %llu transactions of %d rows, %llu dropped\n",
+           db.transactions, db.flush_rows, db.dropped);
+    metrics_db_close(&db);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int rows = 20000, connect_rows = 1000, flush_rows = DB_FLUSH_ROWS, opt, ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "h:u:p:d:n:c:b:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'u': user = optarg; break;
+        case 'p': password = optarg; break;
+        case 'd': database = optarg; break;
+        case 'n': rows = atoi(optarg); break;
+        case 'c': connect_rows = atoi(optarg); break;
+        case 'b': flush_rows = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-u user] [-p password] [-d database] "
+                    "[-n rows] [-c connect_rows] [-b flush_rows]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    MYSQL *conn = connect_db();
+    if (!conn) {
+        return EXIT_FAILURE;
+    }
+    run_sql(conn, "drop table if exists " BENCH_TABLE);
+    if (run_sql(conn, "create table " BENCH_TABLE " like mouse_metrics") < 0) {
+        mysql_close(conn);
+        return EXIT_FAILURE;
+    }
+
+    // Cách cũ chậm hơn nhiều bậc nên chạy ít dòng hơn
+    if (bench_connect(connect_rows) < 0 || bench_prepared(rows) < 0 || bench_batched(rows, flush_rows) < 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    if (run_sql(conn, "select count(*) from " BENCH_TABLE) == 0) {
+        MYSQL_RES *res = mysql_store_result(conn);
+        MYSQL_ROW row = res ? mysql_fetch_row(res) : NULL;
+        if (row) {
+            printf("%s rows in " BENCH_TABLE " (expected %d)\n", row[0], connect_rows + 2 * rows);
+        }
+        if (res) {
+            mysql_free_result(res);
+        }
+    }
+    run_sql(conn, "drop table " BENCH_TABLE);
+    mysql_close(conn);
+    return ret;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Tính phân vị độ trễ từng chặng từ file trace của pub/sub (chạy với -t):
+ *
+ *   ./pub -t trace.csv & ./sub -t trace.csv   (hoặc hai file riêng)
+ *   ./latency_report trace.csv [sub_trace.csv ...]
+ *
+ * Dòng pub: pub,<id>,<arrival>,<flush>,<read>,<close>,<publish>  (CLOCK_MONOTONIC)
+ * Dòng sub: sub,<id>,<sent>,<received>,<received_mono>,<stored_mono>
+ * Mỗi chặng được tính trong cùng một đồng hồ nên không cần ghép dòng pub với sub;
+ * riêng chặng mạng dùng CLOCK_REALTIME của hai máy và chỉ đúng khi giờ được đồng bộ.
+ */
+
+enum stage {
+    STAGE_COALESCE,  // Driver nhận report -> ghi vào ring
+    STAGE_RING,      // Nằm trong ring -> pub lấy ra
+    STAGE_COMPUTE,   // pub lấy ra -> tính xong quỹ đạo
+    STAGE_PUBLISH,   // Tính xong -> broker xác nhận
+    STAGE_HOST,      // Tổng trên máy pub: driver nhận report -> broker xác nhận
+    STAGE_NETWORK,   // pub gửi -> sub nhận
+    STAGE_STORE,     // sub nhận -> ghi xong vào MySQL
+    STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+    [STAGE_COALESCE] = "hid -> ring",
+    [STAGE_RING] = "ring -> pub read",
+    [STAGE_COMPUTE] = "read -> trajectory",
+    [STAGE_PUBLISH] = "trajectory -> publish",
+    [STAGE_HOST] = "hid -> publish",
+    [STAGE_NETWORK] = "publish -> sub",
+    [STAGE_STORE] = "sub -> mysql",
+};
+
+struct samples {
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+static struct samples stages[STAGE_COUNT];
+
+static void add_sample(enum stage stage, int64_t value) {
+    struct samples *s = &stages[stage];
+
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 1024;
+        s->values = realloc(s->values, s->capacity * sizeof(s->values[0]));
+        if (!s->values) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->values[s->count++] = value;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Phân vị theo nearest-rank trên mảng đã sắp xếp, đổi ra micro giây
+static double percentile_us(const struct samples *s, double p) {
+    size_t rank = (size_t)(p / 100.0 * s->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    return s->values[rank - 1] / 1000.0;
+}
+
+static int read_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[256];
+    unsigned long long id, t[5];
+    int lines = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "pub,%llu,%llu,%llu,%llu,%llu,%llu", &id, &t[0], &t[1], &t[2], &t[3], &t[4]) == 6) {
+            add_sample(STAGE_COALESCE, (int64_t)(t[1] - t[0]));
+            add_sample(STAGE_RING, (int64_t)(t[2] - t[1]));
+            add_sample(STAGE_COMPUTE, (int64_t)(t[3] - t[2]));
+            add_sample(STAGE_PUBLISH, (int64_t)(t[4] - t[3]));
+            add_sample(STAGE_HOST, (int64_t)(t[4] - t[0]));
+            lines++;
+        } else if (sscanf(line, "sub,%llu,%llu,%llu,%llu,%llu", &id, &t[0], &t[1], &t[2], &t[3]) == 5) {
+            add_sample(STAGE_NETWORK, (int64_t)(t[1] - t[0]));
+            add_sample(STAGE_STORE, (int64_t)(t[3] - t[2]));
+            lines++;
+        }
+    }
+    fclose(f);
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s trace_file [trace_file ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (read_trace(argv[i]) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-22s %8s %10s %10s %10s %10s %10s\n", "stage (us)", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        struct samples *s = &stages[i];
+        if (s->count == 0) {
+            continue;
+        }
+        qsort(s->values, s->count, sizeof(s->values[0]), compare_int64);
+        printf("%-22s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[i], s->count,
+               percentile_us(s, 50), percentile_us(s, 90), percentile_us(s, 99), percentile_us(s, 99.9),
+               s->values[s->count - 1] / 1000.0);
+        free(s->values);
+    }
+    return EXIT_SUCCESS;
+}
@@ -5,16 +5,9 @@
 #include <time.h>
 #include <string.h>
 
-struct mouse_event {
-    long long timestamp_sec;
-    long timestamp_nsec;
-    int type;
-    int x;
-    int y;
-    int button;
-    int action;
-    int wheel_value;
-};
+#include "../logitech_mouse.h"
+
+#define READ_BATCH 64 // Số sự kiện tối đa mỗi lần read()
 
 const char* get_event_type(int type) {
     switch (type) {
@@ -42,8 +35,41 @@ const char* get_action_name(int action) {
     }
 }
 
-int main() {
-    int fd = open("/dev/logitech_mouse", O_RDONLY);
+void print_event(const struct mouse_event *event) {
+    // Chuyển timestamp thành định dạng dễ đọc
+    char time_buf[64];
+    struct tm tm_info;
+    time_t sec = (time_t)event->timestamp_sec; // Chuyển đổi kiểu
+    localtime_r(&sec, &tm_info);
+    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
+    
+    printf("[%s.%09ld] ", time_buf, event->timestamp_nsec);
+
+    switch (event->type) {
+        case 0: // MOVE
+            printf("MOVE: x=%d, y=%d\n", event->x, event->y);
+            break;
+        case 1: // CLICK
+            printf("CLICK: button=%s, action=%s\n", 
+                   get_button_name(event->button), 
+                   get_action_name(event->action));
+            break;
+        case 2: // WHEEL
+            printf("WHEEL: value=%d\n", event->wheel_value);
+            break;
+        case 3: // GAP
+            printf("GAP: mất %d sự kiện\n", event->x);
+            break;
+        default:
+            printf("UNKNOWN EVENT\n");
+            break;
+    }
+}
+
+// Mỗi chuột một node /dev/logitech_mouseN, mặc định chuột đầu tiên
+int main(int argc, char *argv[]) {
+    const char *device_path = argc > 1 ? argv[1] : "/dev/logitech_mouse0";
+    int fd = open(device_path, O_RDONLY);
     if (fd < 0) {
         perror("Failed to open device");
         return EXIT_FAILURE;
@@ -52,8 +78,8 @@ int main() {
     printf("Listening for mouse events...\n");
 
     while (1) {
-        struct mouse_event event;
-        ssize_t bytes_read = read(fd, &event, sizeof(event));
+        struct mouse_event events[READ_BATCH];
+        ssize_t bytes_read = read(fd, events, sizeof(events));
         
         if (bytes_read < 0) {
             perror("Read error");
@@ -64,30 +90,10 @@ int main() {
             continue;
         }
 
-        // Chuyển timestamp thành định dạng dễ đọc
-        char time_buf[64];
-        struct tm tm_info;
-        time_t sec = (time_t)event.timestamp_sec; // Chuyển đổi kiểu
-        localtime_r(&sec, &tm_info);
-        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
-        
-        printf("[%s.%09ld] ", time_buf, event.timestamp_nsec);
-
-        switch (event.type) {
-            case 0: // MOVE
-                printf("MOVE: x=%d, y=%d\n", event.x, event.y);
-                break;
-            case 1: // CLICK
-                printf("CLICK: button=%s, action=%s\n", 
-                       get_button_name(event.button), 
-                       get_action_name(event.action));
-                break;
-            case 2: // WHEEL
-                printf("WHEEL: value=%d\n", event.wheel_value);
-                break;
-            default:
-                printf("UNKNOWN EVENT\n");
-                break;
+        // Driver trả về nhiều sự kiện nguyên vẹn trong một lần đọc
+        int count = bytes_read / sizeof(struct mouse_event);
+        for (int i = 0; i < count; i++) {
+            print_event(&events[i]);
         }
     }
 
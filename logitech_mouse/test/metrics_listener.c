@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../logitech_mouse.h"
+
+#define DEVICE_PATH "/dev/logitech_mouse_metrics0" // Chuột đầu tiên, chọn chuột khác qua argv[1]
+#define READ_BATCH 16 // Số bản ghi tối đa mỗi lần read()
+
+// Đổi số Q24.8 của driver sang double
+static double from_fixed(__u32 value) {
+    return (double)value / (1 << MOUSE_METRICS_FRAC_BITS);
+}
+
+void print_metrics(const struct mouse_metrics *m) {
+    printf("Trajectory: %u điểm, thời gian = %.3f giây, kết thúc bằng %s\n",
+           m->point_count, m->duration_us / 1e6,
+           m->end_type == MOUSE_EVENT_CLICK ? "CLICK" : "WHEEL");
+    printf("  Path length = %.2f\n", from_fixed(m->path_length));
+    printf("  Speed = %.3f (đơn vị tương đối/giây)\n", from_fixed(m->speed));
+    printf("  Accuracy = %.3f (%u cặp đoạn)\n",
+           (double)m->accuracy / MOUSE_METRICS_ACCURACY_SCALE, m->segments);
+}
+
+int main(int argc, char *argv[]) {
+    const char *device_path = argc > 1 ? argv[1] : DEVICE_PATH;
+    int fd = open(device_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Không thể mở %s: ", device_path);
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    printf("Đang chờ quỹ đạo hoàn chỉnh...\n");
+
+    while (1) {
+        struct mouse_metrics records[READ_BATCH];
+        ssize_t bytes_read = read(fd, records, sizeof(records));
+
+        if (bytes_read < 0) {
+            perror("Read error");
+            break;
+        }
+
+        int count = bytes_read / sizeof(struct mouse_metrics);
+        for (int i = 0; i < count; i++) {
+            print_metrics(&records[i]);
+        }
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
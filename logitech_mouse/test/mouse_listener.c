@@ -5,17 +5,9 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <sys/ioctl.h>
 
-struct mouse_event {
-    long long timestamp_sec;
-    long timestamp_nsec;
-    int type;
-    int x;
-    int y;
-    int button;
-    int action;
-    int wheel_value;
-};
+#include "../logitech_mouse.h"
 
 struct trajectory_point {
     double timestamp;
@@ -25,8 +17,10 @@ struct trajectory_point {
 };
 
 #define MAX_POINTS 10000
-#define DEVICE_PATH "/dev/logitech_mouse"
+#define DEVICE_PATH "/dev/logitech_mouse0" // Chuột đầu tiên, chọn chuột khác qua argv[1]
 #define ANGLE_TOLERANCE 0.1 // Ngưỡng sai số cho góc (radian)
+#define READ_BATCH 64 // Số sự kiện tối đa mỗi lần read()
+#define WAKE_TIMEOUT_US 250000 // read() trả về khi đủ READ_BATCH sự kiện, sau chừng này, hoặc ở CLICK/WHEEL
 
 void process_trajectory(struct trajectory_point *points, int count) {
     if (count < 2) return;
@@ -78,49 +72,79 @@ void process_trajectory(struct trajectory_point *points, int count) {
     printf("  Accuracy = %.3f\n", accuracy);
 }
 
-int main() {
-    int fd = open(DEVICE_PATH, O_RDONLY);
+int main(int argc, char *argv[]) {
+    const char *device_path = argc > 1 ? argv[1] : DEVICE_PATH;
+    int fd = open(device_path, O_RDONLY);
     if (fd < 0) {
         perror("Không thể mở thiết bị");
         return 1;
     }
 
-    struct mouse_event event;
+    // Bản ghi v2 nhỏ hơn và có thời gian monotonic, hợp để đo thời gian quỹ đạo
+    __u32 abi = MOUSE_ABI_V2;
+    if (ioctl(fd, MOUSE_IOC_SET_ABI, &abi) < 0) {
+        perror("Driver không hỗ trợ MOUSE_ABI_V2");
+        close(fd);
+        return 1;
+    }
+
+    // Quỹ đạo chỉ được xử lý ở CLICK/WHEEL nên không cần thức dậy theo từng MOVE
+    struct mouse_wakeup wakeup = {
+        .events = READ_BATCH,
+        .timeout_us = WAKE_TIMEOUT_US,
+        .flags = MOUSE_WAKEUP_CLICK | MOUSE_WAKEUP_WHEEL,
+    };
+    if (ioctl(fd, MOUSE_IOC_SET_WAKEUP, &wakeup) < 0) {
+        perror("Driver không hỗ trợ ngưỡng đánh thức");
+    }
+
+    struct mouse_event_v2 events[READ_BATCH];
     struct trajectory_point points[MAX_POINTS];
     int point_count = 0;
 
     printf("Bắt đầu theo dõi sự kiện chuột...\n");
 
     while (1) {
-        ssize_t bytes_read = read(fd, &event, sizeof(struct mouse_event));
+        ssize_t bytes_read = read(fd, events, sizeof(events));
         if (bytes_read < 0) {
             perror("Lỗi khi đọc sự kiện");
             break;
         }
-        if (bytes_read != sizeof(struct mouse_event)) {
+        if (bytes_read % sizeof(struct mouse_event_v2) != 0) {
             fprintf(stderr, "Dữ liệu đọc không đầy đủ\n");
             continue;
         }
 
-        double timestamp = (double)event.timestamp_sec + (double)event.timestamp_nsec / 1e9;
+        int count = bytes_read / sizeof(struct mouse_event_v2);
+        for (int i = 0; i < count; i++) {
+            struct mouse_event_v2 *event = &events[i];
+            double timestamp = (double)event->timestamp_ns / 1e9;
+            int type = MOUSE_EVENT_TYPE(event->info);
 
-        if (point_count >= MAX_POINTS) {
-            printf("Trajectory quá dài, bỏ qua...\n");
-            point_count = 0;
-        }
+            if (type == MOUSE_EVENT_GAP) { // Quỹ đạo bị đứt, bỏ phần đang gom
+                printf("Mất %u sự kiện, bỏ quỹ đạo hiện tại\n", mouse_event_gap_count(event));
+                point_count = 0;
+                continue;
+            }
+
+            if (point_count >= MAX_POINTS) {
+                printf("Trajectory quá dài, bỏ qua...\n");
+                point_count = 0;
+            }
 
-        points[point_count].timestamp = timestamp;
-        points[point_count].delta_x = event.x;
-        points[point_count].delta_y = event.y;
-        points[point_count].type = event.type;
+            points[point_count].timestamp = timestamp;
+            points[point_count].delta_x = event->dx;
+            points[point_count].delta_y = event->dy;
+            points[point_count].type = type;
 
-        point_count++;
+            point_count++;
 
-        if (event.type == 1 || event.type == 2) { // CLICK hoặc WHEEL
-            if (point_count > 1) { // Đảm bảo có ít nhất 2 điểm
-                process_trajectory(points, point_count);
+            if (type == MOUSE_EVENT_CLICK || type == MOUSE_EVENT_WHEEL) {
+                if (point_count > 1) { // Đảm bảo có ít nhất 2 điểm
+                    process_trajectory(points, point_count);
+                }
+                point_count = 0;
             }
-            point_count = 0;
         }
     }
 
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../mouse_ring.h"
+
+/*
+ * Stress test ring sự kiện: nhiều reader (read() và mmap) cùng đọc trong khi
+ * driver đẩy sự kiện giả với tốc độ tối đa qua debugfs.
+ *
+ *   sudo ./ring_stress [-d số_chuột] [-n số_sự_kiện] [-r số_reader] [-m số_reader_mmap]
+ *
+ * Không di chuyển chuột trong lúc chạy: sự kiện thật sẽ bị tính là dữ liệu hỏng.
+ * Mỗi reader phải thấy số thứ tự tăng dần, không có sự kiện bị xé (y == ~x),
+ * và số sự kiện nhận được + số bị mất (theo các sự kiện GAP) phải bằng đúng
+ * số sự kiện đã đẩy.
+ */
+
+#define DEVICE_PATH  "/dev/logitech_mouse%d"
+#define STRESS_PATH  "/sys/kernel/debug/logitech_mouse/logitech_mouse%d/stress"
+#define READ_BATCH   256
+#define IDLE_TIMEOUT_MS 2000 // Dừng reader nếu không có dữ liệu trong 2s
+
+struct reader_result {
+    int id;
+    int use_mmap;
+    unsigned long long received;
+    unsigned long long lost;
+    unsigned long long corrupt;     // Sự kiện bị xé hoặc không đúng thứ tự
+    unsigned long long gap_lost;    // Tổng số sự kiện bị mất theo các sự kiện GAP
+    int error;
+};
+
+static unsigned int total_events = 1000000;
+static char device_path[64];
+static pthread_barrier_t start_barrier;
+
+// Vị trí của reader trong chuỗi sự kiện giả
+struct seq_state {
+    unsigned long long next;    // Số thứ tự của sự kiện kế tiếp, tính cả các sự kiện đã mất
+    __u64 last_ns;
+};
+
+/*
+ * Kiểm tra một sự kiện; trả về 1 khi đã thấy sự kiện cuối cùng.
+ * Sự kiện giả của driver: dx = 16 bit thấp của số thứ tự, dy = ~dx, timestamp_ns tăng
+ * ngặt. Số thứ tự đầy đủ được dựng lại từ số sự kiện nhận được và số mất theo GAP,
+ * nên GAP đếm sai cũng bị phát hiện ở sự kiện kế tiếp.
+ */
+static int check_event(struct reader_result *res, const struct mouse_event_v2 *event, struct seq_state *st) {
+    unsigned long long seq = st->next;
+
+    // GAP đánh dấu chỗ mất, gồm cả sự kiện driver bỏ khi overflow_policy khác drop-oldest
+    if (MOUSE_EVENT_TYPE(event->info) == MOUSE_EVENT_GAP) {
+        res->gap_lost += mouse_event_gap_count(event);
+        st->next += mouse_event_gap_count(event);
+        return 0;
+    }
+    st->next++;
+    if (MOUSE_EVENT_TYPE(event->info) != MOUSE_EVENT_MOVE || (__u16)event->dx != (__u16)seq ||
+        event->dy != (__s16)~event->dx || event->timestamp_ns <= st->last_ns) {
+        res->corrupt++;
+        return 0;
+    }
+    st->last_ns = event->timestamp_ns;
+    res->received++;
+    return seq == total_events - 1;
+}
+
+static void *read_reader(void *arg) {
+    struct reader_result *res = arg;
+    struct mouse_event_v2 batch[READ_BATCH];
+    struct seq_state st = {0};
+    int done = 0;
+
+    // Đọc cùng định dạng với ring để so sánh được hai đường
+    __u32 abi = MOUSE_ABI_V2;
+    int fd = open(device_path, O_RDONLY | O_NONBLOCK);
+    if (fd >= 0 && ioctl(fd, MOUSE_IOC_SET_ABI, &abi) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    res->error = fd < 0 ? errno : 0;
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    while (!done) {
+        ssize_t bytes_read = read(fd, batch, sizeof(batch));
+        if (bytes_read < 0 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, IDLE_TIMEOUT_MS) <= 0) {
+                break;
+            }
+            continue;
+        }
+        if (bytes_read < 0) {
+            res->error = errno;
+            break;
+        }
+        for (size_t i = 0; i < bytes_read / sizeof(struct mouse_event_v2); i++) {
+            done |= check_event(res, &batch[i], &st);
+        }
+    }
+
+    __u64 lost = 0;
+    ioctl(fd, MOUSE_IOC_GET_LOST, &lost);
+    res->lost = lost;
+    close(fd);
+    return NULL;
+}
+
+static void *mmap_reader(void *arg) {
+    struct reader_result *res = arg;
+    struct mouse_event_v2 batch[READ_BATCH];
+    struct mouse_ring ring;
+    struct seq_state st = {0};
+    int done = 0;
+
+    int ret = mouse_ring_open(&ring, device_path);
+    res->error = ret < 0 ? errno : 0;
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+    if (ret < 0) {
+        return NULL;
+    }
+
+    while (!done) {
+        unsigned int n = mouse_ring_read(&ring, batch, READ_BATCH);
+        if (n == 0) {
+            if (mouse_ring_wait(&ring, IDLE_TIMEOUT_MS) <= 0) {
+                break;
+            }
+            continue;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            done |= check_event(res, &batch[i], &st);
+        }
+    }
+
+    res->lost = mouse_ring_lost(&ring);
+    mouse_ring_close(&ring);
+    return NULL;
+}
+
+/*
+ * Kiểm tra MOUSE_IOC_SET_WAKEUP: timeout_us/flags khi không có ngưỡng events phải
+ * bị từ chối, không được nhận rồi bỏ qua. Trả về số lỗi.
+ */
+static int check_wakeup_config(void) {
+    static const struct {
+        struct mouse_wakeup wakeup;
+        int valid;
+    } cases[] = {
+        {{0, 0, 0, 0}, 1},
+        {{16, 1000, MOUSE_WAKEUP_CLICK, 0}, 1},
+        {{0, 1000, 0, 0}, 0},
+        {{0, 0, MOUSE_WAKEUP_CLICK, 0}, 0},
+    };
+    int fd = open(device_path, O_RDONLY);
+    int failed = 0;
+
+    if (fd < 0) {
+        fprintf(stderr, "Không mở được %s: %s\n", device_path, strerror(errno));
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct mouse_wakeup wakeup = cases[i].wakeup;
+        int ret = ioctl(fd, MOUSE_IOC_SET_WAKEUP, &wakeup);
+        int ok = cases[i].valid ? ret == 0 : ret < 0 && errno == EINVAL;
+
+        printf("SET_WAKEUP events=%u timeout_us=%u flags=%#x: %s\n", wakeup.events, wakeup.timeout_us,
+               wakeup.flags, ok ? "PASS" : "FAIL");
+        failed += !ok;
+    }
+    close(fd);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    int num_readers = 4;
+    int num_mmap = -1;
+    int device = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:r:m:")) != -1) {
+        switch (opt) {
+            case 'd': device = atoi(optarg); break;
+            case 'n': total_events = strtoul(optarg, NULL, 0); break;
+            case 'r': num_readers = atoi(optarg); break;
+            case 'm': num_mmap = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-d device] [-n events] [-r readers] [-m mmap_readers]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (num_readers < 1 || total_events == 0) {
+        fprintf(stderr, "Cần ít nhất 1 reader và 1 sự kiện\n");
+        return EXIT_FAILURE;
+    }
+    if (num_mmap < 0 || num_mmap > num_readers) {
+        num_mmap = num_readers / 2;
+    }
+
+    char stress_path[96];
+    snprintf(device_path, sizeof(device_path), DEVICE_PATH, device);
+    snprintf(stress_path, sizeof(stress_path), STRESS_PATH, device);
+
+    if (check_wakeup_config()) {
+        return EXIT_FAILURE;
+    }
+
+    int stress_fd = open(stress_path, O_WRONLY);
+    if (stress_fd < 0) {
+        fprintf(stderr, "Không mở được %s: %s\n", stress_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    pthread_t threads[num_readers];
+    struct reader_result results[num_readers];
+    memset(results, 0, sizeof(results));
+    // Barrier 2 pha: mọi reader mở xong thiết bị trước khi bắt đầu đẩy sự kiện
+    pthread_barrier_init(&start_barrier, NULL, num_readers + 1);
+
+    for (int i = 0; i < num_readers; i++) {
+        results[i].id = i;
+        results[i].use_mmap = i < num_mmap;
+        pthread_create(&threads[i], NULL, results[i].use_mmap ? mmap_reader : read_reader, &results[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+
+    char cmd[32];
+    int len = snprintf(cmd, sizeof(cmd), "%u", total_events);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (write(stress_fd, cmd, len) != len) {
+        perror("Không đẩy được sự kiện");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close(stress_fd);
+
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Producer: %u sự kiện trong %.3f s (%.0f sự kiện/s)\n",
+           total_events, elapsed, total_events / elapsed);
+
+    int failed = 0;
+    for (int i = 0; i < num_readers; i++) {
+        pthread_join(threads[i], NULL);
+        struct reader_result *res = &results[i];
+        // lost chỉ gồm phần reader đọc chậm, GAP còn gồm cả phần driver tự bỏ
+        int ok = !res->error && res->corrupt == 0 && res->received + res->gap_lost == total_events &&
+                 res->gap_lost >= res->lost;
+        printf("Reader %d (%s): nhận %llu, mất %llu (GAP %llu), hỏng %llu%s%s\n",
+               res->id, res->use_mmap ? "mmap" : "read", res->received, res->lost, res->gap_lost, res->corrupt,
+               res->error ? ", lỗi: " : "", res->error ? strerror(res->error) : "");
+        printf("  -> %s\n", ok ? "PASS" : "FAIL");
+        failed |= !ok;
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,627 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <linux/uhid.h>
+
+#include "../mouse_ring.h"
+
+/*
+ * Benchmark driver không cần chuột thật: tạo một chuột ảo 046d:c077 qua /dev/uhid
+ * (bus USB nên mouse_probe() nhận nó như chuột thật), bơm report với tần số cố
+ * định và đọc lại qua ring mmap như pub.
+ *
+ *   sudo ./uhid_bench [-r 125,1000,8000] [-m 100:0:0,96:2:2] [-d seconds] [-i report_interval_us]
+ *                     [-M move_mode] [-N aggregate_reports] [-l build_label] [-o results.csv]
+ *
+ *   -r   các tần số report (Hz), mỗi tần số chạy với mọi tỉ lệ ở -m
+ *   -m   tỉ lệ report move:click:wheel; click đổi trạng thái nút trái, wheel cuộn ±1
+ *   -i   report_interval_us của chuột ảo (sysfs, không ảnh hưởng chuột thật)
+ *   -M   move_mode của chuột ảo: coalesce, passthrough hoặc aggregate
+ *   -N   aggregate_reports của chuột ảo (cho -M aggregate)
+ *   -l   nhãn build ghi vào cột build, mặc định srcversion của module
+ *   -o   ghi thêm kết quả vào file CSV (header khi file còn rỗng) để so sánh giữa các build
+ *
+ * Mỗi lần chạy in một dòng CSV ra stdout:
+ *   report_rate/event_rate  số report bơm vào và số sự kiện đọc ra mỗi giây
+ *   coalesce_ratio          số report có chuyển động trên mỗi MOVE (gộp của move_timer_callback),
+ *                           cùng timer_fires/timer_empty_fires của chuột ảo trong lần chạy
+ *   drop_rate               sự kiện mất (theo GAP) / (nhận được + mất); click/wheel_missing
+ *                           và motion_error (tổng |dx|+|dy| bị thiếu) là kiểm tra chéo
+ *   lat_*                   report -> đọc ra khỏi ring: từ timestamp_ns (lúc driver nhận report,
+ *                           với MOVE là report đầu tiên được gộp) tới lúc reader lấy sự kiện ra
+ *   coalesce_*, ring_*      hai phần của lat_*: flush_delay_us của các MOVE, rồi thời gian
+ *                           nằm trong ring (mọi loại sự kiện)
+ *
+ * Report được ghi vào uhid đồng bộ (hid_input_report() chạy ngay trong write()) nên
+ * timestamp_ns của driver chính là lúc bơm. Không chạy cùng pub/mouse_record trên chuột ảo.
+ *
+ * Build: gcc -O2 -pthread -o uhid_bench uhid_bench.c
+ */
+
+#define UHID_PATH   "/dev/uhid"
+#define CLASS_PATH  "/sys/class/logitech_mouse"
+#define DEVICE_PATH "/dev/logitech_mouse%d"
+#define READ_BATCH  256
+#define DRAIN_MS    200     // Chờ thêm sau khi bơm xong để timer gửi MOVE cuối và reader đọc hết
+#define PROBE_TIMEOUT_MS 5000
+#define MAX_RUNS    16
+
+// Giống bố cục boot mouse của 046d:c077: 3 nút + đệm, X, Y, wheel mỗi trục 8 bit, không có report ID
+static const unsigned char report_descriptor[] = {
+    0x05, 0x01,         // Usage Page (Generic Desktop)
+    0x09, 0x02,         // Usage (Mouse)
+    0xa1, 0x01,         // Collection (Application)
+    0x09, 0x01,         //   Usage (Pointer)
+    0xa1, 0x00,         //   Collection (Physical)
+    0x05, 0x09,         //     Usage Page (Button)
+    0x19, 0x01,         //     Usage Minimum (1)
+    0x29, 0x03,         //     Usage Maximum (3)
+    0x15, 0x00,         //     Logical Minimum (0)
+    0x25, 0x01,         //     Logical Maximum (1)
+    0x95, 0x03,         //     Report Count (3)
+    0x75, 0x01,         //     Report Size (1)
+    0x81, 0x02,         //     Input (Data, Variable, Absolute)
+    0x95, 0x01,         //     Report Count (1)
+    0x75, 0x05,         //     Report Size (5)
+    0x81, 0x03,         //     Input (Constant)
+    0x05, 0x01,         //     Usage Page (Generic Desktop)
+    0x09, 0x30,         //     Usage (X)
+    0x09, 0x31,         //     Usage (Y)
+    0x09, 0x38,         //     Usage (Wheel)
+    0x15, 0x81,         //     Logical Minimum (-127)
+    0x25, 0x7f,         //     Logical Maximum (127)
+    0x75, 0x08,         //     Report Size (8)
+    0x95, 0x03,         //     Report Count (3)
+    0x81, 0x06,         //     Input (Data, Variable, Relative)
+    0xc0,               //   End Collection
+    0xc0,               // End Collection
+};
+
+#define REPORT_SIZE 4
+
+struct mix {
+    unsigned int move, click, wheel;
+};
+
+struct counters {
+    unsigned long long enqueued_move, dropped, reader_lost, timer_fires, timer_empty_fires, reader_wakeups;
+};
+
+struct samples {
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+// Kết quả phía reader của một lần chạy
+struct reader_state {
+    struct mouse_ring *ring;
+    int stop;                       // Bơm xong: đọc nốt rồi dừng
+    unsigned long long events[4];   // Theo MOUSE_EVENT_*, GAP tính theo số sự kiện bị mất
+    long long dx, dy;               // Tổng chuyển động của các MOVE
+    struct samples latency, coalesce, ring_time;
+};
+
+static int uhid_fd = -1;
+static char uniq[64];
+static char device_path[64];
+static char stats_dir[96];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_sample(struct samples *s, int64_t value) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 4096;
+        s->values = realloc(s->values, s->capacity * sizeof(s->values[0]));
+        if (!s->values) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->values[s->count++] = value;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const struct samples *s, double p) {
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p / 100.0 * (s->count - 1) + 0.5);
+    return s->values[i] / 1000.0;
+}
+
+static int uhid_send(const struct uhid_event *ev, size_t len) {
+    if (write(uhid_fd, ev, len) != (ssize_t)len) {
+        perror("uhid write");
+        return -1;
+    }
+    return 0;
+}
+
+// Bỏ qua các thông báo kernel gửi cho thiết bị (START/OPEN/OUTPUT...), chỉ trả lời yêu cầu report
+static void uhid_drain(void) {
+    struct uhid_event ev;
+
+    while (read(uhid_fd, &ev, sizeof(ev)) > 0) {
+        // Descriptor không có feature report, nhưng không trả lời thì kernel chờ tới timeout
+        if (ev.type == UHID_GET_REPORT) {
+            struct uhid_event reply = { .type = UHID_GET_REPORT_REPLY };
+            reply.u.get_report_reply.id = ev.u.get_report.id;
+            reply.u.get_report_reply.err = EIO;
+            uhid_send(&reply, sizeof(reply));
+        } else if (ev.type == UHID_SET_REPORT) {
+            struct uhid_event reply = { .type = UHID_SET_REPORT_REPLY };
+            reply.u.set_report_reply.id = ev.u.set_report.id;
+            reply.u.set_report_reply.err = EIO;
+            uhid_send(&reply, sizeof(reply));
+        }
+    }
+}
+
+static int send_report(unsigned char buttons, signed char dx, signed char dy, signed char wheel) {
+    struct uhid_event ev;
+
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = REPORT_SIZE;
+    ev.u.input2.data[0] = buttons;
+    ev.u.input2.data[1] = (unsigned char)dx;
+    ev.u.input2.data[2] = (unsigned char)dy;
+    ev.u.input2.data[3] = (unsigned char)wheel;
+    // Chỉ cần ghi tới hết phần dữ liệu của report
+    return uhid_send(&ev, offsetof(struct uhid_event, u.input2.data) + REPORT_SIZE);
+}
+
+// Tìm /dev/logitech_mouseN mà driver tạo cho chuột ảo (HID_UNIQ trong uevent của thiết bị HID cha)
+static int find_device(void) {
+    char path[128], line[160];
+
+    for (int n = 0; n < 16; n++) {
+        snprintf(path, sizeof(path), CLASS_PATH "/logitech_mouse%d/device/uevent", n);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        int found = 0;
+        while (!found && fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\n")] = '\0';
+            found = strncmp(line, "HID_UNIQ=", 9) == 0 && strcmp(line + 9, uniq) == 0;
+        }
+        fclose(f);
+        if (found) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+static int create_device(void) {
+    struct uhid_event ev;
+    int n = -1;
+
+    uhid_fd = open(UHID_PATH, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (uhid_fd < 0) {
+        perror(UHID_PATH);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "uhid_bench 046d:c077");
+    snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys), "uhid_bench/%d", getpid());
+    snprintf(uniq, sizeof(uniq), "uhid_bench-%d", getpid());
+    snprintf((char *)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", uniq);
+    memcpy(ev.u.create2.rd_data, report_descriptor, sizeof(report_descriptor));
+    ev.u.create2.rd_size = sizeof(report_descriptor);
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = 0x046d;
+    ev.u.create2.product = 0xc077;
+    if (uhid_send(&ev, sizeof(ev)) < 0) {
+        return -1;
+    }
+
+    // Chờ probe xong và udev tạo node
+    for (int waited = 0; waited < PROBE_TIMEOUT_MS; waited += 10) {
+        uhid_drain();
+        if (n < 0) {
+            n = find_device();
+        }
+        if (n >= 0) {
+            snprintf(device_path, sizeof(device_path), DEVICE_PATH, n);
+            if (access(device_path, R_OK) == 0) {
+                snprintf(stats_dir, sizeof(stats_dir), CLASS_PATH "/logitech_mouse%d", n);
+                return 0;
+            }
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "Driver không nhận chuột ảo sau %d ms (module logitech_mouse đã được nạp chưa?)\n",
+            PROBE_TIMEOUT_MS);
+    return -1;
+}
+
+static void destroy_device(void) {
+    struct uhid_event ev = { .type = UHID_DESTROY };
+
+    if (uhid_fd >= 0) {
+        uhid_send(&ev, sizeof(ev));
+        close(uhid_fd);
+    }
+}
+
+static unsigned long long read_stat(const char *name) {
+    char path[160];
+    unsigned long long value = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", stats_dir, name);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%llu", &value) != 1) {
+            value = 0;
+        }
+        fclose(f);
+    }
+    return value;
+}
+
+static int write_attr(const char *name, unsigned int value) {
+    char path[160];
+
+    snprintf(path, sizeof(path), "%s/%s", stats_dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "%u\n", value);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int write_attr_string(const char *name, const char *value) {
+    char path[160];
+
+    snprintf(path, sizeof(path), "%s/%s", stats_dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "%s\n", value);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Giá trị đang chọn của thuộc tính dạng "a [b] c"
+static void read_choice(const char *name, char *value, size_t len) {
+    char path[160], line[128];
+    char *start, *end;
+
+    snprintf(value, len, "unknown");
+    snprintf(path, sizeof(path), "%s/%s", stats_dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+    if (fgets(line, sizeof(line), f) && (start = strchr(line, '[')) && (end = strchr(start, ']'))) {
+        *end = '\0';
+        snprintf(value, len, "%s", start + 1);
+    }
+    fclose(f);
+}
+
+static void read_counters(struct counters *c) {
+    c->enqueued_move = read_stat("stats/enqueued_move");
+    c->dropped = read_stat("stats/dropped");
+    c->reader_lost = read_stat("stats/reader_lost");
+    c->timer_fires = read_stat("stats/timer_fires");
+    c->timer_empty_fires = read_stat("stats/timer_empty_fires");
+    c->reader_wakeups = read_stat("stats/reader_wakeups");
+}
+
+static void *reader_main(void *arg) {
+    struct reader_state *rs = arg;
+    struct mouse_event_v2 batch[READ_BATCH];
+
+    while (1) {
+        unsigned int n = mouse_ring_read(rs->ring, batch, READ_BATCH);
+        if (n == 0) {
+            if (__atomic_load_n(&rs->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            mouse_ring_wait(rs->ring, 20);
+            continue;
+        }
+
+        uint64_t read_ns = now_ns();
+        for (unsigned int i = 0; i < n; i++) {
+            const struct mouse_event_v2 *e = &batch[i];
+            int type = MOUSE_EVENT_TYPE(e->info);
+
+            if (type == MOUSE_EVENT_GAP) {
+                rs->events[MOUSE_EVENT_GAP] += mouse_event_gap_count(e);
+                continue;
+            }
+            rs->events[type]++;
+            if (type == MOUSE_EVENT_MOVE) {
+                rs->dx += e->dx;
+                rs->dy += e->dy;
+                add_sample(&rs->coalesce, (int64_t)e->flush_delay_us * 1000);
+            }
+            uint64_t flushed = e->timestamp_ns + e->flush_delay_us * 1000ULL;
+            add_sample(&rs->latency, (int64_t)(read_ns - e->timestamp_ns));
+            add_sample(&rs->ring_time, read_ns > flushed ? (int64_t)(read_ns - flushed) : 0);
+        }
+    }
+    return NULL;
+}
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static const char *csv_header =
+    "build,kernel,rate_hz,mix,duration_s,report_interval_us,move_mode,aggregate_reports,reports,report_rate,move_reports,click_reports,"
+    "wheel_reports,events,event_rate,move_events,click_events,wheel_events,coalesce_ratio,timer_fires,"
+    "timer_empty_fires,reader_wakeups,gap_lost,dropped,reader_lost,drop_rate,click_missing,wheel_missing,"
+    "motion_error,lat_p50_us,lat_p90_us,lat_p99_us,lat_p999_us,lat_max_us,coalesce_p50_us,coalesce_p99_us,"
+    "ring_p50_us,ring_p99_us,inject_late_max_us";
+
+static void run(unsigned int rate, const struct mix *mix, double seconds, const char *build, const char *kernel,
+                FILE *out) {
+    struct reader_state rs = { 0 };
+    struct mouse_ring ring;
+    struct counters before, after;
+    pthread_t reader;
+    unsigned long long reports = 0, move_reports = 0, click_reports = 0, wheel_reports = 0;
+    long long dx_sum = 0, dy_sum = 0;
+    unsigned char buttons = 0;
+    uint32_t seed = 0x9e3779b9u ^ rate;
+    uint64_t period = 1000000000ULL / rate, max_late = 0;
+    unsigned int total = mix->move + mix->click + mix->wheel;
+    char mix_name[32], mode[32];
+
+    snprintf(mix_name, sizeof(mix_name), "%u:%u:%u", mix->move, mix->click, mix->wheel);
+    read_choice("move_mode", mode, sizeof(mode));
+    if (mouse_ring_open(&ring, device_path) < 0) {
+        fprintf(stderr, "Không mở được ring của %s: ", device_path);
+        perror(NULL);
+        return;
+    }
+    rs.ring = &ring;
+    read_counters(&before);
+    if (pthread_create(&reader, NULL, reader_main, &rs) != 0) {
+        perror("pthread_create");
+        mouse_ring_close(&ring);
+        return;
+    }
+
+    fprintf(stderr, "%u Hz, move:click:wheel = %s, %.1f s...\n", rate, mix_name, seconds);
+    uint64_t start = now_ns(), count = (uint64_t)(seconds * rate);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t due = start + i * period;
+        uint64_t now = now_ns();
+        if (due > now) {
+            struct timespec ts = { due / 1000000000ULL, due % 1000000000ULL };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            }
+        } else if (now - due > max_late) {
+            max_late = now - due;
+        }
+
+        unsigned int pick = xorshift(&seed) % total;
+        signed char dx = 0, dy = 0, wheel = 0;
+        if (pick < mix->move) {
+            // Delta ngẫu nhiên -8..8, luôn khác 0 trên ít nhất một trục
+            dx = (signed char)((int)(xorshift(&seed) % 17) - 8);
+            dy = (signed char)((int)(xorshift(&seed) % 17) - 8);
+            if (dx == 0 && dy == 0) {
+                dx = 1;
+            }
+            dx_sum += dx;
+            dy_sum += dy;
+            move_reports++;
+        } else if (pick < mix->move + mix->click) {
+            buttons ^= 1;
+            click_reports++;
+        } else {
+            wheel = xorshift(&seed) & 1 ? 1 : -1;
+            wheel_reports++;
+        }
+        if (send_report(buttons, dx, dy, wheel) < 0) {
+            break;
+        }
+        reports++;
+        if ((i & 1023) == 0) {
+            uhid_drain();
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    // Nhả nút nếu đang giữ để lần chạy sau bắt đầu từ cùng trạng thái
+    if (buttons && send_report(0, 0, 0, 0) == 0) {
+        click_reports++;
+        reports++;
+    }
+
+    usleep(read_stat("report_interval_us") + DRAIN_MS * 1000);
+    __atomic_store_n(&rs.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    read_counters(&after);
+    mouse_ring_close(&ring);
+
+    unsigned long long received = rs.events[MOUSE_EVENT_MOVE] + rs.events[MOUSE_EVENT_CLICK] +
+                                  rs.events[MOUSE_EVENT_WHEEL];
+    unsigned long long lost = rs.events[MOUSE_EVENT_GAP];
+    long long click_missing = (long long)click_reports - (long long)rs.events[MOUSE_EVENT_CLICK];
+    long long wheel_missing = (long long)wheel_reports - (long long)rs.events[MOUSE_EVENT_WHEEL];
+    long long motion_error = llabs(dx_sum - rs.dx) + llabs(dy_sum - rs.dy);
+    unsigned long long move_events = after.enqueued_move - before.enqueued_move;
+
+    qsort(rs.latency.values, rs.latency.count, sizeof(int64_t), compare_int64);
+    qsort(rs.coalesce.values, rs.coalesce.count, sizeof(int64_t), compare_int64);
+    qsort(rs.ring_time.values, rs.ring_time.count, sizeof(int64_t), compare_int64);
+
+    char row[1024];
+    snprintf(row, sizeof(row),
+             "%s,%s,%u,%s,%.3f,%llu,%s,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%.1f,%llu,%llu,%llu,%.2f,%llu,%llu,%llu,"
+             "%llu,%llu,%llu,%.6f,%lld,%lld,%lld,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+             build, kernel, rate, mix_name, elapsed, read_stat("report_interval_us"), mode,
+             read_stat("aggregate_reports"), reports, reports / elapsed,
+             move_reports, click_reports, wheel_reports, received, received / elapsed,
+             rs.events[MOUSE_EVENT_MOVE], rs.events[MOUSE_EVENT_CLICK], rs.events[MOUSE_EVENT_WHEEL],
+             move_events ? (double)move_reports / move_events : 0.0,
+             after.timer_fires - before.timer_fires, after.timer_empty_fires - before.timer_empty_fires,
+             after.reader_wakeups - before.reader_wakeups, lost, after.dropped - before.dropped,
+             after.reader_lost - before.reader_lost, received + lost ? (double)lost / (received + lost) : 0.0,
+             click_missing, wheel_missing, motion_error,
+             percentile_us(&rs.latency, 50), percentile_us(&rs.latency, 90), percentile_us(&rs.latency, 99),
+             percentile_us(&rs.latency, 99.9), percentile_us(&rs.latency, 100),
+             percentile_us(&rs.coalesce, 50), percentile_us(&rs.coalesce, 99),
+             percentile_us(&rs.ring_time, 50), percentile_us(&rs.ring_time, 99), max_late / 1000.0);
+    printf("%s\n", row);
+    fflush(stdout);
+    if (out) {
+        fprintf(out, "%s\n", row);
+        fflush(out);
+    }
+
+    free(rs.latency.values);
+    free(rs.coalesce.values);
+    free(rs.ring_time.values);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r rates] [-m move:click:wheel,...] [-d seconds] [-i report_interval_us] "
+            "[-M move_mode] [-N aggregate_reports] [-l build_label] [-o results.csv]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int rates[MAX_RUNS] = { 125, 1000, 8000 };
+    struct mix mixes[MAX_RUNS] = { { 100, 0, 0 }, { 96, 2, 2 } };
+    int rate_count = 3, mix_count = 2, interval = -1, aggregate = -1, opt;
+    double seconds = 5;
+    char build[64] = "unknown", *list, *tok;
+    const char *out_path = NULL, *move_mode = NULL;
+    FILE *out = NULL;
+    struct utsname uts;
+
+    // Nhãn mặc định: srcversion thay đổi mỗi khi mã nguồn module thay đổi
+    FILE *f = fopen("/sys/module/logitech_mouse/srcversion", "r");
+    if (f) {
+        if (fscanf(f, "%63s", build) != 1) {
+            strcpy(build, "unknown");
+        }
+        fclose(f);
+    }
+
+    while ((opt = getopt(argc, argv, "r:m:d:i:M:N:l:o:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate_count = 0;
+            list = optarg;
+            while ((tok = strsep(&list, ",")) && rate_count < MAX_RUNS) {
+                rates[rate_count] = strtoul(tok, NULL, 10);
+                if (rates[rate_count] < 1 || rates[rate_count] > 100000) {
+                    fprintf(stderr, "Tần số phải trong 1..100000 Hz\n");
+                    return EXIT_FAILURE;
+                }
+                rate_count++;
+            }
+            break;
+        case 'm':
+            mix_count = 0;
+            list = optarg;
+            while ((tok = strsep(&list, ",")) && mix_count < MAX_RUNS) {
+                struct mix *m = &mixes[mix_count];
+                if (sscanf(tok, "%u:%u:%u", &m->move, &m->click, &m->wheel) != 3 ||
+                    m->move + m->click + m->wheel == 0) {
+                    fprintf(stderr, "Tỉ lệ phải có dạng move:click:wheel, vd. 90:5:5\n");
+                    return EXIT_FAILURE;
+                }
+                mix_count++;
+            }
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'M':
+            move_mode = optarg;
+            break;
+        case 'N':
+            aggregate = atoi(optarg);
+            break;
+        case 'l':
+            snprintf(build, sizeof(build), "%s", optarg);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (seconds <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "a");
+        if (!out) {
+            perror(out_path);
+            return EXIT_FAILURE;
+        }
+        if (fseek(out, 0, SEEK_END) == 0 && ftell(out) == 0) {
+            fprintf(out, "%s\n", csv_header);
+        }
+    }
+    uname(&uts);
+
+    if (create_device() < 0) {
+        destroy_device();
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Chuột ảo là %s\n", device_path);
+    // move_mode sau aggregate_reports để MOVE đầu tiên đã dùng đúng N
+    if ((interval >= 0 && write_attr("report_interval_us", interval) < 0) ||
+        (aggregate >= 0 && write_attr("aggregate_reports", aggregate) < 0) ||
+        (move_mode && write_attr_string("move_mode", move_mode) < 0)) {
+        destroy_device();
+        return EXIT_FAILURE;
+    }
+
+    printf("%s\n", csv_header);
+    for (int r = 0; r < rate_count; r++) {
+        for (int m = 0; m < mix_count; m++) {
+            run(rates[r], &mixes[m], seconds, build, uts.release, out);
+        }
+    }
+
+    destroy_device();
+    if (out) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}